@@ -0,0 +1,969 @@
+#include "search_class.h"
+#include "ingest_pipeline.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <functional>
+
+using namespace std;
+using namespace chrono;
+
+// Генератор синтетических доков: термы из словаря с распределением, близким к Зипфу.
+// mixed - половина словаря записана кириллицей (цифры ранга - буквами), первая буква случайного регистра
+vector<vector<pair<string, string>>> generateCorpus(int doc_count, int vocabulary_size, unsigned seed = 42, bool mixed = false) {
+    mt19937 rng(seed);
+    // частота терма с рангом r пропорциональна 1 / r
+    vector<double> weights(vocabulary_size);
+    for (int r = 0; r < vocabulary_size; ++r) {
+        weights[r] = 1.0 / (r + 1);
+    }
+    discrete_distribution<int> term_dist(weights.begin(), weights.end());
+    uniform_int_distribution<int> title_len(3, 10);
+    uniform_int_distribution<int> content_len(50, 200);
+
+    auto makeText = [&](int length) {
+        string text;
+        for (int i = 0; i < length; ++i) {
+            if (i) text += ' ';
+            int rank = term_dist(rng);
+            if (!mixed || rank % 2 == 0) {
+                text += "w" + to_string(rank);
+                continue;
+            }
+            static const char* const letters[] = {"а", "б", "в", "г", "д", "е", "ж", "з", "и", "к"};
+            text += rng() % 2 ? "Р" : "р";
+            for (char digit : to_string(rank)) text += letters[digit - '0'];
+        }
+        return text;
+    };
+
+    vector<vector<pair<string, string>>> corpus;
+    corpus.reserve(doc_count);
+    for (int i = 0; i < doc_count; ++i) {
+        corpus.push_back({{"title", makeText(title_len(rng))}, {"content", makeText(content_len(rng))}});
+    }
+    return corpus;
+}
+
+// Время загрузки корпуса в пакетном режиме (beginBulkLoad / addDocument / commit)
+double measureBulkLoad(const vector<vector<pair<string, string>>>& corpus) {
+    auto start_time = high_resolution_clock::now();
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    for (const auto& doc : corpus) {
+        indexer.addDocument(doc);
+    }
+    indexer.commit();
+    auto end_time = high_resolution_clock::now();
+    return duration<double, milli>(end_time - start_time).count();
+}
+
+// Проверяем, что время загрузки растет линейно с размером корпуса
+void benchmarkLoadScaling() {
+    cout << "Load scaling (vocabulary 20000 terms)" << endl;
+    cout << "docs\tms\tus/doc" << endl;
+    for (int doc_count : {2500, 5000, 10000, 20000}) {
+        auto corpus = generateCorpus(doc_count, 20000);
+        double bulk_ms = measureBulkLoad(corpus);
+        cout << doc_count << "\t" << bulk_ms << "\t" << bulk_ms * 1000 / doc_count << endl;
+    }
+    cout << endl;
+}
+
+// Параллельная загрузка: время и ускорение от 1 потока до числа ядер
+// (результаты запросов сверяются с последовательной загрузкой)
+void benchmarkParallelLoad() {
+    const int doc_count = 40000;
+    auto corpus = generateCorpus(doc_count, 20000);
+    int max_threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+    TextIndexer serial;
+    serial.beginBulkLoad();
+    for (const auto& doc : corpus) {
+        serial.addDocument(doc);
+    }
+    serial.commit();
+
+    cout << "Parallel load (" << doc_count << " docs, " << max_threads << " hardware threads)" << endl;
+    cout << "threads\tms\tspeedup\tsame results" << endl;
+    // степени двойки до числа ядер и само число ядер
+    vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    double single_ms = 0;
+    for (int threads : thread_counts) {
+        auto start_time = high_resolution_clock::now();
+        TextIndexer indexer;
+        indexer.beginBulkLoad();
+        indexer.addDocuments(corpus, threads);
+        indexer.commit();
+        double ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+        if (threads == 1) single_ms = ms;
+
+        bool same = true;
+        for (string query : {"w3 AND w10", "w7 OR NOT w2", "title:w5 AND w9", "w1 NEAR/3 w2"}) {
+            same = same && indexer.executeQuery(query) == serial.executeQuery(query);
+        }
+        cout << threads << "\t" << ms << "\t" << single_ms / ms << "\t" << (same ? "yes" : "NO") << endl;
+    }
+    cout << endl;
+}
+
+// Регрессионный тест на квадратичную индексацию: 100k доков, в которых почти все
+// словоупотребления приходятся на несколько очень частых термов (как стоп-слова)
+void benchmarkCommonTerms() {
+    const int doc_count = 100000;
+    const int checkpoint = 10000;
+    mt19937 rng(7);
+    uniform_int_distribution<int> common_term(0, 4);
+    uniform_int_distribution<int> rare_term(0, 50000);
+
+    cout << "Common terms (" << doc_count << " docs, 5 terms cover ~90% of tokens)" << endl;
+    cout << "docs\tms per " << checkpoint << " docs" << endl;
+
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    auto start_time = high_resolution_clock::now();
+    for (int i = 1; i <= doc_count; ++i) {
+        string content;
+        for (int j = 0; j < 100; ++j) {
+            if (j) content += ' ';
+            content += j % 10 == 0 ? "r" + to_string(rare_term(rng)) : "c" + to_string(common_term(rng));
+        }
+        indexer.addDocument({{"title", "c0 c1 r" + to_string(rare_term(rng))}, {"content", content}});
+
+        // время на каждый следующий блок доков не должно расти вместе с df частых термов
+        if (i % checkpoint == 0) {
+            auto now = high_resolution_clock::now();
+            cout << i << "\t" << duration<double, milli>(now - start_time).count() << endl;
+            start_time = now;
+        }
+    }
+    indexer.commit();
+    cout << endl;
+}
+
+// случайный упорядоченный список из size разных doc_id в диапазоне [1, universe]
+vector<int> randomPostingList(int size, int universe, mt19937& rng) {
+    uniform_int_distribution<int> doc_dist(1, universe);
+    vector<int> list;
+    list.reserve(size * 2);
+    while ((int)list.size() < size) {
+        for (int i = 0; i < size; ++i) list.push_back(doc_dist(rng));
+        sort(list.begin(), list.end());
+        list.erase(unique(list.begin(), list.end()), list.end());
+    }
+    list.resize(size);
+    return list;
+}
+
+// Ядра попарного пересечения списков для сравнения: запросы движок пересекает деревом курсоров (query_cursor.h)
+
+// обычное слияние двумя указателями: O(|a| + |b|)
+vector<int> intersectLinear(const vector<int>& list1, const vector<int>& list2) {
+    vector<int> result;
+    size_t i = 0, j = 0;
+    while (i < list1.size() && j < list2.size()) {
+        if (list1[i] == list2[j]) {
+            result.push_back(list1[i]);
+            i++; j++;
+        } else if (list1[i] < list2[j]) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    return result;
+}
+
+// при меньшем перекосе длин списков обычное слияние быстрее прыжков
+constexpr size_t GALLOP_MIN_RATIO = 16;
+
+// вызов fn с курсором нужного типа по ссылке на список (без фильтра по полю)
+template <typename Fn>
+auto withCursor(const PostingRef& ref, Fn&& fn) {
+    if (ref.is_compressed) {
+        CompressedCursor cursor(ref.compressed);
+        return fn(cursor);
+    }
+    VectorCursor cursor(*ref.docs, ref.skips);
+    return fn(cursor);
+}
+
+template <typename Cursor1, typename Cursor2>
+vector<int> intersectCursors(Cursor1& cursor1, Cursor2& cursor2) {
+    vector<int> result;
+    while (!cursor1.atEnd() && !cursor2.atEnd()) {
+        if (cursor1.docId() == cursor2.docId()) {
+            result.push_back(cursor1.docId());
+            cursor1.next();
+            cursor2.next();
+        } else if (cursor1.docId() < cursor2.docId()) {
+            cursor1.advance(cursor2.docId());
+        } else {
+            cursor2.advance(cursor1.docId());
+        }
+    }
+    return result;
+}
+
+// пересечение с пропусками: отстающий список догоняет другой прыжками,
+// поэтому rare AND common стоит O(|small| * log(|large|)), а не O(|small| + |large|).
+// Сжатые списки распаковываются по блоку, блоки левее нужного doc_id пропускаются целиком
+vector<int> intersectSkipping(const PostingRef& ref1, const PostingRef& ref2) {
+    if (!ref1.is_compressed && !ref2.is_compressed &&
+        max(ref1.size(), ref2.size()) < GALLOP_MIN_RATIO * min(ref1.size(), ref2.size())) {
+        return intersectLinear(*ref1.docs, *ref2.docs);
+    }
+    return withCursor(ref1, [&](auto& cursor1) {
+        return withCursor(ref2, [&](auto& cursor2) { return intersectCursors(cursor1, cursor2); });
+    });
+}
+
+// Сравнение слияния двумя указателями с galloping и скип-указателями при разной длине списков
+void benchmarkIntersection() {
+    const int universe = 20000000;
+    const int large_size = 1000000;
+    mt19937 rng(11);
+    vector<int> large = randomPostingList(large_size, universe, rng);
+    SkipPointers large_skips = buildSkipPointers(large);
+    CompressedPostings large_compressed = CompressedPostings::encode(large);
+
+    cout << "Intersection, |large| = " << large_size << " (us per intersection)" << endl;
+    cout << "ratio\tlinear\tgalloping\tskip pointers\tcompressed blocks" << endl;
+    for (int ratio : {1, 10, 100, 1000, 10000}) {
+        vector<int> small = randomPostingList(large_size / ratio, universe, rng);
+        int repeats = max(5, ratio / 10);
+        size_t checksum = 0;
+
+        auto time = [&](auto&& run) {
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) checksum += run().size();
+            return duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+        };
+        double linear_us = time([&] { return intersectLinear(small, large); });
+        double galloping_us = time([&] { return intersectSkipping({&small, nullptr}, {&large, nullptr}); });
+        double skips_us = time([&] { return intersectSkipping({&small, nullptr}, {&large, &large_skips}); });
+        double compressed_us = time([&] { return intersectSkipping({&small, nullptr}, PostingRef::of(large_compressed.view())); });
+
+        cout << ratio << "\t" << linear_us << "\t" << galloping_us << "\t" << skips_us << "\t" << compressed_us
+             << "\t(" << checksum / (4 * repeats) << " matches)" << endl;
+    }
+    cout << endl;
+}
+
+// Отрицание: одиночный NOT и NOT внутри AND против такого же позитивного запроса
+void benchmarkNegation() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    for (const auto& doc : corpus) {
+        indexer.addDocument(doc);
+    }
+    indexer.commit();
+
+    cout << "Negation (20000 docs, us per query)" << endl;
+    for (string query : {"w3 AND w10", "w3 AND NOT w10", "NOT w10 AND w3", "NOT w10", "w500 AND NOT w0"}) {
+        const int repeats = 200;
+        size_t found = 0;
+        auto start_time = high_resolution_clock::now();
+        for (int r = 0; r < repeats; ++r) found = indexer.executeQuery(query).size();
+        double us = duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+        cout << query << "\t" << us << "\t(" << found << " docs)" << endl;
+    }
+    cout << endl;
+}
+
+// Сжатие списков doc_id: память на постинг и скорость распаковки блоков
+void benchmarkCompression() {
+    auto corpus = generateCorpus(20000, 20000);
+    cout << "Posting compression (20000 docs)" << endl;
+    cout << "mode\tload ms\tposting bytes\tus per query" << endl;
+    for (bool compress : {false, true}) {
+        auto start_time = high_resolution_clock::now();
+        TextIndexer indexer(compress);
+        indexer.beginBulkLoad();
+        for (const auto& doc : corpus) {
+            indexer.addDocument(doc);
+        }
+        indexer.commit();
+        double load_ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+
+        const int repeats = 100;
+        start_time = high_resolution_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (string query : {"w3 AND w10", "w1000 AND w1", "w50 AND w7 AND NOT w2", "title:w5 AND w9"}) {
+                indexer.executeQuery(query);
+            }
+        }
+        double query_us = duration<double, micro>(high_resolution_clock::now() - start_time).count() / (4 * repeats);
+        cout << (compress ? "compressed" : "raw") << "\t" << load_ms << "\t" << indexer.postingMemoryBytes()
+             << "\t" << query_us << endl;
+    }
+
+    // распаковка: SSE против скалярного кода на одном и том же списке
+    mt19937 rng(5);
+    vector<int> list = randomPostingList(1000000, 20000000, rng);
+    CompressedPostings compressed = CompressedPostings::encode(list);
+    cout << "1M doc ids: " << list.size() * sizeof(int) << " raw bytes, " << compressed.memoryBytes()
+         << " compressed bytes" << endl;
+
+    alignas(16) uint32_t values[POSTING_BLOCK_SIZE];
+    for (int scalar = 0; scalar < 2; ++scalar) {
+        uint64_t checksum = 0;
+        auto start_time = high_resolution_clock::now();
+        for (int r = 0; r < 20; ++r) {
+            for (size_t block = 0; block < compressed.block_last.size(); ++block) {
+                uint32_t base = block ? compressed.block_last[block - 1] : 0;
+                const uint32_t* in = compressed.data.data() + compressed.block_offset[block];
+                if (scalar) {
+                    unpackBlockScalar(in, compressed.block_width[block], POSTING_BLOCK_SIZE / POSTING_BLOCK_LANES, base, values);
+                } else {
+                    unpackBlock(in, compressed.block_width[block], POSTING_BLOCK_SIZE / POSTING_BLOCK_LANES, base, values);
+                }
+                checksum += values[POSTING_BLOCK_SIZE - 1];
+            }
+        }
+        double ns = duration<double, nano>(high_resolution_clock::now() - start_time).count();
+        cout << (scalar ? "scalar" : "simd") << " decode: " << 20.0 * list.size() / ns * 1000
+             << " M ints/s (checksum " << checksum << ")" << endl;
+    }
+    cout << endl;
+}
+
+// NEAR/ADJ по плоскому координатному индексу: пропускная способность и память под позиции
+void benchmarkProximity() {
+    auto corpus = generateCorpus(20000, 20000);
+    cout << "Proximity (20000 docs, us per query)" << endl;
+    for (bool compress : {false, true}) {
+        TextIndexer indexer(compress);
+        indexer.beginBulkLoad();
+        for (const auto& doc : corpus) {
+            indexer.addDocument(doc);
+        }
+        indexer.commit();
+        cout << (compress ? "compressed" : "raw") << ": positional lists "
+             << indexer.positionalMemoryBytes() / (1024 * 1024) << " MB" << endl;
+
+        for (string query : {"w1 NEAR/3 w2", "w5 ADJ/1 w0", "w100 NEAR/5 w3", "title:w1 NEAR/2 title:w4"}) {
+            const int repeats = 100;
+            size_t found = 0;
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) found = indexer.executeQuery(query).size();
+            double us = duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+            cout << query << "\t" << us << "\t(" << found << " docs)" << endl;
+        }
+    }
+    cout << endl;
+}
+
+// Перезапуск: индексация с нуля против подключения сохраненного сегмента через mmap
+void benchmarkSegmentLoad() {
+    auto corpus = generateCorpus(20000, 20000);
+    const string path = "benchmark.seg";
+    cout << "Segment load (20000 docs)" << endl;
+
+    auto start_time = high_resolution_clock::now();
+    {
+        TextIndexer indexer;
+        indexer.beginBulkLoad();
+        for (const auto& doc : corpus) {
+            indexer.addDocument(doc);
+        }
+        indexer.commit();
+        cout << "reindex ms\t" << duration<double, milli>(high_resolution_clock::now() - start_time).count() << endl;
+        indexer.saveSegment(path);
+    }
+
+    start_time = high_resolution_clock::now();
+    TextIndexer loaded;
+    loaded.loadSegment(path);
+    size_t found = loaded.executeQuery("w3 AND w10").size();
+    cout << "mmap load + first query ms\t" << duration<double, milli>(high_resolution_clock::now() - start_time).count()
+         << "\t(" << found << " docs)" << endl;
+
+    const int repeats = 100;
+    start_time = high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r) {
+        for (string query : {"w3 AND w10", "w1000 AND w1", "w50 AND w7 AND NOT w2", "w1 NEAR/3 w2"}) {
+            loaded.executeQuery(query);
+        }
+    }
+    cout << "us per query from segment\t"
+         << duration<double, micro>(high_resolution_clock::now() - start_time).count() / (4 * repeats) << endl;
+    remove(path.c_str());
+    cout << endl;
+}
+
+// Запросы из нескольких потоков по снимкам, пока писатель дописывает и публикует новые доки
+void benchmarkConcurrentQueries() {
+    auto corpus = generateCorpus(24000, 20000);
+    vector<vector<pair<string, string>>> initial(corpus.begin(), corpus.begin() + 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    indexer.addDocuments(initial);
+    indexer.commit();
+
+    int max_threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    cout << "Concurrent queries during ingestion (20000 docs + live feed)" << endl;
+    cout << "reader threads\tqueries/s\tdocs ingested" << endl;
+    size_t next_doc = initial.size();
+    for (int readers = 1; readers <= max_threads; readers *= 2) {
+        atomic<bool> done(false);
+        atomic<size_t> queries(0);
+        vector<thread> workers;
+        for (int r = 0; r < readers; ++r) {
+            workers.emplace_back([&] {
+                const string patterns[] = {"w3 AND w10", "w1000 AND w1", "w50 AND w7 AND NOT w2", "w1 NEAR/3 w2"};
+                size_t local = 0;
+                while (!done) {
+                    indexer.snapshot()->executeQuery(patterns[local % 4]);
+                    local++;
+                }
+                queries += local;
+            });
+        }
+
+        // писатель: по одному доку, публикация каждые 100 доков, пока читатели работают 1 секунду
+        size_t ingested = 0;
+        auto start_time = high_resolution_clock::now();
+        while (duration<double>(high_resolution_clock::now() - start_time).count() < 1.0) {
+            if (next_doc < corpus.size()) {
+                indexer.addDocument(corpus[next_doc++]);
+                if (++ingested % 100 == 0) indexer.publish();
+            } else {
+                this_thread::sleep_for(milliseconds(1));
+            }
+        }
+        done = true;
+        for (auto& worker : workers) worker.join();
+        double seconds = duration<double>(high_resolution_clock::now() - start_time).count();
+        cout << readers << "\t" << queries / seconds << "\t" << ingested << endl;
+    }
+    cout << endl;
+}
+
+// top-10 по BM25: WAND против полного перебора (оценка всех найденных доков + сортировка)
+void benchmarkRanking() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+    auto snapshot = indexer.snapshot();
+    size_t document_count = snapshot->documentCount();
+
+    const string queries[] = {"w1000 OR w5", "w3 OR w70 OR w900", "w1 OR w2 OR w3 OR w4", "w10 OR w2000 OR w15000",
+                              "w7 w300 OR w8"};
+    const int repeats = 20;
+    cout << "BM25 top-10 (20000 docs)" << endl;
+    cout << "query\tWAND ms\texhaustive ms" << endl;
+    for (const string& query : queries) {
+        double time[2];
+        for (int exhaustive = 0; exhaustive < 2; ++exhaustive) {
+            // k = число доков: порог не растет, и оценивается каждый найденный док
+            size_t k = exhaustive ? document_count : 10;
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) snapshot->executeQuery(query, k);
+            time[exhaustive] = duration<double, milli>(high_resolution_clock::now() - start_time).count() / repeats;
+        }
+        cout << query << "\t" << time[0] << "\t" << time[1] << endl;
+    }
+    cout << endl;
+}
+
+// потоковая выдача: первая страница и подсчет без сбора doc_id против полного результата
+void benchmarkStreaming() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+
+    const string queries[] = {"w3 AND w10", "w1 OR w2 OR w3", "NOT w1", "w1 NEAR/3 w2", "(w1 OR w2) AND w100"};
+    const int repeats = 50;
+    auto time = [&](auto&& fn) {
+        auto start_time = high_resolution_clock::now();
+        for (int r = 0; r < repeats; ++r) fn();
+        return duration<double, milli>(high_resolution_clock::now() - start_time).count() / repeats;
+    };
+    cout << "Streaming results (20000 docs)" << endl;
+    cout << "query\tfound\tall ms\tfirst 10 ms\tcount ms" << endl;
+    for (const string& query : queries) {
+        size_t found = indexer.countQuery(query);
+        double all_ms = time([&] { indexer.executeQuery(query); });
+        double page_ms = time([&] { indexer.executeQueryPage(query, 0, 10); });
+        double count_ms = time([&] { indexer.countQuery(query); });
+        cout << query << "\t" << found << "\t" << all_ms << "\t" << page_ms << "\t" << count_ms << endl;
+    }
+    cout << endl;
+}
+
+// подстановки: раскрытие по словарю + OR всех подходящих термов (широкий OR сливается в битовую карту)
+void benchmarkWildcards() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+
+    // w1999* раскрывается в 11 термов - сравниваем с тем же OR, записанным явно
+    string explicit_or = "w1999";
+    for (int d = 0; d < 10; ++d) explicit_or += " OR w1999" + to_string(d);
+    const string queries[] = {"w1999*", explicit_or, "w12*", "w1*", "*99", "w1* AND w2*"};
+    const int repeats = 20;
+    cout << "Wildcard queries (20000 docs, 20000 terms)" << endl;
+    cout << "query\tfound\tms" << endl;
+    for (const string& query : queries) {
+        size_t found = indexer.countQuery(query);
+        auto start_time = high_resolution_clock::now();
+        for (int r = 0; r < repeats; ++r) indexer.countQuery(query);
+        double ms = duration<double, milli>(high_resolution_clock::now() - start_time).count() / repeats;
+        cout << (query.size() > 24 ? query.substr(0, 21) + "..." : query) << "\t" << found << "\t" << ms << endl;
+    }
+    cout << endl;
+}
+
+// повторяющиеся запросы: первый вызов считает результат, следующие берут его из кэша.
+// Для сравнения тот же поток запросов без кэша (объем 0)
+void benchmarkQueryCache() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer;
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+
+    const string queries[] = {"w1 OR w2 OR w3", "NOT w1", "w1 NEAR/3 w2", "(w1 OR w2) AND NOT (w3 ADJ/2 w4)", "w1*"};
+    auto run = [&](const string& query, int repeats) {
+        auto start_time = high_resolution_clock::now();
+        for (int r = 0; r < repeats; ++r) indexer.executeQuery(query);
+        return duration<double, milli>(high_resolution_clock::now() - start_time).count() / repeats;
+    };
+    cout << "Query cache (20000 docs)" << endl;
+    cout << "query\tno cache ms\tfirst call ms\tcached ms" << endl;
+    for (const string& query : queries) {
+        indexer.setQueryCacheCapacity(0);
+        double uncached_ms = run(query, 20);
+        indexer.setQueryCacheCapacity(DEFAULT_QUERY_CACHE_BYTES);
+        double first_ms = run(query, 1);
+        double cached_ms = run(query, 1000);
+        cout << query << "\t" << uncached_ms << "\t" << first_ms << "\t" << cached_ms << endl;
+    }
+    QueryCacheStats stats = indexer.queryCacheStats();
+    cout << "hits " << stats.hits << ", misses " << stats.misses << ", evictions " << stats.evictions
+         << ", entries " << stats.entries << ", " << stats.bytes / 1024 << " KB" << endl;
+    cout << endl;
+}
+
+// токенизация с нормализацией: блочная по маске разделителей с таблицей свертки регистра UTF-8
+// против прежнего посимвольного разбора (копии токенов, isalnum/tolower), и полная индексация того же текста.
+// На смешанном русско-английском тексте прежний разбор выбрасывает кириллицу, поэтому число термов у него другое
+void benchmarkTokenizer() {
+    for (bool mixed : {false, true}) {
+        auto corpus = generateCorpus(20000, 20000, 42, mixed);
+        string text;
+        for (const auto& doc : corpus) {
+            for (const auto& [field, value] : doc) text += value + ". ";
+        }
+        double megabytes = text.size() / 1048576.0;
+
+        auto measure = [&](auto&& tokenize_pass) {
+            auto start_time = high_resolution_clock::now();
+            size_t terms = tokenize_pass();
+            double ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+            return make_pair(terms, ms);
+        };
+        auto [block_terms, block_ms] = measure([&] {
+            size_t terms = 0;
+            string term;
+            forEachToken(text, [&](string_view token) {
+                normalizeTerm(token, term);
+                terms += !term.empty();
+            });
+            return terms;
+        });
+        auto [scalar_terms, scalar_ms] = measure([&] {
+            size_t terms = 0;
+            string token;
+            auto flush = [&] {
+                string term;
+                for (char c : token) {
+                    if (isalnum(c)) term += tolower(c);
+                }
+                terms += !term.empty();
+                token.clear();
+            };
+            for (char c : text) {
+                if (isDelimiter(c)) {
+                    if (!token.empty()) flush();
+                } else {
+                    token += c;
+                }
+            }
+            if (!token.empty()) flush();
+            return terms;
+        });
+
+        cout << "Tokenizer, " << (mixed ? "mixed Russian/English" : "English") << " text (" << megabytes << " MB)" << endl;
+        cout << "variant\tterms\tms\tMB/s" << endl;
+        cout << "block\t" << block_terms << "\t" << block_ms << "\t" << megabytes * 1000 / block_ms << endl;
+        cout << "byte loop\t" << scalar_terms << "\t" << scalar_ms << "\t" << megabytes * 1000 / scalar_ms << endl;
+        double index_ms = measureBulkLoad(corpus);
+        cout << "indexing\t" << block_terms << "\t" << index_ms << "\t" << megabytes * 1000 / index_ms << endl;
+        cout << endl;
+    }
+}
+
+// корпус в CSV: содержание - цитата в кавычках (""), каждые 50 слов - новая строка внутри поля
+void writeCorpusCsv(const vector<vector<pair<string, string>>>& corpus, const string& path) {
+    ofstream out(path, ios::binary);
+    out << "id,title,content\r\n";
+    int id = 0;
+    for (const auto& doc : corpus) {
+        string content = doc[1].second;
+        size_t words = 0;
+        for (char& c : content) {
+            if (c == ' ' && ++words % 50 == 0) c = '\n';
+        }
+        out << ++id << ",\"" << doc[0].second << "\",\"\"\"" << content << "\"\"\"\r\n";
+    }
+}
+
+// разбор CSV: отображенный файл без копирования полей против чтения по строкам с копированием
+// каждого символа (как раньше в test.cpp). Поля в кавычках с "" и переводами строк внутри
+void benchmarkCsvParsing() {
+    auto corpus = generateCorpus(20000, 20000);
+    string path = "benchmark_corpus.csv";
+    writeCorpusCsv(corpus, path);
+
+    auto start_time = high_resolution_clock::now();
+    size_t mapped_rows = 0;
+    size_t mapped_bytes = 0;
+    {
+        MappedFile file;
+        file.open(path);
+        CsvReader reader(file.data(), file.size());
+        vector<string_view> fields;
+        while (reader.next(fields)) {
+            mapped_rows++;
+            for (string_view field : fields) mapped_bytes += field.size();
+        }
+    }
+    double mapped_ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+
+    start_time = high_resolution_clock::now();
+    size_t line_rows = 0;
+    size_t line_bytes = 0;
+    {
+        ifstream file(path);
+        string line;
+        while (getline(file, line)) {
+            line_rows++;
+            vector<string> fields;
+            string current_field;
+            bool in_quotes = false;
+            for (char c : line) {
+                if (c == '"') {
+                    in_quotes = !in_quotes;
+                } else if (c == ',' && !in_quotes) {
+                    fields.push_back(current_field);
+                    current_field.clear();
+                } else {
+                    current_field += c;
+                }
+            }
+            fields.push_back(current_field);
+            for (const string& field : fields) line_bytes += field.size();
+        }
+    }
+    double line_ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+
+    ifstream size_probe(path, ios::binary | ios::ate);
+    double megabytes = static_cast<double>(size_probe.tellg()) / 1048576.0;
+    remove(path.c_str());
+
+    cout << "CSV parsing (" << megabytes << " MB, " << corpus.size() << " docs)" << endl;
+    cout << "variant\trecords\tfield bytes\tms\tMB/s" << endl;
+    cout << "mapped\t" << mapped_rows << "\t" << mapped_bytes << "\t" << mapped_ms << "\t" << megabytes * 1000 / mapped_ms << endl;
+    // построчный разбор режет записи на переводах строк внутри кавычек
+    cout << "getline\t" << line_rows << "\t" << line_bytes << "\t" << line_ms << "\t" << megabytes * 1000 / line_ms << endl;
+    cout << endl;
+}
+
+// загрузка CSV: сначала разбор всего файла, потом индексация (как было) против конвейера
+// разбор -> токенизация -> запись; по счетчикам стадий видно, какая из них узкое место
+void benchmarkIngestPipeline() {
+    auto corpus = generateCorpus(40000, 20000);
+    string path = "benchmark_corpus.csv";
+    writeCorpusCsv(corpus, path);
+
+    auto start_time = high_resolution_clock::now();
+    size_t sequential_docs = 0;
+    {
+        MappedFile file;
+        file.open(path);
+        CsvReader reader(file.data(), file.size());
+        vector<string_view> fields;
+        vector<DocumentView> documents;
+        reader.next(fields);
+        while (reader.next(fields)) documents.push_back({{"title", fields[1]}, {"content", fields[2]}});
+        TextIndexer indexer;
+        indexer.beginBulkLoad();
+        sequential_docs = indexer.addDocuments(documents).size();
+        indexer.commit();
+    }
+    double sequential_ms = duration<double, milli>(high_resolution_clock::now() - start_time).count();
+
+    cout << "Ingestion pipeline (" << corpus.size() << " docs, " << thread::hardware_concurrency() << " cores)" << endl;
+    cout << "variant\tdocs\tms" << endl;
+    cout << "parse, then index\t" << sequential_docs << "\t" << sequential_ms << endl;
+    for (int workers : {1, 2, 4}) {
+        TextIndexer indexer;
+        CsvIngestOptions options;
+        options.worker_count = workers;
+        CsvIngestPipeline pipeline(indexer, options);
+        size_t docs = pipeline.run(path);
+        IngestStats stats = pipeline.stats();
+        cout << "pipeline, " << workers << " tokenizers\t" << docs << "\t" << stats.elapsed_ms << endl;
+        cout << "  stage\tbusy ms\tinput wait ms\toutput wait ms\tdocs/s busy" << endl;
+        auto printStage = [](const string& name, const IngestStageStats& stage) {
+            cout << "  " << name << "\t" << stage.busy_ms << "\t" << stage.input_wait_ms << "\t" << stage.output_wait_ms << "\t"
+                 << (stage.busy_ms > 0 ? stage.documents * 1000 / stage.busy_ms : 0) << endl;
+        };
+        printStage("parse", stats.parse);
+        printStage("tokenize", stats.tokenize);
+        printStage("write", stats.write);
+        cout << "  max queue depth: parsed " << stats.parsed_queue.max_depth << "/" << stats.parsed_queue.capacity
+             << ", indexed " << stats.indexed_queue.max_depth << "/" << stats.indexed_queue.capacity << endl;
+    }
+    remove(path.c_str());
+    cout << endl;
+}
+
+// удаление доков: задержка запросов при растущей доле удаленных, пока они отсеиваются картой (надгробия)
+// и после уплотнения, которое переписывает части без них; время уплотнения и память под списки
+void benchmarkDeletes() {
+    auto corpus = generateCorpus(20000, 20000);
+    const string queries[] = {"w3 AND w10", "NOT w10", "w1 NEAR/3 w2"};
+    const string ranked_query = "w1 OR w2 OR w50";
+
+    cout << "Deletes (20000 docs, us per query, cache off)" << endl;
+    cout << "deleted\tstate";
+    for (const string& query : queries) cout << "\t" << query;
+    cout << "\ttop10 " << ranked_query << "\tcount w1\tpostings KB\tcompact ms" << endl;
+    for (double ratio : {0.0, 0.1, 0.25, 0.5, 0.75}) {
+        TextIndexer indexer;
+        indexer.setQueryCacheCapacity(0);
+        indexer.beginBulkLoad();
+        indexer.addDocuments(corpus);
+        indexer.commit();
+
+        // удаляем случайные доки (одинаковые при каждом запуске)
+        mt19937 rng(7);
+        vector<int> doc_ids(corpus.size());
+        iota(doc_ids.begin(), doc_ids.end(), 1);
+        shuffle(doc_ids.begin(), doc_ids.end(), rng);
+        for (size_t i = 0; i < static_cast<size_t>(ratio * corpus.size()); ++i) indexer.deleteDocument(doc_ids[i]);
+        indexer.publish();
+
+        auto measure = [](auto&& run, int repeats) {
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) run();
+            return duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+        };
+        auto report = [&](const string& state, double compact_ms) {
+            cout << static_cast<int>(ratio * 100) << "%\t" << state;
+            for (const string& query : queries) cout << "\t" << measure([&] { indexer.executeQuery(query); }, 50);
+            cout << "\t" << measure([&] { indexer.executeQuery(ranked_query, 10); }, 50);
+            cout << "\t" << measure([&] { indexer.countQuery("w1"); }, 200);
+            cout << "\t" << indexer.postingMemoryBytes() / 1024 << "\t" << compact_ms << endl;
+        };
+        report("tombstones", 0);
+        if (ratio == 0.0) continue;
+
+        auto start_time = high_resolution_clock::now();
+        indexer.compact();
+        report("compacted", duration<double, milli>(high_resolution_clock::now() - start_time).count());
+    }
+    cout << endl;
+}
+
+void benchmarkSustainedIngestion() {
+    const int window = 25000;
+    auto corpus = generateCorpus(8 * window, 50000);
+
+    cout << "Sustained ingestion (addDocument, docs/s and worst add in us per window of " << window << " docs)" << endl;
+    cout << "policy\tindexed\tdocs/s\tmax add us\tparts" << endl;
+    // 0 - все доки в одной растущей части; иначе запечатывание по порогу и ярусные слияния в фоне
+    for (size_t flush_documents : {size_t(0), size_t(4096), DEFAULT_FLUSH_DOCUMENTS}) {
+        TextIndexer indexer;
+        indexer.setMergePolicy(flush_documents);
+        string policy = flush_documents == 0 ? "single part" : "flush " + to_string(flush_documents);
+        for (size_t begin = 0; begin < corpus.size(); begin += window) {
+            double max_add_us = 0;
+            auto start_time = high_resolution_clock::now();
+            for (size_t i = begin; i < begin + window; ++i) {
+                auto add_start = high_resolution_clock::now();
+                indexer.addDocument(corpus[i]);
+                max_add_us = max(max_add_us, duration<double, micro>(high_resolution_clock::now() - add_start).count());
+            }
+            double seconds = duration<double>(high_resolution_clock::now() - start_time).count();
+            cout << policy << "\t" << begin + window << "\t" << static_cast<int>(window / seconds) << "\t"
+                 << static_cast<int>(max_add_us) << "\t" << indexer.snapshot()->parts.size() << endl;
+        }
+    }
+    cout << endl;
+}
+
+void benchmarkPhrases() {
+    auto corpus = generateCorpus(20000, 20000);
+    // N-термный оператор против прежнего обходного пути - AND попарных ADJ/NEAR (он еще и находит лишнее)
+    const pair<string, string> queries[] = {
+        {"\"w1 w2 w3\"", "(w1 ADJ/1 w2) AND (w2 ADJ/1 w3)"},
+        {"\"w0 w1 w2 w3\"", "(w0 ADJ/1 w1) AND (w1 ADJ/1 w2) AND (w2 ADJ/1 w3)"},
+        {"\"w700 w1 w2\"", "(w700 ADJ/1 w1) AND (w1 ADJ/1 w2)"},
+        {"w1 NEAR/5 w2 NEAR/5 w3", "(w1 NEAR/5 w2) AND (w2 NEAR/5 w3) AND (w1 NEAR/5 w3)"},
+        {"w1 ADJ/6 w2 ADJ/6 w3", "(w1 ADJ/6 w2) AND (w2 ADJ/6 w3)"},
+    };
+
+    cout << "Phrases and N-term proximity (20000 docs, us per query, cache off)" << endl;
+    cout << "index\tquery\tus\tdocs\tpairwise us\tpairwise docs" << endl;
+    for (bool compress : {false, true}) {
+        TextIndexer indexer(compress);
+        indexer.setQueryCacheCapacity(0);
+        indexer.beginBulkLoad();
+        indexer.addDocuments(corpus);
+        indexer.commit();
+
+        auto measure = [&](const string& query, size_t& found) {
+            const int repeats = 50;
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) found = indexer.executeQuery(query).size();
+            return duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+        };
+        for (const auto& [query, pairwise] : queries) {
+            size_t found = 0, pairwise_found = 0;
+            double us = measure(query, found);
+            double pairwise_us = measure(pairwise, pairwise_found);
+            cout << (compress ? "compressed" : "raw") << "\t" << query << "\t" << us << "\t" << found << "\t"
+                 << pairwise_us << "\t" << pairwise_found << endl;
+        }
+    }
+    cout << endl;
+}
+
+void benchmarkQueryProfiling() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer(true);
+    indexer.setQueryCacheCapacity(0);
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+
+    // цена профиля: запрос без метрик, с метриками (профиль каждого запроса) и с EXPLAIN
+    const string queries[] = {"w1 AND w2", "w1 OR w2 OR w3", "w1 AND NOT w2", "\"w1 w2\"", "w1* AND w2"};
+    cout << "Query profiling overhead (20000 docs, compressed, us per query, cache off)" << endl;
+    cout << "query	plain us	metrics us	explain us	plan nodes" << endl;
+    for (const string& query : queries) {
+        const int repeats = 200;
+        auto measure = [&](auto&& run) {
+            auto start_time = high_resolution_clock::now();
+            for (int r = 0; r < repeats; ++r) run();
+            return duration<double, micro>(high_resolution_clock::now() - start_time).count() / repeats;
+        };
+        size_t nodes = 0;
+        function<void(const QueryProfileNode&)> countNodes = [&](const QueryProfileNode& node) {
+            nodes++;
+            for (const auto& child : node.children) countNodes(*child);
+        };
+
+        indexer.setQueryProfiling(false);
+        double plain_us = measure([&] { indexer.executeQuery(query); });
+        indexer.setQueryProfiling(true);
+        double metrics_us = measure([&] { indexer.executeQuery(query); });
+        indexer.setQueryProfiling(false);
+        double explain_us = measure([&] { indexer.profileQuery(query); });
+        countNodes(indexer.profileQuery(query).plan);
+        cout << query << "\t" << plain_us << "\t" << metrics_us << "\t" << explain_us << "\t" << nodes << endl;
+    }
+    cout << endl;
+}
+
+void benchmarkStoredText() {
+    auto corpus = generateCorpus(20000, 20000);
+    TextIndexer indexer(true);
+    indexer.beginBulkLoad();
+    indexer.addDocuments(corpus);
+    indexer.commit();
+
+    // тексты доков: объем до сжатия и в хранилище (без учета накладных расходов хеш-таблицы, которая была раньше)
+    size_t raw_bytes = indexer.storedTextRawBytes();
+    size_t stored_bytes = indexer.storedTextMemoryBytes();
+    cout << "Stored text (20000 docs): raw " << raw_bytes / 1024 << " KB, stored " << stored_bytes / 1024 << " KB ("
+         << 100.0 * stored_bytes / raw_bytes << "%)" << endl;
+
+    // чтение текстов по случайным докам: копия через индексатор, без копирования из снимка, фрагмент под запрос
+    mt19937 rng(7);
+    vector<int> doc_ids(2000);
+    for (int& doc_id : doc_ids) doc_id = 1 + rng() % corpus.size();
+    auto measure = [&](auto&& read) {
+        size_t bytes = 0;
+        auto start_time = high_resolution_clock::now();
+        for (int doc_id : doc_ids) bytes += read(doc_id);
+        double us = duration<double, micro>(high_resolution_clock::now() - start_time).count() / doc_ids.size();
+        return make_pair(us, bytes / doc_ids.size());
+    };
+    auto snapshot = indexer.snapshot();
+    string buffer;
+    cout << "access\tus per doc\tbytes per doc" << endl;
+    const pair<string, function<size_t(int)>> readers[] = {
+        {"getDocumentTitle", [&](int doc_id) { return indexer.getDocumentTitle(doc_id).size(); }},
+        {"getDocumentContent", [&](int doc_id) { return indexer.getDocumentContent(doc_id).size(); }},
+        {"snapshot title view", [&](int doc_id) {
+            string_view text;
+            return snapshot->documentText(StoredField::TITLE, doc_id, buffer, text) ? text.size() : 0;
+        }},
+        {"snapshot content view", [&](int doc_id) {
+            string_view text;
+            return snapshot->documentText(StoredField::CONTENT, doc_id, buffer, text) ? text.size() : 0;
+        }},
+        {"snippet \"w1 AND w5\"", [&](int doc_id) { return snapshot->getDocumentSnippet(doc_id, "w1 AND w5").size(); }},
+    };
+    for (const auto& [name, read] : readers) {
+        auto [us, bytes] = measure(read);
+        cout << name << "\t" << us << "\t" << bytes << endl;
+    }
+    cout << endl;
+}
+
+int main() {
+    benchmarkLoadScaling();
+    benchmarkParallelLoad();
+    benchmarkCommonTerms();
+    benchmarkIntersection();
+    benchmarkNegation();
+    benchmarkCompression();
+    benchmarkProximity();
+    benchmarkSegmentLoad();
+    benchmarkConcurrentQueries();
+    benchmarkRanking();
+    benchmarkStreaming();
+    benchmarkWildcards();
+    benchmarkQueryCache();
+    benchmarkTokenizer();
+    benchmarkCsvParsing();
+    benchmarkIngestPipeline();
+    benchmarkDeletes();
+    benchmarkSustainedIngestion();
+    benchmarkPhrases();
+    benchmarkQueryProfiling();
+    benchmarkStoredText();
+    return 0;
+}
@@ -0,0 +1,151 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// ожидание без блокировок: сначала уступаем ядро, затем засыпаем на короткое время,
+// чтобы простаивающая стадия не отнимала процессор у занятых
+class Backoff {
+private:
+    int attempts = 0;
+
+public:
+    void wait() {
+        if (attempts < 64) {
+            ++attempts;
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+};
+
+// Ограниченная очередь без блокировок для нескольких писателей и читателей (кольцо Вьюкова):
+// у каждой ячейки свой счетчик, по которому писатель видит, что ячейка свободна, а читатель - что заполнена.
+// push ждет свободного места (так медленная стадия притормаживает предыдущую), pop - элемента.
+// Время ожидания с обеих сторон и наибольшая глубина копятся для счетчиков конвейера
+template <typename T>
+class BoundedQueue {
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueue_position;
+    alignas(64) atomic<size_t> dequeue_position;
+    alignas(64) atomic<size_t> max_depth;
+    atomic<uint64_t> push_wait_ns;
+    atomic<uint64_t> pop_wait_ns;
+
+    static uint64_t nanosecondsSince(chrono::steady_clock::time_point start) {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    // емкость округляется вверх до степени двойки
+    explicit BoundedQueue(size_t capacity)
+        : enqueue_position(0), dequeue_position(0), max_depth(0), push_wait_ns(0), pop_wait_ns(0) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // false, если очередь полна (value тогда не тронут)
+    bool tryPush(T& value) {
+        size_t position = enqueue_position.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    cell.value = move(value);
+                    cell.sequence.store(position + 1, memory_order_release);
+                    // позиция другого писателя может быть впереди своей, поэтому глубина - по обоим счетчикам
+                    size_t current = min(depth(), capacity());
+                    size_t seen = max_depth.load(memory_order_relaxed);
+                    while (current > seen && !max_depth.compare_exchange_weak(seen, current, memory_order_relaxed)) {}
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueue_position.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // false, если очередь пуста
+    bool tryPop(T& out) {
+        size_t position = dequeue_position.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    out = move(cell.value);
+                    cell.sequence.store(position + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = dequeue_position.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(T value) {
+        if (tryPush(value)) return;
+        auto start = chrono::steady_clock::now();
+        Backoff backoff;
+        do {
+            backoff.wait();
+        } while (!tryPush(value));
+        push_wait_ns += nanosecondsSince(start);
+    }
+
+    T pop() {
+        T value;
+        if (tryPop(value)) return value;
+        auto start = chrono::steady_clock::now();
+        Backoff backoff;
+        do {
+            backoff.wait();
+        } while (!tryPop(value));
+        pop_wait_ns += nanosecondsSince(start);
+        return value;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // число элементов сейчас (приблизительно, пока писатели и читатели работают)
+    size_t depth() const {
+        size_t enqueued = enqueue_position.load(memory_order_relaxed);
+        size_t dequeued = dequeue_position.load(memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t maxDepth() const { return max_depth.load(memory_order_relaxed); }
+    // суммарное время, которое писатели ждали места, а читатели - элементов
+    uint64_t pushWaitNanoseconds() const { return push_wait_ns.load(memory_order_relaxed); }
+    uint64_t popWaitNanoseconds() const { return pop_wait_ns.load(memory_order_relaxed); }
+};
+
+#endif
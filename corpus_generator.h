@@ -0,0 +1,128 @@
+#ifndef CORPUS_GENERATOR_H
+#define CORPUS_GENERATOR_H
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Воспроизводимый синтетический корпус для бенчмарков. Терм с рангом r - слово "w<r>" (r от 1),
+// его доля среди токенов пропорциональна 1 / r^s (закон Ципфа с показателем s). У каждого поля
+// своя доля доков, в которых оно есть, и свое распределение длины в токенах.
+// Выборки сделаны поверх mt19937_64 без распределений стандартной библиотеки (их алгоритмы
+// у разных реализаций разные), поэтому одни и те же параметры дают один и тот же корпус везде
+
+enum class LengthDistribution {
+    FIXED,     // ровно a токенов
+    UNIFORM,   // от a до b токенов
+    LOGNORMAL  // медиана a токенов, b - стандартное отклонение логарифма длины (длинный хвост, как у статей)
+};
+
+struct FieldSpec {
+    string name;
+    // доля доков, в которых есть поле
+    double probability = 1.0;
+    LengthDistribution distribution = LengthDistribution::UNIFORM;
+    double a = 10;
+    double b = 100;
+    // потолок длины (хвост логнормального распределения)
+    size_t max_length = 5000;
+};
+
+struct CorpusOptions {
+    size_t vocabulary_size = 50000;
+    double zipf_exponent = 1.0;
+    uint64_t seed = 42;
+    vector<FieldSpec> fields = {
+        {"title", 1.0, LengthDistribution::UNIFORM, 3, 12},
+        {"content", 1.0, LengthDistribution::LOGNORMAL, 150, 0.7},
+    };
+};
+
+class CorpusGenerator {
+private:
+    CorpusOptions options;
+    mt19937_64 rng;
+    // накопленные веса рангов 1..vocabulary_size
+    vector<double> cumulative;
+
+    // равномерно в [0, 1): старшие 53 бита числа генератора
+    double uniform() {
+        return static_cast<double>(rng() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // стандартное нормальное (Бокс - Мюллер)
+    double normal() {
+        double u1 = 1.0 - uniform();
+        double u2 = uniform();
+        return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    }
+
+    size_t sampleLength(const FieldSpec& field) {
+        double length = field.a;
+        switch (field.distribution) {
+            case LengthDistribution::FIXED:
+                break;
+            case LengthDistribution::UNIFORM:
+                length = field.a + floor(uniform() * (field.b - field.a + 1));
+                break;
+            case LengthDistribution::LOGNORMAL:
+                length = round(field.a * exp(field.b * normal()));
+                break;
+        }
+        return min(field.max_length, static_cast<size_t>(max(1.0, length)));
+    }
+
+public:
+    explicit CorpusGenerator(CorpusOptions corpus_options = CorpusOptions())
+        : options(move(corpus_options)), rng(options.seed) {
+        cumulative.resize(max<size_t>(1, options.vocabulary_size));
+        double total = 0;
+        for (size_t r = 0; r < cumulative.size(); ++r) {
+            total += 1.0 / pow(static_cast<double>(r + 1), options.zipf_exponent);
+            cumulative[r] = total;
+        }
+    }
+
+    const CorpusOptions& corpusOptions() const { return options; }
+
+    static string term(size_t rank) {
+        return "w" + to_string(rank);
+    }
+
+    // ранг очередного терма (от 1)
+    size_t sampleRank() {
+        double target = uniform() * cumulative.back();
+        return upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin() + 1;
+    }
+
+    // следующий док: поля в порядке options.fields, отсутствующие поля пропускаются
+    vector<pair<string, string>> nextDocument() {
+        vector<pair<string, string>> document;
+        for (const FieldSpec& field : options.fields) {
+            if (field.probability < 1.0 && uniform() >= field.probability) continue;
+            size_t length = sampleLength(field);
+            string text;
+            text.reserve(length * 6);
+            for (size_t i = 0; i < length; ++i) {
+                if (i) text += ' ';
+                text += term(sampleRank());
+            }
+            document.emplace_back(field.name, move(text));
+        }
+        return document;
+    }
+
+    vector<vector<pair<string, string>>> nextBatch(size_t count) {
+        vector<vector<pair<string, string>>> batch;
+        batch.reserve(count);
+        for (size_t i = 0; i < count; ++i) batch.push_back(nextDocument());
+        return batch;
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Файл, целиком отображенный в память для последовательного чтения.
+// Отображение частное и доступно на запись: изменения (раскрытие кавычек CSV на месте) попадают
+// в копии затронутых страниц, а не в файл. Прочитанное начало файла можно отпустить (release),
+// чтобы многогигабайтный файл не оседал в памяти процесса
+class MappedFile {
+private:
+    char* base;
+    size_t mapped_size;
+    size_t released_size; // сколько байт с начала уже отпущено
+
+public:
+    MappedFile() : base(nullptr), mapped_size(0), released_size(0) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base) munmap(base, mapped_size);
+    }
+
+    // false, если файл не открывается; пустой файл открывается с нулевым размером
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        if (info.st_size == 0) {
+            close(fd);
+            return true;
+        }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        base = static_cast<char*>(mapped);
+        mapped_size = info.st_size;
+        madvise(base, mapped_size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    char* data() const { return base; }
+    size_t size() const { return mapped_size; }
+
+    // отпустить страницы, целиком лежащие до position: повторное чтение вернет содержимое файла,
+    // поэтому ссылки на эту часть (и раскрытые в ней поля) после release недействительны
+    void release(const char* position) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t until = static_cast<size_t>(position - base) / page * page;
+        if (until <= released_size) return;
+        madvise(base + released_size, until - released_size, MADV_DONTNEED);
+        released_size = until;
+    }
+};
+
+// Разбор CSV по RFC 4180 без копирования: поля записи - куски буфера (string_view).
+// Поле в кавычках может содержать разделители и переводы строк, "" внутри него - одна кавычка;
+// такое поле раскрывается на месте сдвигом байтов внутри самого поля, поэтому буфер должен быть
+// изменяемым (см. MappedFile), а поля без "" не трогаются вовсе.
+// Записи разделяются "\r\n" или "\n", пустые строки пропускаются, пробелы и табуляции вокруг полей
+// отбрасываются. Незакрытая кавычка продолжает поле до конца данных
+class CsvReader {
+private:
+    char* position;
+    char* end;
+    char separator;
+
+    static bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    string_view readField() {
+        while (position < end && (*position == ' ' || *position == '\t')) ++position;
+        char* start = position;
+        char* write = position;
+
+        if (position < end && *position == '"') {
+            start = write = ++position;
+            while (position < end) {
+                char* quote = static_cast<char*>(memchr(position, '"', end - position));
+                if (!quote) quote = end;
+                if (write != position) memmove(write, position, quote - position);
+                write += quote - position;
+                position = quote;
+                if (position == end) break;
+                if (position + 1 < end && position[1] == '"') {
+                    *write++ = '"';
+                    position += 2;
+                    continue;
+                }
+                ++position;
+                break;
+            }
+            // после закрывающей кавычки допускаем только пробелы; прочий текст до разделителя
+            // (нарушение формата) дописывается к полю как есть, вместе с пробелами внутри него,
+            // а пробелы в конце поля отбрасываются, как у поля без кавычек
+            char* quoted_end = write;
+            while (position < end && *position != separator && *position != '\n') *write++ = *position++;
+            while (write > quoted_end && isBlank(write[-1])) --write;
+            return string_view(start, write - start);
+        }
+
+        while (position < end && *position != separator && *position != '\n') ++position;
+        char* field_end = position;
+        while (field_end > start && isBlank(field_end[-1])) --field_end;
+        return string_view(start, field_end - start);
+    }
+
+public:
+    CsvReader(char* data, size_t size, char sep = ',') : position(data), end(data + size), separator(sep) {
+        // метка порядка байт UTF-8 в начале файла
+        if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) position += 3;
+    }
+
+    // следующая запись в fields; ссылки действительны, пока жив буфер. false - записи кончились
+    bool next(vector<string_view>& fields) {
+        fields.clear();
+        while (position < end && (*position == '\n' || *position == '\r')) ++position;
+        if (position == end) return false;
+
+        while (true) {
+            fields.push_back(readField());
+            if (position < end && *position == separator) {
+                ++position;
+                continue;
+            }
+            if (position < end) ++position; // '\n'
+            return true;
+        }
+    }
+
+    // начало еще не разобранных данных
+    const char* current() const { return position; }
+};
+
+#endif
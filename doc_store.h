@@ -0,0 +1,301 @@
+#ifndef DOC_STORE_H
+#define DOC_STORE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// поля, тексты которых хранятся вместе с индексом
+enum class StoredField { TITLE, CONTENT };
+
+// Хранилище текстов одного поля (заголовков или содержания) для доков части.
+// Доки адресуются плотно: док first_doc_id + i - это i-я запись. Тексты лежат подряд в одном буфере,
+// сквозное смещение начала записи i - doc_offsets[i], длина - doc_offsets[i + 1] - doc_offsets[i].
+// Буфер режется по границам доков на блоки примерно по DOC_STORE_BLOCK_BYTES, и каждый закрытый блок
+// сжимается (LZ77, формат ниже); последний незакрытый блок (хвост) лежит как есть.
+// Чтобы прочитать док из сжатого блока, блок распаковывается до конца дока - не больше одного блока
+constexpr size_t DOC_STORE_BLOCK_BYTES = 16 << 10;
+
+// Сжатие блока - последовательности "литералы + совпадение":
+//   токен (старшие 4 бита - число литералов, младшие - длина совпадения минус DOC_STORE_MIN_MATCH;
+//   15 - длина продолжается байтами, каждый 255 - еще байт), литералы, смещение совпадения назад (2 байта).
+// Последняя последовательность - только литералы, на ней вход кончается. Окно - 64 КБ, поэтому
+// смещение всегда помещается в 2 байта
+constexpr size_t DOC_STORE_MIN_MATCH = 4;
+constexpr int DOC_STORE_HASH_BITS = 12;
+
+inline void appendLength(string& out, size_t length) {
+    for (; length >= 255; length -= 255) out += static_cast<char>(255);
+    out += static_cast<char>(length);
+}
+
+inline uint32_t read32(const char* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// дописать сжатый блок в конец out
+inline void compressBlock(string_view in, string& out) {
+    const char* data = in.data();
+    size_t size = in.size();
+    // последние байты не ищем: совпадение должно целиком поместиться во вход
+    size_t limit = size >= DOC_STORE_MIN_MATCH ? size - DOC_STORE_MIN_MATCH : 0;
+    uint32_t table[1 << DOC_STORE_HASH_BITS];
+    // 0 - пусто, иначе позиция + 1
+    memset(table, 0, sizeof(table));
+
+    auto emit = [&](size_t anchor, size_t literals, size_t offset, size_t match_length) {
+        size_t extra = match_length ? match_length - DOC_STORE_MIN_MATCH : 0;
+        char token = static_cast<char>((min<size_t>(literals, 15) << 4) | min<size_t>(extra, 15));
+        out += token;
+        if (literals >= 15) appendLength(out, literals - 15);
+        out.append(data + anchor, literals);
+        if (!match_length) return;
+        out += static_cast<char>(offset & 0xFF);
+        out += static_cast<char>(offset >> 8);
+        if (extra >= 15) appendLength(out, extra - 15);
+    };
+
+    size_t anchor = 0;
+    for (size_t i = 0; i < limit;) {
+        uint32_t sequence = read32(data + i);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - DOC_STORE_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(i + 1);
+        if (!candidate || i + 1 - candidate > 0xFFFF || read32(data + candidate - 1) != sequence) {
+            i++;
+            continue;
+        }
+        size_t match = candidate - 1;
+        size_t length = DOC_STORE_MIN_MATCH;
+        while (i + length < size && data[match + length] == data[i + length]) length++;
+        emit(anchor, i - anchor, i - match, length);
+        i += length;
+        anchor = i;
+    }
+    emit(anchor, size - anchor, 0, 0);
+}
+
+// распаковка блока в out (raw_size байт) до тех пор, пока не готовы первые needed байт;
+// false, если вход испорчен
+inline bool decompressBlock(const char* in, size_t in_size, char* out, size_t raw_size, size_t needed) {
+    const char* end = in + in_size;
+    size_t produced = 0;
+    auto readLength = [&](size_t length) {
+        if (length < 15) return length;
+        while (in < end) {
+            uint8_t byte = static_cast<uint8_t>(*in++);
+            length += byte;
+            if (byte != 255) break;
+        }
+        return length;
+    };
+
+    while (produced < needed) {
+        if (in >= end) return false;
+        uint8_t token = static_cast<uint8_t>(*in++);
+        size_t literals = readLength(token >> 4);
+        if (literals > static_cast<size_t>(end - in) || literals > raw_size - produced) return false;
+        memcpy(out + produced, in, literals);
+        in += literals;
+        produced += literals;
+        if (in == end) break;
+
+        if (end - in < 2) return false;
+        size_t offset = static_cast<uint8_t>(in[0]) | static_cast<size_t>(static_cast<uint8_t>(in[1])) << 8;
+        in += 2;
+        size_t length = readLength(token & 15) + DOC_STORE_MIN_MATCH;
+        if (!offset || offset > produced || length > raw_size - produced) return false;
+        // совпадение может перекрывать само себя (повтор короче длины) - тогда копируем по байту
+        const char* from = out + produced - offset;
+        if (offset >= length) {
+            memcpy(out + produced, from, length);
+        } else {
+            for (size_t k = 0; k < length; ++k) out[produced + k] = from[k];
+        }
+        produced += length;
+    }
+    return produced >= needed;
+}
+
+// Хранилище без владения: массивы DocStore в памяти или прямо в отображенном сегменте
+struct DocStoreView {
+    const uint64_t* presence = nullptr;      // бит i - у записи i есть текст
+    const uint64_t* doc_offsets = nullptr;   // [doc_count + 1]
+    size_t doc_count = 0;
+    const uint64_t* block_starts = nullptr;  // сквозное смещение начала блока [block_count]
+    const uint64_t* block_offsets = nullptr; // смещение сжатого блока в compressed [block_count + 1]
+    size_t block_count = 0;
+    const char* compressed = nullptr;
+    const char* tail = nullptr;              // несжатые байты начиная со сквозного смещения tail_start
+    uint64_t tail_start = 0;
+
+    bool has(size_t i) const {
+        return i < doc_count && (presence[i >> 6] >> (i & 63) & 1);
+    }
+
+    // текст записи i: out указывает прямо в хранилище, если запись в несжатом хвосте,
+    // иначе в buffer, куда распакован ее блок. false, если записи нет
+    bool text(size_t i, string& buffer, string_view& out) const {
+        if (!has(i)) return false;
+        uint64_t begin = doc_offsets[i], end = doc_offsets[i + 1];
+        if (begin == end) {
+            out = string_view();
+            return true;
+        }
+        if (begin >= tail_start) {
+            out = string_view(tail + (begin - tail_start), end - begin);
+            return true;
+        }
+        size_t block = upper_bound(block_starts, block_starts + block_count, begin) - block_starts - 1;
+        uint64_t block_start = block_starts[block];
+        if (!decodeBlock(block, buffer, end - block_start)) return false;
+        out = string_view(buffer.data() + (begin - block_start), end - begin);
+        return true;
+    }
+
+    // распаковка блока (первых needed байт, по умолчанию целиком) в buffer
+    bool decodeBlock(size_t block, string& buffer, size_t needed = SIZE_MAX) const {
+        uint64_t raw_size = blockEnd(block) - block_starts[block];
+        if (buffer.size() < raw_size) buffer.resize(raw_size);
+        return decompressBlock(compressed + block_offsets[block], block_offsets[block + 1] - block_offsets[block],
+                               &buffer[0], raw_size, min<uint64_t>(needed, raw_size));
+    }
+
+    uint64_t blockEnd(size_t block) const {
+        return block + 1 < block_count ? block_starts[block + 1] : tail_start;
+    }
+
+    // on_text(i, text) по всем записям с текстом по порядку; каждый блок распаковывается один раз
+    template <typename Fn>
+    void forEach(Fn&& on_text) const {
+        string buffer;
+        size_t block = 0;
+        bool decoded = false;
+        for (size_t i = 0; i < doc_count; ++i) {
+            if (!has(i)) continue;
+            uint64_t begin = doc_offsets[i], end = doc_offsets[i + 1];
+            if (begin == end) {
+                on_text(i, string_view());
+            } else if (begin >= tail_start) {
+                on_text(i, string_view(tail + (begin - tail_start), end - begin));
+            } else {
+                while (blockEnd(block) <= begin) {
+                    block++;
+                    decoded = false;
+                }
+                if (!decoded) decoded = decodeBlock(block, buffer);
+                if (decoded) on_text(i, string_view(buffer.data() + (begin - block_starts[block]), end - begin));
+            }
+        }
+    }
+};
+
+// Хранилище в памяти: записи дописываются по возрастанию номера
+class DocStore {
+private:
+    vector<uint64_t> presence;
+    vector<uint64_t> doc_offsets = {0};
+    vector<uint64_t> block_starts;
+    vector<uint64_t> block_offsets = {0};
+    string compressed;
+    string tail;
+    uint64_t tail_start = 0;
+
+    // закрыть хвост: сжать его отдельным блоком
+    void sealTail() {
+        if (tail.empty()) return;
+        block_starts.push_back(tail_start);
+        compressBlock(tail, compressed);
+        block_offsets.push_back(compressed.size());
+        tail_start += tail.size();
+        tail.clear();
+    }
+
+    // записи до index без текста
+    void padTo(size_t index) {
+        while (documentCount() < index) doc_offsets.push_back(doc_offsets.back());
+        presence.resize((index + 64) / 64, 0);
+    }
+
+public:
+    size_t documentCount() const { return doc_offsets.size() - 1; }
+
+    // текст записи index; повторная запись последней записи заменяет ее текст, более ранние не меняются
+    void set(size_t index, string_view text) {
+        if (index < documentCount()) {
+            if (index + 1 != documentCount() || doc_offsets[index] < tail_start) return;
+            tail.resize(doc_offsets[index] - tail_start);
+            doc_offsets.pop_back();
+        } else {
+            if (tail.size() >= DOC_STORE_BLOCK_BYTES) sealTail();
+            padTo(index);
+        }
+        presence[index >> 6] |= uint64_t(1) << (index & 63);
+        tail.append(text.data(), text.size());
+        doc_offsets.push_back(tail_start + tail.size());
+    }
+
+    // дописать записи другого хранилища начиная с номера first_index (не меньше documentCount()).
+    // Сжатые блоки копируются как есть, поэтому свой хвост закрывается, даже если он короткий
+    void append(const DocStore& source, size_t first_index) {
+        sealTail();
+        padTo(first_index);
+        uint64_t shift = tail_start;
+        for (size_t block = 0; block < source.block_starts.size(); ++block) {
+            block_starts.push_back(source.block_starts[block] + shift);
+            block_offsets.push_back(compressed.size() + source.block_offsets[block + 1]);
+        }
+        compressed += source.compressed;
+        for (size_t i = 0; i < source.documentCount(); ++i) {
+            doc_offsets.push_back(source.doc_offsets[i + 1] + shift);
+        }
+        presence.resize((documentCount() + 64) / 64, 0);
+        DocStoreView source_view = source.view();
+        for (size_t i = 0; i < source.documentCount(); ++i) {
+            if (source_view.has(i)) presence[(first_index + i) >> 6] |= uint64_t(1) << ((first_index + i) & 63);
+        }
+        tail_start = source.tail_start + shift;
+        tail = source.tail;
+    }
+
+    DocStoreView view() const {
+        DocStoreView result;
+        result.presence = presence.data();
+        result.doc_offsets = doc_offsets.data();
+        result.doc_count = documentCount();
+        result.block_starts = block_starts.data();
+        result.block_offsets = block_offsets.data();
+        result.block_count = block_starts.size();
+        result.compressed = compressed.data();
+        result.tail = tail.data();
+        result.tail_start = tail_start;
+        return result;
+    }
+
+    // освободить запас емкости (часть больше не растет)
+    void shrinkToFit() {
+        presence.shrink_to_fit();
+        doc_offsets.shrink_to_fit();
+        block_starts.shrink_to_fit();
+        block_offsets.shrink_to_fit();
+        compressed.shrink_to_fit();
+        tail.shrink_to_fit();
+    }
+
+    size_t memoryBytes() const {
+        return (presence.capacity() + doc_offsets.capacity() + block_starts.capacity() + block_offsets.capacity()) * sizeof(uint64_t) +
+               compressed.capacity() + tail.capacity();
+    }
+
+    // сквозной объем текстов до сжатия
+    uint64_t rawBytes() const { return doc_offsets.back(); }
+};
+
+#endif
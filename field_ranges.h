@@ -0,0 +1,147 @@
+#ifndef FIELD_RANGES_H
+#define FIELD_RANGES_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// Поля дока в едином индексе. Позиции термов нумеруются сквозь все поля дока по порядку (как если бы
+// поля шли одним текстом), и каждое поле занимает в этой нумерации непрерывный диапазон.
+// У поля части есть номер, а постинг терма несет маску полей, в которых терм встретился в доке.
+// Запрос по полю - фильтр единого списка: доки отбираются по маске, позиции дока - по диапазонам поля.
+// Бит в маске есть только у первых MAX_FIELDS полей части. Доки поля с большим номером отбираются
+// по позициям: док подходит, если позиция терма попадает в диапазон поля. Такой фильтр распаковывает
+// позиции каждого дока списка (и при поиске, и при подсчете доков поля), поэтому запросы по полям
+// сверх MAX_FIELDS заметно медленнее.
+// Позиции с фильтром остаются в сквозной нумерации, поэтому NEAR/ADJ без поля видят поля дока одним
+// текстом (ADJ может перейти из конца title в начало content), а операнды разных полей
+// (title:a NEAR/k content:b) сравниваются по расстоянию через границу полей
+constexpr uint32_t MAX_FIELDS = 8;
+// такого поля в части нет
+constexpr uint32_t NO_FIELD = UINT32_MAX;
+
+using FieldMask = uint8_t;
+
+inline FieldMask fieldBit(uint32_t field) {
+    return field < MAX_FIELDS ? static_cast<FieldMask>(1u << field) : 0;
+}
+
+// маска с номерами полей другой части: field_map[номер в источнике] -> номер здесь
+inline FieldMask remapFieldMask(FieldMask mask, const uint32_t* field_map) {
+    FieldMask result = 0;
+    for (; mask; mask &= mask - 1) result |= fieldBit(field_map[__builtin_ctz(mask)]);
+    return result;
+}
+
+// диапазон позиций [start, end) поля field в доке
+struct FieldRange {
+    uint32_t start;
+    uint32_t end;
+    uint32_t field;
+};
+
+// Диапазоны полей без владения (в памяти или прямо в отображенном сегменте):
+// диапазоны дока first_doc_id + i по возрастанию start - ranges[doc_offsets[i] .. doc_offsets[i + 1])
+struct FieldRangesView {
+    const uint32_t* doc_offsets = nullptr;
+    const FieldRange* ranges = nullptr;
+    size_t doc_count = 0;
+    int first_doc_id = 0;
+
+    // диапазоны дока [first, second); пусто, если дока нет
+    pair<const FieldRange*, const FieldRange*> of(int doc_id) const {
+        size_t i = static_cast<size_t>(doc_id - first_doc_id);
+        if (doc_id < first_doc_id || i >= doc_count) return {ranges, ranges};
+        return {ranges + doc_offsets[i], ranges + doc_offsets[i + 1]};
+    }
+
+    // маска полей, в которые попадают позиции дока (по возрастанию); номера полей переводятся через field_map
+    FieldMask maskOf(int doc_id, const int* positions, size_t count, const uint32_t* field_map) const {
+        auto [range, last] = of(doc_id);
+        FieldMask mask = 0;
+        for (size_t k = 0; k < count && range != last; ++k) {
+            uint32_t position = static_cast<uint32_t>(positions[k]);
+            while (range != last && range->end <= position) ++range;
+            if (range != last && range->start <= position) mask |= fieldBit(field_map[range->field]);
+        }
+        return mask;
+    }
+
+    // оставить в начале positions (по возрастанию) только позиции поля field дока doc_id; их число
+    size_t filter(int doc_id, uint32_t field, int* positions, size_t count) const {
+        auto [first, last] = of(doc_id);
+        size_t kept = 0, k = 0;
+        for (const FieldRange* range = first; range != last && k < count; ++range) {
+            if (range->field != field) continue;
+            k = lower_bound(positions + k, positions + count, static_cast<int>(range->start)) - positions;
+            for (; k < count && positions[k] < static_cast<int>(range->end); ++k) positions[kept++] = positions[k];
+        }
+        return kept;
+    }
+};
+
+// Диапазоны полей доков части: записи дописываются по возрастанию номера дока (i - док first_doc_id + i)
+class FieldRanges {
+private:
+    vector<uint32_t> doc_offsets = {0};
+    vector<FieldRange> ranges;
+
+    // доки до index без полей
+    void padTo(size_t index) {
+        while (documentCount() < index) doc_offsets.push_back(doc_offsets.back());
+    }
+
+public:
+    size_t documentCount() const { return doc_offsets.size() - 1; }
+
+    // диапазоны нового дока index (не меньше documentCount())
+    void add(size_t index, const FieldRange* first, const FieldRange* last) {
+        padTo(index);
+        ranges.insert(ranges.end(), first, last);
+        doc_offsets.push_back(static_cast<uint32_t>(ranges.size()));
+    }
+
+    // поле длиной length позиций в конец дока index (в том числе уже не последнего); возвращает начало поля
+    uint32_t extend(size_t index, uint32_t field, uint32_t length) {
+        if (index >= documentCount()) {
+            FieldRange range = {0, length, field};
+            add(index, &range, &range + 1);
+            return 0;
+        }
+        uint32_t end = doc_offsets[index + 1];
+        uint32_t start = end > doc_offsets[index] ? ranges[end - 1].end : 0;
+        ranges.insert(ranges.begin() + end, FieldRange{start, start + length, field});
+        for (size_t i = index + 1; i < doc_offsets.size(); ++i) doc_offsets[i]++;
+        return start;
+    }
+
+    // дописать доки другой части начиная с номера first_index (не меньше documentCount()),
+    // номера полей переводятся через field_map
+    void append(const FieldRanges& source, size_t first_index, const uint32_t* field_map) {
+        padTo(first_index);
+        uint32_t shift = static_cast<uint32_t>(ranges.size());
+        for (FieldRange range : source.ranges) {
+            range.field = field_map[range.field];
+            ranges.push_back(range);
+        }
+        for (size_t i = 1; i < source.doc_offsets.size(); ++i) doc_offsets.push_back(source.doc_offsets[i] + shift);
+    }
+
+    FieldRangesView view(int first_doc_id) const {
+        return {doc_offsets.data(), ranges.data(), documentCount(), first_doc_id};
+    }
+
+    void shrinkToFit() {
+        doc_offsets.shrink_to_fit();
+        ranges.shrink_to_fit();
+    }
+
+    size_t memoryBytes() const {
+        return doc_offsets.capacity() * sizeof(uint32_t) + ranges.capacity() * sizeof(FieldRange);
+    }
+};
+
+#endif
@@ -0,0 +1,323 @@
+#ifndef INGEST_PIPELINE_H
+#define INGEST_PIPELINE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include "search_class.h"
+#include "csv_reader.h"
+#include "bounded_queue.h"
+
+using namespace std;
+
+// Конвейерная загрузка CSV: три стадии на своих потоках, связанные ограниченными очередями.
+//   разбор    - один поток: читает отображенный файл (CsvReader), режет записи на пакеты,
+//               резервирует под пакет doc_id и кладет его в очередь разобранных пакетов;
+//   токенизация - worker_count потоков: строят по пакету частичный MemoryIndex
+//               (токенизация, нормализация, словарь, постинги) и кладут его в очередь готовых;
+//   запись    - вызывающий поток: дописывает частичные индексы в индексатор строго по порядку
+//               пакетов (все готовые подряд пакеты - одним слиянием) и отпускает прочитанную часть файла.
+// Очереди ограничены, и разбор не уходит вперед записи больше чем на емкость конвейера,
+// поэтому память не растет, а скорость определяется самой медленной стадией, а не суммой стадий.
+// Счетчики стадий (stats) можно читать из другого потока во время загрузки.
+// Пока идет загрузка, другие доки в индексатор добавлять нельзя (см. TextIndexer::reserveDocIds)
+
+struct CsvIngestOptions {
+    char separator = ',';
+    size_t max_rows = 0;       // 0 - без ограничения
+    size_t batch_size = 4096;  // доков в пакете
+    int worker_count = 0;      // 0 - по числу ядер за вычетом потоков разбора и записи
+    size_t queue_capacity = 0; // пакетов в каждой очереди; 0 - по два на поток токенизации
+    // индексируемые колонки (по заголовку); записи, где все они пусты, пропускаются
+    vector<string> fields = {"title", "content"};
+};
+
+struct IngestStageStats {
+    uint64_t batches = 0;
+    uint64_t documents = 0;
+    double busy_ms = 0;        // процессорное время стадии (у токенизации - сумма по потокам)
+    double input_wait_ms = 0;  // ожидание входной очереди
+    double output_wait_ms = 0; // ожидание места в выходной очереди (противодавление)
+};
+
+struct IngestQueueStats {
+    size_t depth = 0;
+    size_t max_depth = 0;
+    size_t capacity = 0;
+};
+
+struct IngestStats {
+    IngestStageStats parse;
+    IngestStageStats tokenize;
+    IngestStageStats write;
+    IngestQueueStats parsed_queue;
+    IngestQueueStats indexed_queue;
+    int worker_count = 0;
+    double elapsed_ms = 0;
+};
+
+class CsvIngestPipeline {
+private:
+    struct ParsedBatch {
+        size_t sequence = 0;
+        int first_doc_id = 0;
+        vector<DocumentView> documents;
+        const char* end = nullptr; // конец пакета в файле
+        bool last = false;         // сигнал потоку токенизации завершиться
+    };
+
+    struct IndexedBatch {
+        size_t sequence = 0;
+        unique_ptr<MemoryIndex> partial;
+        size_t documents = 0;
+        const char* end = nullptr;
+        bool last = false;
+    };
+
+    struct StageCounters {
+        atomic<uint64_t> batches{0};
+        atomic<uint64_t> documents{0};
+        atomic<uint64_t> busy_ns{0};
+        atomic<uint64_t> wait_ns{0}; // ожидание сверх очередей (разбор ждет, пока запись догонит)
+    };
+
+    TextIndexer& indexer;
+    CsvIngestOptions options;
+    int worker_count;
+    BoundedQueue<ParsedBatch> parsed_queue;
+    BoundedQueue<IndexedBatch> indexed_queue;
+    StageCounters parse_counters;
+    StageCounters tokenize_counters;
+    StageCounters write_counters;
+    atomic<size_t> written_batches{0};
+    atomic<int64_t> start_ns{0};
+    atomic<int64_t> finish_ns{0};
+
+    static int64_t nowNanoseconds() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static int defaultWorkerCount(int requested) {
+        if (requested > 0) return requested;
+        return max(1, static_cast<int>(thread::hardware_concurrency()) - 2);
+    }
+
+    // процессорное время потока: занятость стадии не завышается, когда потоков больше, чем ядер
+    static int64_t threadCpuNanoseconds() {
+        timespec time;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    static double milliseconds(uint64_t nanoseconds) {
+        return nanoseconds / 1e6;
+    }
+
+    // пакетов в работе (разобран, но еще не записан) не больше, чем помещается в очереди и потоки
+    size_t maxInFlight() const {
+        return parsed_queue.capacity() + indexed_queue.capacity() + worker_count;
+    }
+
+    void parseStage(MappedFile& file) {
+        CsvReader reader(file.data(), file.size(), options.separator);
+        vector<string_view> record;
+        vector<int> columns(options.fields.size(), -1);
+        if (reader.next(record)) {
+            for (size_t f = 0; f < options.fields.size(); ++f) {
+                for (size_t i = 0; i < record.size(); ++i) {
+                    if (record[i] == options.fields[f]) columns[f] = static_cast<int>(i);
+                }
+            }
+        }
+
+        size_t rows = 0;
+        size_t sequence = 0;
+        ParsedBatch batch;
+        auto flush = [&] {
+            if (batch.documents.empty()) return;
+            batch.sequence = sequence++;
+            batch.first_doc_id = indexer.reserveDocIds(batch.documents.size());
+            batch.end = reader.current();
+            parse_counters.batches++;
+            parse_counters.documents += batch.documents.size();
+
+            // ждем, пока запись догонит разбор
+            if (batch.sequence >= written_batches.load() + maxInFlight()) {
+                auto wait_start = nowNanoseconds();
+                Backoff backoff;
+                while (batch.sequence >= written_batches.load() + maxInFlight()) backoff.wait();
+                parse_counters.wait_ns += nowNanoseconds() - wait_start;
+            }
+            parsed_queue.push(move(batch));
+            batch = ParsedBatch();
+        };
+
+        auto busy_start = threadCpuNanoseconds();
+        while ((options.max_rows == 0 || rows < options.max_rows) && reader.next(record)) {
+            rows++;
+            DocumentView document;
+            bool empty = true;
+            for (size_t f = 0; f < columns.size(); ++f) {
+                int column = columns[f];
+                string_view value = column >= 0 && static_cast<size_t>(column) < record.size() ? record[column] : string_view();
+                empty = empty && value.empty();
+                document.push_back({options.fields[f], value});
+            }
+            if (empty) continue;
+
+            batch.documents.push_back(move(document));
+            if (batch.documents.size() == options.batch_size) {
+                parse_counters.busy_ns += threadCpuNanoseconds() - busy_start;
+                flush();
+                busy_start = threadCpuNanoseconds();
+            }
+        }
+        parse_counters.busy_ns += threadCpuNanoseconds() - busy_start;
+        flush();
+
+        for (int t = 0; t < worker_count; ++t) {
+            ParsedBatch end_marker;
+            end_marker.last = true;
+            parsed_queue.push(move(end_marker));
+        }
+    }
+
+    void tokenizeStage() {
+        while (true) {
+            ParsedBatch batch = parsed_queue.pop();
+            IndexedBatch indexed;
+            if (batch.last) {
+                indexed.last = true;
+                indexed_queue.push(move(indexed));
+                return;
+            }
+
+            auto busy_start = threadCpuNanoseconds();
+            indexed.sequence = batch.sequence;
+            indexed.documents = batch.documents.size();
+            indexed.end = batch.end;
+            indexed.partial = make_unique<MemoryIndex>(batch.first_doc_id, false);
+            for (size_t i = 0; i < batch.documents.size(); ++i) {
+                indexed.partial->addDocument(batch.first_doc_id + static_cast<int>(i), batch.documents[i]);
+            }
+            tokenize_counters.busy_ns += threadCpuNanoseconds() - busy_start;
+            tokenize_counters.batches++;
+            tokenize_counters.documents += indexed.documents;
+            indexed_queue.push(move(indexed));
+        }
+    }
+
+    size_t writeStage(MappedFile& file) {
+        // пакеты приходят не по порядку - держим опередившие до своей очереди
+        map<size_t, IndexedBatch> pending;
+        size_t next_sequence = 0;
+        size_t indexed = 0;
+        int finished_workers = 0;
+        while (finished_workers < worker_count) {
+            IndexedBatch batch = indexed_queue.pop();
+            if (batch.last) {
+                finished_workers++;
+                continue;
+            }
+            pending.emplace(batch.sequence, move(batch));
+
+            // все пакеты, готовые по порядку, дописываются одним слиянием
+            vector<const MemoryIndex*> ready;
+            const char* end = nullptr;
+            size_t documents = 0;
+            for (auto it = pending.find(next_sequence + ready.size()); it != pending.end();
+                 it = pending.find(next_sequence + ready.size())) {
+                ready.push_back(it->second.partial.get());
+                end = it->second.end;
+                documents += it->second.documents;
+            }
+            if (ready.empty()) continue;
+
+            auto busy_start = threadCpuNanoseconds();
+            indexer.appendPartials(ready, worker_count);
+            file.release(end);
+            for (size_t i = 0; i < ready.size(); ++i) pending.erase(next_sequence + i);
+            next_sequence += ready.size();
+            indexed += documents;
+            write_counters.batches += ready.size();
+            write_counters.documents += documents;
+            written_batches.store(next_sequence);
+            write_counters.busy_ns += threadCpuNanoseconds() - busy_start;
+        }
+        return indexed;
+    }
+
+public:
+    explicit CsvIngestPipeline(TextIndexer& target, CsvIngestOptions ingest_options = CsvIngestOptions())
+        : indexer(target), options(move(ingest_options)), worker_count(defaultWorkerCount(options.worker_count)),
+          parsed_queue(options.queue_capacity ? options.queue_capacity : 2 * worker_count),
+          indexed_queue(options.queue_capacity ? options.queue_capacity : 2 * worker_count) {
+        if (options.batch_size == 0) options.batch_size = 1;
+    }
+
+    CsvIngestPipeline(const CsvIngestPipeline&) = delete;
+    CsvIngestPipeline& operator=(const CsvIngestPipeline&) = delete;
+
+    // загрузка файла целиком (пакетный режим индексатора, в конце commit); число проиндексированных доков.
+    // Если файл не открывается, возвращает 0 и индекс не меняет
+    size_t run(const string& path) {
+        MappedFile file;
+        if (!file.open(path)) return 0;
+        start_ns = nowNanoseconds();
+        finish_ns = 0;
+
+        indexer.beginBulkLoad();
+        thread parser([&] { parseStage(file); });
+        vector<thread> workers;
+        for (int t = 0; t < worker_count; ++t) workers.emplace_back([this] { tokenizeStage(); });
+        size_t indexed = writeStage(file);
+
+        parser.join();
+        for (auto& worker : workers) worker.join();
+        indexer.commit();
+        finish_ns = nowNanoseconds();
+        return indexed;
+    }
+
+    IngestStats stats() const {
+        IngestStats result;
+        auto stage = [](const StageCounters& counters) {
+            IngestStageStats stage_stats;
+            stage_stats.batches = counters.batches.load();
+            stage_stats.documents = counters.documents.load();
+            stage_stats.busy_ms = milliseconds(counters.busy_ns.load());
+            return stage_stats;
+        };
+        auto queue = [](const auto& source) {
+            IngestQueueStats queue_stats;
+            queue_stats.depth = source.depth();
+            queue_stats.max_depth = source.maxDepth();
+            queue_stats.capacity = source.capacity();
+            return queue_stats;
+        };
+
+        result.parse = stage(parse_counters);
+        result.parse.output_wait_ms = milliseconds(parsed_queue.pushWaitNanoseconds() + parse_counters.wait_ns.load());
+        result.tokenize = stage(tokenize_counters);
+        result.tokenize.input_wait_ms = milliseconds(parsed_queue.popWaitNanoseconds());
+        result.tokenize.output_wait_ms = milliseconds(indexed_queue.pushWaitNanoseconds());
+        result.write = stage(write_counters);
+        result.write.input_wait_ms = milliseconds(indexed_queue.popWaitNanoseconds());
+        result.parsed_queue = queue(parsed_queue);
+        result.indexed_queue = queue(indexed_queue);
+        result.worker_count = worker_count;
+
+        int64_t start = start_ns.load();
+        int64_t finish = finish_ns.load();
+        if (start) result.elapsed_ms = milliseconds((finish ? finish : nowNanoseconds()) - start);
+        return result;
+    }
+};
+
+#endif
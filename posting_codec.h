@@ -0,0 +1,306 @@
+#ifndef POSTING_CODEC_H
+#define POSTING_CODEC_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Блочное сжатие упорядоченных списков doc_id.
+// Список режется на блоки по 128 чисел, внутри блока хранятся разности с шагом 4 (x[i] - x[i-4]),
+// упакованные по bit_width бит в "вертикальной" раскладке: число i лежит в дорожке i % 4.
+// Так 4 соседних числа распаковываются одной SSE-инструкцией, а префиксная сумма по разностям
+// с шагом 4 - это просто сложение векторов. Без SSE2 тот же формат читается скалярным кодом
+constexpr int POSTING_BLOCK_SIZE = 128;
+constexpr int POSTING_BLOCK_LANES = 4;
+
+// неполный хвост короче этого выгоднее хранить как есть
+constexpr int POSTING_MIN_PACKED = 16;
+
+// минимальное число бит, в которое помещается value
+inline int bitWidth(uint32_t value) {
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// число слов под vectors четверок чисел по bit_width бит
+inline int packedWords(int bit_width, int vectors) {
+    return POSTING_BLOCK_LANES * ((vectors * bit_width + 31) / 32);
+}
+
+// упаковка vectors четверок чисел (полный блок - 32 четверки) по bit_width бит
+inline void packBlock(const uint32_t* values, int bit_width, int vectors, uint32_t* out) {
+    memset(out, 0, sizeof(uint32_t) * packedWords(bit_width, vectors));
+    for (int k = 0; k < vectors; ++k) {
+        int bit = k * bit_width;
+        int word = bit >> 5, offset = bit & 31;
+        for (int lane = 0; lane < POSTING_BLOCK_LANES; ++lane) {
+            uint32_t value = values[k * POSTING_BLOCK_LANES + lane];
+            out[word * POSTING_BLOCK_LANES + lane] |= value << offset;
+            if (offset + bit_width > 32) {
+                out[(word + 1) * POSTING_BLOCK_LANES + lane] |= value >> (32 - offset);
+            }
+        }
+    }
+}
+
+// распаковка блока + восстановление doc_id из разностей; base - последний doc_id предыдущего блока
+inline void unpackBlockScalar(const uint32_t* in, int bit_width, int vectors, uint32_t base, uint32_t* values) {
+    uint32_t mask = bit_width == 32 ? ~0u : (1u << bit_width) - 1;
+    uint32_t prev[POSTING_BLOCK_LANES] = {base, base, base, base};
+    for (int k = 0; k < vectors; ++k) {
+        int bit = k * bit_width;
+        int word = bit >> 5, offset = bit & 31;
+        for (int lane = 0; lane < POSTING_BLOCK_LANES; ++lane) {
+            uint32_t value = 0;
+            if (bit_width) {
+                value = in[word * POSTING_BLOCK_LANES + lane] >> offset;
+                if (offset + bit_width > 32) {
+                    value |= in[(word + 1) * POSTING_BLOCK_LANES + lane] << (32 - offset);
+                }
+            }
+            prev[lane] += value & mask;
+            values[k * POSTING_BLOCK_LANES + lane] = prev[lane];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+inline void unpackBlockSSE(const uint32_t* in, int bit_width, int vectors, uint32_t base, uint32_t* values) {
+    const __m128i* words = reinterpret_cast<const __m128i*>(in);
+    __m128i* out = reinterpret_cast<__m128i*>(values);
+    __m128i mask = _mm_set1_epi32(bit_width == 32 ? -1 : static_cast<int>((1u << bit_width) - 1));
+    __m128i prev = _mm_set1_epi32(static_cast<int>(base));
+
+    for (int k = 0; k < vectors; ++k) {
+        __m128i value = _mm_setzero_si128();
+        if (bit_width) {
+            int bit = k * bit_width;
+            int word = bit >> 5, offset = bit & 31;
+            value = _mm_srl_epi32(_mm_loadu_si128(words + word), _mm_cvtsi32_si128(offset));
+            if (offset + bit_width > 32) {
+                __m128i high = _mm_sll_epi32(_mm_loadu_si128(words + word + 1), _mm_cvtsi32_si128(32 - offset));
+                value = _mm_or_si128(value, high);
+            }
+            value = _mm_and_si128(value, mask);
+        }
+        prev = _mm_add_epi32(prev, value);
+        _mm_storeu_si128(out + k, prev);
+    }
+}
+#endif
+
+inline void unpackBlock(const uint32_t* in, int bit_width, int vectors, uint32_t base, uint32_t* values) {
+#if defined(__SSE2__)
+    unpackBlockSSE(in, bit_width, vectors, base, values);
+#else
+    unpackBlockScalar(in, bit_width, vectors, base, values);
+#endif
+}
+
+// varbyte: по 7 бит на байт, старший бит - признак продолжения
+inline void appendVarint(vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// число из [in, end): чтение не заходит за end и берет не больше 5 байт, поэтому испорченные данные
+// (число обрывается на end или не кончается) дают неверное значение, но не выход за буфер
+inline uint32_t readVarint(const uint8_t*& in, const uint8_t* end) {
+    uint32_t value = 0;
+    for (int shift = 0; in < end && shift < 35; shift += 7) {
+        uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+// Представление сжатого списка без владения: массивы могут лежать и в векторах CompressedPostings,
+// и прямо в отображенном в память файле сегмента
+struct CompressedView {
+    const int* block_last = nullptr;
+    const uint32_t* block_offset = nullptr;
+    const uint8_t* block_width = nullptr;
+    const uint32_t* data = nullptr;
+    size_t packed_blocks = 0;
+    int last_block_size = POSTING_BLOCK_SIZE;
+    const int* tail = nullptr;
+    size_t tail_size = 0;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    size_t blockCount() const { return packed_blocks + (tail_size ? 1 : 0); }
+    int blockLast(size_t block) const { return block < packed_blocks ? block_last[block] : tail[tail_size - 1]; }
+
+    // распаковка блока в out (не больше 128 чисел), возвращает число doc_id в блоке
+    int decodeBlock(size_t block, int* out) const {
+        if (block >= packed_blocks) {
+            copy(tail, tail + tail_size, out);
+            return static_cast<int>(tail_size);
+        }
+        uint32_t base = block ? static_cast<uint32_t>(block_last[block - 1]) : 0;
+        int n = block + 1 == packed_blocks ? last_block_size : POSTING_BLOCK_SIZE;
+        alignas(16) uint32_t values[POSTING_BLOCK_SIZE];
+        unpackBlock(data + block_offset[block], block_width[block],
+                    (n + POSTING_BLOCK_LANES - 1) / POSTING_BLOCK_LANES, base, values);
+        memcpy(out, values, sizeof(int) * n);
+        return n;
+    }
+
+    vector<int> decodeAll() const {
+        vector<int> result(count);
+        size_t filled = 0;
+        for (size_t block = 0; block < blockCount(); ++block) {
+            filled += decodeBlock(block, result.data() + filled);
+        }
+        return result;
+    }
+};
+
+// Сжатый список doc_id. Полные блоки упакованы, недозаполненный хвост хранится как есть,
+// пока его не упакует seal(). Дописывать можно только doc_id больше последнего
+struct CompressedPostings {
+    vector<int> block_last;          // последний doc_id каждого блока - по ним прыгаем, не распаковывая
+    vector<uint32_t> block_offset;   // начало блока в data
+    vector<uint8_t> block_width;     // бит на разность в блоке
+    vector<uint32_t> data;
+    int last_block_size = POSTING_BLOCK_SIZE; // последний упакованный блок может быть неполным (после seal)
+    vector<int> tail;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    int back() const { return tail.empty() ? block_last.back() : tail.back(); }
+
+    CompressedView view() const {
+        return {block_last.data(), block_offset.data(), block_width.data(), data.data(), block_last.size(),
+                last_block_size, tail.data(), tail.size(), count};
+    }
+
+    void push_back(int doc_id) {
+        // последний блок упакован неполным - возвращаем его в хвост
+        if (tail.empty() && last_block_size < POSTING_BLOCK_SIZE) {
+            int values[POSTING_BLOCK_SIZE];
+            int n = view().decodeBlock(block_last.size() - 1, values);
+            tail.assign(values, values + n);
+            data.resize(block_offset.back());
+            block_last.pop_back();
+            block_offset.pop_back();
+            block_width.pop_back();
+            last_block_size = POSTING_BLOCK_SIZE;
+        }
+        tail.push_back(doc_id);
+        count++;
+        if (tail.size() == POSTING_BLOCK_SIZE) packTail();
+    }
+
+    // упаковать хвост, чтобы все числа хранились сжатыми (совсем короткий хвост остается как есть)
+    void seal() {
+        if (tail.size() >= POSTING_MIN_PACKED) packTail();
+        tail.shrink_to_fit();
+    }
+
+    vector<int> decodeAll() const {
+        return view().decodeAll();
+    }
+
+    static CompressedPostings encode(const vector<int>& list) {
+        CompressedPostings compressed;
+        for (int doc_id : list) compressed.push_back(doc_id);
+        compressed.seal();
+        return compressed;
+    }
+
+    size_t memoryBytes() const {
+        return block_last.capacity() * sizeof(int) + block_offset.capacity() * sizeof(uint32_t) +
+               block_width.capacity() + data.capacity() * sizeof(uint32_t) + tail.capacity() * sizeof(int);
+    }
+
+private:
+    void packTail() {
+        int n = static_cast<int>(tail.size());
+        uint32_t base = block_last.empty() ? 0 : static_cast<uint32_t>(block_last.back());
+        // неполный блок пакуем только до последней четверки, ее добиваем последним doc_id
+        int vectors = (n + POSTING_BLOCK_LANES - 1) / POSTING_BLOCK_LANES;
+        uint32_t values[POSTING_BLOCK_SIZE];
+        for (int i = 0; i < vectors * POSTING_BLOCK_LANES; ++i) {
+            values[i] = static_cast<uint32_t>(tail[min(i, n - 1)]);
+        }
+
+        // разности с шагом 4: первые 4 числа считаются от последнего doc_id предыдущего блока
+        uint32_t deltas[POSTING_BLOCK_SIZE];
+        uint32_t all_bits = 0;
+        for (int i = 0; i < vectors * POSTING_BLOCK_LANES; ++i) {
+            deltas[i] = values[i] - (i < POSTING_BLOCK_LANES ? base : values[i - POSTING_BLOCK_LANES]);
+            all_bits |= deltas[i];
+        }
+
+        int width = bitWidth(all_bits);
+        block_offset.push_back(static_cast<uint32_t>(data.size()));
+        block_width.push_back(static_cast<uint8_t>(width));
+        block_last.push_back(tail.back());
+        data.resize(data.size() + packedWords(width, vectors));
+        packBlock(deltas, width, vectors, data.data() + block_offset.back());
+
+        last_block_size = n;
+        tail.clear();
+    }
+};
+
+// Курсор по сжатому списку: распаковывает по одному блоку и пропускает блоки по block_last
+class CompressedCursor {
+private:
+    CompressedView list;
+    size_t block;
+    int buffer[POSTING_BLOCK_SIZE];
+    int buffer_size;
+    int pos;
+
+public:
+    CompressedCursor(const CompressedView& postings) : list(postings), block(0), buffer_size(0), pos(0) {
+        loadBlock(0);
+    }
+
+    bool atEnd() const { return pos >= buffer_size; }
+    int docId() const { return buffer[pos]; }
+    // номер текущего doc_id в списке (неполным бывает только последний блок)
+    size_t index() const { return block * POSTING_BLOCK_SIZE + pos; }
+
+    void next() {
+        if (++pos >= buffer_size) loadBlock(block + 1);
+    }
+
+    // переход к первому doc_id >= target
+    void advance(int target) {
+        if (atEnd() || buffer[pos] >= target) return;
+        if (list.blockLast(block) < target) {
+            // блоки, целиком лежащие левее target, даже не распаковываем
+            size_t lo = block + 1, hi = list.blockCount();
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (list.blockLast(mid) < target) lo = mid + 1; else hi = mid;
+            }
+            loadBlock(lo);
+            if (atEnd()) return;
+        }
+        pos = static_cast<int>(lower_bound(buffer + pos, buffer + buffer_size, target) - buffer);
+    }
+
+private:
+    void loadBlock(size_t new_block) {
+        block = new_block;
+        pos = 0;
+        buffer_size = block < list.blockCount() ? list.decodeBlock(block, buffer) : 0;
+    }
+};
+
+#endif
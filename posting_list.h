@@ -0,0 +1,616 @@
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include "posting_codec.h"
+#include "doc_store.h"
+#include "field_ranges.h"
+
+using namespace std;
+
+// Скип-указатели, встроенные в массив: skip_doc_ids[k] = doc_list[k * step], шаг sqrt(n).
+// В отличие от цепочки узлов, прыжок - это индекс в том же непрерывном массиве постингов
+struct SkipPointers {
+    int step = 0;
+    vector<int> skip_doc_ids;
+};
+
+// Фильтр списка терма по полю без бита в маске (номер поля не меньше MAX_FIELDS): i-й док (doc_id)
+// проходит, если хотя бы одна его позиция (offsets/positions или packed_positions, как у PositionsRef)
+// лежит в диапазоне поля field
+struct FieldPositionFilter {
+    const uint32_t* offsets = nullptr;
+    const int* positions = nullptr;
+    const uint8_t* packed_positions = nullptr;
+    FieldRangesView fields;
+    uint32_t field = NO_FIELD;
+
+    bool active() const { return field != NO_FIELD; }
+
+    bool accepts(size_t i, int doc_id) const {
+        auto [range, last] = fields.of(doc_id);
+        // позиции и диапазоны дока идут по возрастанию, поэтому диапазон ищется одним проходом
+        auto inField = [&](uint32_t position) {
+            while (range != last && range->end <= position) ++range;
+            return range != last && range->start <= position && range->field == field;
+        };
+        if (!packed_positions) {
+            for (uint32_t k = offsets[i]; k < offsets[i + 1] && range != last; ++k) {
+                if (inField(static_cast<uint32_t>(positions[k]))) return true;
+            }
+            return false;
+        }
+        const uint8_t* in = packed_positions + offsets[i];
+        const uint8_t* end = packed_positions + offsets[i + 1];
+        uint32_t position = 0;
+        while (in < end && range != last) {
+            position += readVarint(in, end);
+            if (inField(position)) return true;
+        }
+        return false;
+    }
+};
+
+// Ссылка на упорядоченный список doc_id без копирования: список из индекса (со скипами или сжатый,
+// в том числе лежащий в отображенном в память сегменте) или промежуточный результат.
+// Список поля - тот же список терма с фильтром: курсоры проходят только доки, в маске которых
+// есть бит поля, а у полей без бита - доки, прошедшие фильтр по позициям (см. field_ranges.h)
+struct PostingRef {
+    const vector<int>* docs;
+    const SkipPointers* skips;
+    CompressedView compressed = {};
+    bool is_compressed = false;
+    const FieldMask* field_masks = nullptr;
+    FieldMask field_bit = 0;
+    FieldPositionFilter position_filter;
+    // число доков поля (размер отфильтрованного списка)
+    size_t field_size = 0;
+
+    static PostingRef of(const CompressedView& view) {
+        return {nullptr, nullptr, view, true};
+    }
+
+    // тот же список, отфильтрованный по полю: masks[i] - маска полей i-го дока, count - доков с bit
+    PostingRef withField(const FieldMask* masks, FieldMask bit, size_t count) const {
+        PostingRef ref = *this;
+        ref.field_masks = masks;
+        ref.field_bit = bit;
+        ref.field_size = count;
+        return ref;
+    }
+
+    // тот же список, отфильтрованный по позициям поля без бита; доки поля считаются здесь же проходом по списку
+    PostingRef withFieldPositions(const FieldPositionFilter& filter) const {
+        PostingRef ref = *this;
+        ref.position_filter = filter;
+        ref.field_size = ref.toVector().size();
+        return ref;
+    }
+
+    bool filtered() const { return field_bit != 0 || position_filter.active(); }
+
+    // проходит ли i-й док списка (doc_id) фильтр поля
+    bool accepts(size_t i, int doc_id) const {
+        return field_bit ? (field_masks[i] & field_bit) != 0 : position_filter.accepts(i, doc_id);
+    }
+    size_t size() const { return filtered() ? field_size : is_compressed ? compressed.size() : docs->size(); }
+    // последний doc_id списка без фильтра (-1 для пустого) - верхняя граница doc_id списка поля
+    int lastDocId() const {
+        if (is_compressed) return compressed.size() ? compressed.blockLast(compressed.blockCount() - 1) : -1;
+        return docs->empty() ? -1 : docs->back();
+    }
+
+    vector<int> toVector() const {
+        vector<int> ids = is_compressed ? compressed.decodeAll() : *docs;
+        if (!filtered()) return ids;
+        size_t kept = 0;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (accepts(i, ids[i])) ids[kept++] = ids[i];
+        }
+        ids.resize(kept);
+        return ids;
+    }
+};
+
+// пустой список (для отсутствующего терма)
+inline PostingRef emptyPostings() {
+    static const vector<int> empty_list;
+    return {&empty_list, nullptr};
+}
+
+// Непрерывный кусок упорядоченных позиций терма в доке (аналог span)
+struct PositionSpan {
+    const int* data;
+    size_t size;
+};
+
+// Координатный список без владения: doc_id + плоские позиции (несжатые или разностями varbyte).
+// Позиции дока с номером i в списке лежат в [offsets[i], offsets[i + 1]).
+// block_max_tf[j] - наибольшая частота терма среди доков j * 128 .. j * 128 + 127 (оценки для ранжирования).
+// У списка поля (field != NO_FIELD) doc_ids отфильтрован, а из позиций дока остаются только позиции
+// из диапазонов поля; частоты по всем полям остаются верхними оценками частот поля
+struct PositionsRef {
+    PostingRef doc_ids = emptyPostings();
+    const uint32_t* offsets = nullptr;
+    const int* positions = nullptr;
+    const uint8_t* packed_positions = nullptr;
+    const uint32_t* block_max_tf = nullptr;
+    uint32_t max_tf = 0;
+    FieldRangesView fields;
+    uint32_t field = NO_FIELD;
+
+    // оставить в списке только поле field_id: у поля с битом доки отбираются по маскам (masks, count - доков
+    // поля), у остальных - по позициям и диапазонам ranges. false, если в поле у терма нет доков
+    bool selectField(uint32_t field_id, const FieldMask* masks, size_t count, const FieldRangesView& ranges) {
+        if (field_id == NO_FIELD) return false;
+        doc_ids = field_id < MAX_FIELDS ? doc_ids.withField(masks, fieldBit(field_id), count)
+                                        : doc_ids.withFieldPositions({offsets, positions, packed_positions, ranges, field_id});
+        fields = ranges;
+        field = field_id;
+        return doc_ids.size() > 0;
+    }
+
+    // частота терма в i-м доке (doc_id) = число его позиций (в varbyte у каждого числа ровно один байт
+    // без старшего бита); у списка поля позиции приходится распаковывать в buffer
+    uint32_t frequency(size_t i, int doc_id, vector<int>& buffer) const {
+        if (field != NO_FIELD) return static_cast<uint32_t>(positionsOf(i, doc_id, buffer).size);
+        if (!packed_positions) return offsets[i + 1] - offsets[i];
+        uint32_t count = 0;
+        for (uint32_t k = offsets[i]; k < offsets[i + 1]; ++k) count += packed_positions[k] < 0x80;
+        return count;
+    }
+
+    // позиции i-го дока (doc_id): несжатые - прямо из массива, сжатые или отфильтрованные по полю - в buffer
+    PositionSpan positionsOf(size_t i, int doc_id, vector<int>& buffer) const {
+        PositionSpan span = allPositions(i, buffer);
+        if (field == NO_FIELD) return span;
+        if (span.data != buffer.data()) buffer.assign(span.data, span.data + span.size);
+        buffer.resize(fields.filter(doc_id, field, buffer.data(), buffer.size()));
+        return {buffer.data(), buffer.size()};
+    }
+
+    // позиции i-го дока по всем полям
+    PositionSpan allPositions(size_t i, vector<int>& buffer) const {
+        if (!packed_positions) {
+            return {positions + offsets[i], offsets[i + 1] - offsets[i]};
+        }
+        buffer.clear();
+        const uint8_t* in = packed_positions + offsets[i];
+        const uint8_t* end = packed_positions + offsets[i + 1];
+        uint32_t position = 0;
+        while (in < end) {
+            position += readVarint(in, end);
+            buffer.push_back(static_cast<int>(position));
+        }
+        return {buffer.data(), buffer.size()};
+    }
+};
+
+// Упорядоченный список doc_id терма: обычный массив или (опционально) сжатые блоки
+struct PostingList {
+    vector<int> doc_ids;
+    CompressedPostings compressed;
+    bool is_compressed = false;
+
+    size_t size() const { return is_compressed ? compressed.size() : doc_ids.size(); }
+    bool empty() const { return size() == 0; }
+    int back() const { return is_compressed ? compressed.back() : doc_ids.back(); }
+
+    void push_back(int doc_id) {
+        if (is_compressed) {
+            compressed.push_back(doc_id);
+        } else {
+            doc_ids.push_back(doc_id);
+        }
+    }
+
+    PostingRef ref(const SkipPointers* skips = nullptr) const {
+        return is_compressed ? PostingRef::of(compressed.view()) : PostingRef{&doc_ids, skips};
+    }
+
+    vector<int> toVector() const {
+        return is_compressed ? compressed.decodeAll() : doc_ids;
+    }
+
+    size_t memoryBytes() const {
+        return is_compressed ? compressed.memoryBytes() : doc_ids.capacity() * sizeof(int);
+    }
+
+    // отдать запас емкости массивов, когда список больше не растет
+    void shrinkToFit() {
+        doc_ids.shrink_to_fit();
+        compressed.block_last.shrink_to_fit();
+        compressed.block_offset.shrink_to_fit();
+        compressed.block_width.shrink_to_fit();
+        compressed.data.shrink_to_fit();
+        compressed.tail.shrink_to_fit();
+    }
+};
+
+// Координатный список терма в плоской раскладке: позиции дока doc_ids[i] лежат в
+// positions[offsets[i] .. offsets[i + 1]) - три непрерывных массива вместо отдельного вектора на каждый док.
+// В сжатом режиме doc_ids хранятся блоками, а позиции - разностями varbyte (offsets тогда в байтах).
+// field_masks[i] - поля, в которых терм встретился в доке doc_ids[i], field_counts[f] - число доков с полем f
+struct PositionalPostings {
+    PostingList doc_ids;
+    vector<uint32_t> offsets = {0};
+    vector<int> positions;
+    vector<uint8_t> packed_positions;
+    vector<FieldMask> field_masks;
+    vector<uint32_t> block_max_tf;
+    uint32_t max_tf = 0;
+    uint32_t field_counts[MAX_FIELDS] = {};
+
+    size_t size() const { return doc_ids.size(); }
+    bool empty() const { return doc_ids.empty(); }
+    int lastDocId() const { return doc_ids.back(); }
+
+    // дописать док в конец списка
+    void append(int doc_id, const vector<int>& doc_positions, FieldMask fields) {
+        append(doc_id, PositionSpan{doc_positions.data(), doc_positions.size()}, fields);
+    }
+
+    void append(int doc_id, PositionSpan doc_positions, FieldMask fields) {
+        doc_ids.push_back(doc_id);
+        appendPositions(doc_positions);
+        field_masks.push_back(0);
+        addFields(fields);
+    }
+
+    // дописать в конец весь список other (все его doc_id больше последнего doc_id этого списка);
+    // field_map переводит номера полей other в номера этого списка (nullptr - номера те же).
+    // Если поле other без бита получает здесь номер с битом, маски строятся заново по позициям
+    // и диапазонам полей other (other_ranges), иначе - переводом масок other
+    void appendAll(const PositionalPostings& other, const uint32_t* field_map = nullptr,
+                   const FieldRangesView* other_ranges = nullptr) {
+        vector<int> buffer;
+        auto fieldsOf = [&](size_t i, int doc_id) {
+            if (other_ranges) {
+                PositionSpan span = other.positionsOf(i, buffer);
+                return other_ranges->maskOf(doc_id, span.data, span.size, field_map);
+            }
+            return field_map ? remapFieldMask(other.field_masks[i], field_map) : other.field_masks[i];
+        };
+        if (!doc_ids.is_compressed && !other.doc_ids.is_compressed) {
+            doc_ids.doc_ids.insert(doc_ids.doc_ids.end(), other.doc_ids.doc_ids.begin(), other.doc_ids.doc_ids.end());
+            uint32_t shift = offsets.back();
+            for (size_t i = 1; i < other.offsets.size(); ++i) {
+                offsets.push_back(other.offsets[i] + shift);
+                updateMaxFrequency(other.offsets[i] - other.offsets[i - 1]);
+            }
+            positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+            for (size_t i = 0; i < other.field_masks.size(); ++i) {
+                field_masks.push_back(0);
+                addFields(fieldsOf(i, other.doc_ids.doc_ids[i]));
+            }
+            return;
+        }
+        vector<int> ids = other.doc_ids.toVector();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            FieldMask fields = fieldsOf(i, ids[i]);
+            append(ids[i], other.positionsOf(i, buffer), fields);
+        }
+    }
+
+    // тот же док пришел повторно (повторяющееся поле) - сливаем позиции и поля последнего дока
+    void mergeIntoLast(const vector<int>& doc_positions, FieldMask fields) {
+        vector<int> buffer;
+        PositionSpan last = positionsOf(size() - 1, buffer);
+        vector<int> merged;
+        merge(last.data, last.data + last.size, doc_positions.begin(), doc_positions.end(), back_inserter(merged));
+        merged.erase(unique(merged.begin(), merged.end()), merged.end());
+
+        offsets.pop_back();
+        if (doc_ids.is_compressed) {
+            packed_positions.resize(offsets.back());
+        } else {
+            positions.resize(offsets.back());
+        }
+        appendPositions({merged.data(), merged.size()});
+        addFields(fields);
+    }
+
+    // док из прошлого - пересобираем список целиком (до финализации индекса сюда не попадаем)
+    void insertDoc(int doc_id, const vector<int>& doc_positions, FieldMask fields) {
+        vector<int> ids = doc_ids.toVector();
+        PositionalPostings rebuilt;
+        rebuilt.doc_ids.is_compressed = doc_ids.is_compressed;
+        vector<int> buffer;
+        bool inserted = false;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (!inserted && doc_id < ids[i]) {
+                rebuilt.append(doc_id, doc_positions, fields);
+                inserted = true;
+            }
+            PositionSpan span = positionsOf(i, buffer);
+            rebuilt.append(ids[i], span, field_masks[i]);
+            if (ids[i] == doc_id) {
+                rebuilt.mergeIntoLast(doc_positions, fields);
+                inserted = true;
+            }
+        }
+        if (!inserted) rebuilt.append(doc_id, doc_positions, fields);
+        rebuilt.doc_ids.compressed.seal();
+        *this = move(rebuilt);
+    }
+
+    PositionsRef ref() const {
+        if (doc_ids.is_compressed) {
+            return {doc_ids.ref(), offsets.data(), nullptr, packed_positions.data(), block_max_tf.data(), max_tf,
+                    FieldRangesView(), NO_FIELD};
+        }
+        return {doc_ids.ref(), offsets.data(), positions.data(), nullptr, block_max_tf.data(), max_tf,
+                FieldRangesView(), NO_FIELD};
+    }
+
+    // позиции i-го дока по всем полям
+    PositionSpan positionsOf(size_t i, vector<int>& buffer) const {
+        return ref().allPositions(i, buffer);
+    }
+
+    // число доков, в которых терм есть в поле field
+    uint32_t fieldCount(uint32_t field) const {
+        return field < MAX_FIELDS ? field_counts[field] : 0;
+    }
+
+    size_t memoryBytes() const {
+        return doc_ids.memoryBytes() + offsets.capacity() * sizeof(uint32_t) +
+               positions.capacity() * sizeof(int) + packed_positions.capacity() + field_masks.capacity() +
+               block_max_tf.capacity() * sizeof(uint32_t);
+    }
+
+    void shrinkToFit() {
+        doc_ids.shrinkToFit();
+        offsets.shrink_to_fit();
+        positions.shrink_to_fit();
+        packed_positions.shrink_to_fit();
+        field_masks.shrink_to_fit();
+        block_max_tf.shrink_to_fit();
+    }
+
+private:
+    // добавить поля к маске последнего дока (счетчики - только за новые биты)
+    void addFields(FieldMask fields) {
+        FieldMask& mask = field_masks.back();
+        for (FieldMask added = fields & ~mask; added; added &= added - 1) field_counts[__builtin_ctz(added)]++;
+        mask |= fields;
+    }
+
+    void appendPositions(PositionSpan doc_positions) {
+        if (doc_ids.is_compressed) {
+            int prev = 0;
+            for (size_t i = 0; i < doc_positions.size; ++i) {
+                appendVarint(packed_positions, static_cast<uint32_t>(doc_positions.data[i] - prev));
+                prev = doc_positions.data[i];
+            }
+            offsets.push_back(static_cast<uint32_t>(packed_positions.size()));
+        } else {
+            positions.insert(positions.end(), doc_positions.data, doc_positions.data + doc_positions.size);
+            offsets.push_back(static_cast<uint32_t>(positions.size()));
+        }
+        updateMaxFrequency(static_cast<uint32_t>(doc_positions.size));
+    }
+
+    // частота терма в только что дописанном (последнем) доке - обновляем максимумы блока и списка
+    void updateMaxFrequency(uint32_t tf) {
+        size_t block = (offsets.size() - 2) / POSTING_BLOCK_SIZE;
+        if (block == block_max_tf.size()) {
+            block_max_tf.push_back(tf);
+        } else {
+            block_max_tf[block] = max(block_max_tf[block], tf);
+        }
+        max_tf = max(max_tf, tf);
+    }
+};
+
+// Плотный битовый набор doc_id (бит i - документ i): множество всех доков
+// и дополнение для NOT считаются пословно, без дерева и двоичного поиска
+struct DocBitmap {
+    vector<uint64_t> words;
+    size_t bit_count = 0;
+
+    void set(int doc_id) {
+        size_t word = doc_id >> 6;
+        if (word >= words.size()) words.resize(word + 1, 0);
+        uint64_t mask = uint64_t(1) << (doc_id & 63);
+        if (!(words[word] & mask)) {
+            words[word] |= mask;
+            bit_count++;
+        }
+    }
+
+    void reset(int doc_id) {
+        size_t word = doc_id >> 6;
+        if (word >= words.size()) return;
+        uint64_t mask = uint64_t(1) << (doc_id & 63);
+        if (words[word] & mask) {
+            words[word] &= ~mask;
+            bit_count--;
+        }
+    }
+
+    bool test(int doc_id) const {
+        size_t word = doc_id >> 6;
+        return word < words.size() && (words[word] >> (doc_id & 63) & 1);
+    }
+
+    size_t count() const { return bit_count; }
+
+    // число doc_id, установленных и здесь, и в other
+    size_t intersectionCount(const DocBitmap& other) const {
+        size_t common = 0;
+        for (size_t word = 0; word < min(words.size(), other.words.size()); ++word) {
+            common += __builtin_popcountll(words[word] & other.words[word]);
+        }
+        return common;
+    }
+
+    // установленные doc_id по возрастанию
+    vector<int> toVector() const {
+        vector<int> result;
+        result.reserve(bit_count);
+        for (size_t word = 0; word < words.size(); ++word) {
+            uint64_t bits = words[word];
+            while (bits) {
+                result.push_back(static_cast<int>(word * 64 + __builtin_ctzll(bits)));
+                bits &= bits - 1;
+            }
+        }
+        return result;
+    }
+};
+
+// новый номер состояния источника; номера общие для всех источников, поэтому не повторяются
+inline uint64_t nextIndexGeneration() {
+    static atomic<uint64_t> counter{0};
+    return ++counter;
+}
+
+// Источник списков для вычисления запроса: индекс в памяти или отображенный в память сегмент.
+// Термы передаются уже нормализованными, пустое поле - общий индекс по всем полям
+class IndexReader {
+public:
+    virtual ~IndexReader() = default;
+
+    // номер текущего состояния источника (nextIndexGeneration): меняется при каждом изменении
+    // содержимого, поэтому годится как часть ключа кэша результатов
+    virtual uint64_t generation() const = 0;
+
+    // список doc_id терма (пустой, если терма нет)
+    virtual PostingRef postings(const string& term, const string& field) const = 0;
+    // координатный список терма; false, если терма нет
+    virtual bool positions(const string& term, const string& field, PositionsRef& out) const = 0;
+    // термы источника под шаблон "prefix*" или "*suffix", у которых есть список в поле field
+    virtual void expandTerms(const string& pattern, const string& field, vector<string>& out) const = 0;
+    // все доки источника - универсум для NOT
+    virtual const DocBitmap& allDocs() const = 0;
+    // число термов в доке и сумма по всем докам источника (нормировка длины в BM25)
+    virtual uint32_t documentLength(int doc_id) const = 0;
+    virtual uint64_t totalLength() const = 0;
+    // заголовок/содержание дока без копирования: out указывает в источник (живет, пока жив источник)
+    // или в buffer, если текст лежал в сжатом блоке; false, если дока в источнике нет или у него нет такого поля
+    virtual bool storedText(StoredField field, int doc_id, string& buffer, string_view& out) const = 0;
+};
+
+// Ядра пересечения/объединения упорядоченных списков
+
+inline SkipPointers buildSkipPointers(const vector<int>& doc_list) {
+    SkipPointers skips;
+    if (doc_list.size() < 3) return skips;
+    skips.step = static_cast<int>(sqrt(doc_list.size()));
+    skips.skip_doc_ids.reserve(doc_list.size() / skips.step + 1);
+    for (size_t i = 0; i < doc_list.size(); i += skips.step) {
+        skips.skip_doc_ids.push_back(doc_list[i]);
+    }
+    return skips;
+}
+
+// экспоненциальный (galloping) поиск: первый индекс >= from, у которого doc_id >= target.
+// Стоит O(log d), где d - расстояние прыжка, а не O(d), как у шага по одному
+inline size_t gallopTo(const vector<int>& list, size_t from, int target) {
+    size_t n = list.size();
+    if (from >= n || list[from] >= target) return from;
+
+    // удваиваем шаг, пока не перепрыгнем target: ответ лежит в (lo, hi]
+    size_t lo = from, hi = from + 1, step = 1;
+    while (hi < n && list[hi] < target) {
+        lo = hi;
+        step <<= 1;
+        hi = from + step;
+    }
+    if (hi > n) hi = n;
+    return lower_bound(list.begin() + lo + 1, list.begin() + hi, target) - list.begin();
+}
+
+// то же, но сначала прыгаем по скип-указателям, а внутри блока ищем двоичным поиском
+inline size_t skipTo(const vector<int>& list, const SkipPointers* skips, size_t from, int target) {
+    if (!skips || skips->step == 0) return gallopTo(list, from, target);
+    if (from >= list.size() || list[from] >= target) return from;
+
+    const auto& keys = skips->skip_doc_ids;
+    size_t step = skips->step;
+    size_t block = from / step;
+    // target в пределах текущего блока - короткий прыжок, хватит galloping
+    if (block + 1 >= keys.size() || keys[block + 1] > target) {
+        return gallopTo(list, from, target);
+    }
+
+    // иначе ищем последний блок, который начинается с doc_id <= target, и двоичный поиск внутри него
+    block = gallopTo(keys, block + 1, target + 1) - 1;
+    from = block * step;
+    // хвост за последним скипом (в том числе дописанный после построения скипов) - один блок
+    size_t end = block + 1 < keys.size() ? (block + 1) * step : list.size();
+    return lower_bound(list.begin() + from, list.begin() + end, target) - list.begin();
+}
+
+// курсор по несжатому списку с тем же интерфейсом, что у CompressedCursor
+class VectorCursor {
+private:
+    const vector<int>* list;
+    const SkipPointers* skips;
+    size_t pos;
+
+public:
+    VectorCursor(const vector<int>& doc_list, const SkipPointers* skip_pointers = nullptr)
+        : list(&doc_list), skips(skip_pointers), pos(0) {}
+
+    bool atEnd() const { return pos >= list->size(); }
+    int docId() const { return (*list)[pos]; }
+    size_t index() const { return pos; }
+    void next() { pos++; }
+    void advance(int target) { pos = skipTo(*list, skips, pos, target); }
+};
+
+// курсор по любому списку без шаблонов: для операторов, которые держат курсоры
+// несжатых и сжатых списков в одном массиве (ранжирование по нескольким термам)
+class PostingCursor {
+private:
+    VectorCursor vector_cursor;
+    CompressedCursor compressed_cursor;
+    bool is_compressed;
+    const FieldMask* field_masks;
+    FieldMask field_bit;
+    FieldPositionFilter position_filter;
+
+    void skipOtherFields() {
+        if (field_bit) {
+            while (!atEnd() && !(field_masks[index()] & field_bit)) step();
+        } else if (position_filter.active()) {
+            while (!atEnd() && !position_filter.accepts(index(), docId())) step();
+        }
+    }
+
+    void step() {
+        if (is_compressed) compressed_cursor.next(); else vector_cursor.next();
+    }
+
+public:
+    PostingCursor(const PostingRef& ref)
+        : vector_cursor(ref.is_compressed ? *emptyPostings().docs : *ref.docs, ref.skips),
+          compressed_cursor(ref.compressed), is_compressed(ref.is_compressed),
+          field_masks(ref.field_masks), field_bit(ref.field_bit), position_filter(ref.position_filter) {
+        skipOtherFields();
+    }
+
+    bool atEnd() const { return is_compressed ? compressed_cursor.atEnd() : vector_cursor.atEnd(); }
+    int docId() const { return is_compressed ? compressed_cursor.docId() : vector_cursor.docId(); }
+    size_t index() const { return is_compressed ? compressed_cursor.index() : vector_cursor.index(); }
+
+    void next() {
+        step();
+        skipOtherFields();
+    }
+
+    void advance(int target) {
+        if (is_compressed) compressed_cursor.advance(target); else vector_cursor.advance(target);
+        skipOtherFields();
+    }
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+// Кэш результатов запросов: итоговые результаты и результаты дорогих поддеревьев (NOT, NEAR/ADJ).
+// Ключ - каноническая запись запроса и состояния частей индекса, по которым он вычислен
+// (IndexReader::generation() меняется при каждом изменении части), поэтому после addDocument
+// старые записи просто перестают находиться и со временем вытесняются.
+// Объем ограничен в байтах, вытесняется давно не использованная запись (LRU).
+// Кэш общий для писателя и читателей снимков, все методы защищены мьютексом;
+// найденный результат неизменяем и остается живым у читателя, даже если запись уже вытеснена
+
+constexpr size_t DEFAULT_QUERY_CACHE_BYTES = 64 << 20;
+// сколько ключей с одним промахом помнит кэш (по хешу ключа); при переполнении память промахов очищается
+constexpr size_t MISSED_KEYS_LIMIT = 4096;
+
+struct CachedResult {
+    vector<int> doc_ids;
+    vector<double> scores; // оценки BM25 ранжированного результата (у булевых пусто)
+
+    size_t memoryBytes() const {
+        return doc_ids.capacity() * sizeof(int) + scores.capacity() * sizeof(double);
+    }
+};
+
+struct QueryCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t capacity_bytes = 0;
+};
+
+class QueryCache {
+private:
+    struct Entry {
+        string key;
+        shared_ptr<const CachedResult> result;
+        size_t bytes;
+    };
+
+    mutable mutex cache_mutex;
+    size_t capacity_bytes;
+    size_t used_bytes = 0;
+    list<Entry> entries;                                          // от недавно использованных к давним
+    unordered_map<string_view, list<Entry>::iterator> positions; // ключи указывают на строки в entries
+    QueryCacheStats counters;
+    unordered_set<size_t> missed_keys; // хеши ключей, которые промахнулись один раз
+
+    // запись вместе с ключом и узлами списка и хеш-таблицы
+    static size_t entryBytes(const string& key, const CachedResult& result) {
+        return result.memoryBytes() + key.capacity() + sizeof(Entry) + 4 * sizeof(void*);
+    }
+
+    void evictTo(size_t limit) {
+        while (used_bytes > limit && !entries.empty()) {
+            positions.erase(entries.back().key);
+            used_bytes -= entries.back().bytes;
+            entries.pop_back();
+            counters.evictions++;
+        }
+    }
+
+public:
+    explicit QueryCache(size_t capacity = DEFAULT_QUERY_CACHE_BYTES) : capacity_bytes(capacity) {}
+
+    // результат по ключу или nullptr; найденная запись становится самой свежей.
+    // Выключенный кэш (объем 0) не ищет и не считает промахи
+    shared_ptr<const CachedResult> find(const string& key) {
+        lock_guard<mutex> lock(cache_mutex);
+        if (capacity_bytes == 0) return nullptr;
+        auto it = positions.find(key);
+        if (it == positions.end()) {
+            counters.misses++;
+            return nullptr;
+        }
+        counters.hits++;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->result;
+    }
+
+    // результат больше четверти объема не кэшируется, чтобы один огромный ответ не вытеснял все остальные
+    void insert(const string& key, shared_ptr<const CachedResult> result) {
+        lock_guard<mutex> lock(cache_mutex);
+        size_t bytes = entryBytes(key, *result);
+        if (bytes > capacity_bytes / 4 || positions.count(key)) return;
+        entries.push_front({key, move(result), bytes});
+        positions.emplace(entries.front().key, entries.begin());
+        used_bytes += bytes;
+        counters.insertions++;
+        evictTo(capacity_bytes);
+    }
+
+    // true, если ключ уже промахивался раньше (тогда результат стоит вычислить целиком и запомнить);
+    // первый промах только запоминается
+    bool repeatedMiss(const string& key) {
+        lock_guard<mutex> lock(cache_mutex);
+        size_t hash = std::hash<string>()(key);
+        if (missed_keys.erase(hash)) return true;
+        if (missed_keys.size() >= MISSED_KEYS_LIMIT) missed_keys.clear();
+        missed_keys.insert(hash);
+        return false;
+    }
+
+    void setCapacity(size_t bytes) {
+        lock_guard<mutex> lock(cache_mutex);
+        capacity_bytes = bytes;
+        evictTo(capacity_bytes);
+    }
+
+    void clear() {
+        lock_guard<mutex> lock(cache_mutex);
+        positions.clear();
+        entries.clear();
+        missed_keys.clear();
+        used_bytes = 0;
+    }
+
+    QueryCacheStats stats() const {
+        lock_guard<mutex> lock(cache_mutex);
+        QueryCacheStats result = counters;
+        result.entries = entries.size();
+        result.bytes = used_bytes;
+        result.capacity_bytes = capacity_bytes;
+        return result;
+    }
+};
+
+#endif
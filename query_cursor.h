@@ -0,0 +1,777 @@
+#ifndef QUERY_CURSOR_H
+#define QUERY_CURSOR_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <cstdlib>
+#include <functional>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "posting_list.h"
+#include "query_profile.h"
+
+using namespace std;
+
+// Ленивое вычисление запроса: дерево курсоров повторяет план запроса и выдает доки по одному,
+// по возрастанию doc_id. Промежуточные списки не строятся - узел двигает курсоры операндов
+// через next()/advance(), поэтому память на запрос зависит от размера плана, а не от длины списков,
+// и вычисление можно остановить после нужного числа доков.
+// Только что созданный курсор уже стоит на первом подходящем доке
+
+// doc_id курсора, который дошел до конца
+constexpr int NO_MORE_DOCS = numeric_limits<int>::max();
+
+class QueryCursor {
+protected:
+    int current = NO_MORE_DOCS;
+
+public:
+    virtual ~QueryCursor() = default;
+
+    bool atEnd() const { return current == NO_MORE_DOCS; }
+    int docId() const { return current; }
+
+    // к следующему доку
+    virtual void next() = 0;
+    // к первому доку >= target (назад курсор не ходит)
+    virtual void advance(int target) = 0;
+};
+
+// Операнды AND/OR бывают двух видов: списки термов читаются напрямую, без виртуальных вызовов
+// (самый частый случай - все операнды термы), а вложенные операторы - через курсор поддерева
+
+// список doc_id терма прямо из индекса (сжатые блоки распаковываются по одному)
+class PostingIterator {
+private:
+    PostingCursor cursor;
+    int current;
+
+    void update() { current = cursor.atEnd() ? NO_MORE_DOCS : cursor.docId(); }
+
+public:
+    PostingIterator(const PostingRef& postings) : cursor(postings) { update(); }
+
+    bool atEnd() const { return current == NO_MORE_DOCS; }
+    int docId() const { return current; }
+    // номер текущего doc_id в списке
+    size_t index() const { return cursor.index(); }
+
+    void next() {
+        cursor.next();
+        update();
+    }
+
+    // в пересечении списков близкого размера нужный док чаще всего следующий - проверяем его до прыжка
+    void advance(int target) {
+        if (target <= current) return;
+        cursor.next();
+        if (!cursor.atEnd() && cursor.docId() < target) cursor.advance(target);
+        update();
+    }
+};
+
+class SubqueryIterator {
+private:
+    unique_ptr<QueryCursor> cursor;
+
+public:
+    SubqueryIterator(unique_ptr<QueryCursor> subquery) : cursor(move(subquery)) {}
+
+    bool atEnd() const { return cursor->atEnd(); }
+    int docId() const { return cursor->docId(); }
+    void next() { cursor->next(); }
+    void advance(int target) { cursor->advance(target); }
+};
+
+class TermQueryCursor : public QueryCursor {
+private:
+    PostingIterator postings;
+
+public:
+    TermQueryCursor(const PostingRef& list) : postings(list) { current = postings.docId(); }
+
+    void next() override {
+        postings.next();
+        current = postings.docId();
+    }
+
+    void advance(int target) override {
+        postings.advance(target);
+        current = postings.docId();
+    }
+};
+
+// Список терма с подсчетом для профиля (см. query_profile.h): на каких позициях списка курсор побывал
+// (scanned, они же выданные доки - output), сколько перепрыгнул (skipped) и сколько байт doc_id
+// распаковано из сжатых блоков, на которых он останавливался. Счетчики копятся в итераторе
+// и переносятся в узел при его уничтожении, чтобы шаг стоил одно сложение
+class CountingPostingIterator {
+private:
+    PostingIterator postings;
+    QueryProfileNode* node;
+    size_t size;
+    bool compressed;
+    uint64_t scanned = 0;
+    uint64_t decoded_bytes = 0;
+    size_t block = numeric_limits<size_t>::max();
+
+    void land() {
+        if (postings.atEnd()) return;
+        scanned++;
+        if (compressed && postings.index() / POSTING_BLOCK_SIZE != block) {
+            block = postings.index() / POSTING_BLOCK_SIZE;
+            decoded_bytes += sizeof(int) * min<size_t>(POSTING_BLOCK_SIZE, size - block * POSTING_BLOCK_SIZE);
+        }
+    }
+
+public:
+    CountingPostingIterator(const PostingRef& list, QueryProfileNode* profile_node)
+        : postings(list), node(profile_node), size(list.size()), compressed(list.is_compressed) {
+        land();
+    }
+
+    CountingPostingIterator(CountingPostingIterator&& other) noexcept
+        : postings(other.postings), node(other.node), size(other.size), compressed(other.compressed),
+          scanned(other.scanned), decoded_bytes(other.decoded_bytes), block(other.block) {
+        other.node = nullptr;
+    }
+
+    CountingPostingIterator& operator=(CountingPostingIterator&&) = delete;
+
+    // позиции до текущей курсор либо прошел, либо перепрыгнул
+    ~CountingPostingIterator() {
+        if (!node) return;
+        size_t passed = postings.atEnd() ? size : postings.index() + 1;
+        node->input += size;
+        node->scanned += scanned;
+        node->output += scanned;
+        node->skipped += passed - scanned;
+        node->decoded_bytes += decoded_bytes;
+    }
+
+    bool atEnd() const { return postings.atEnd(); }
+    int docId() const { return postings.docId(); }
+
+    void next() {
+        if (atEnd()) return;
+        postings.next();
+        land();
+    }
+
+    void advance(int target) {
+        if (target <= postings.docId()) return;
+        postings.advance(target);
+        land();
+    }
+};
+
+class CountingTermCursor : public QueryCursor {
+private:
+    CountingPostingIterator postings;
+
+public:
+    CountingTermCursor(const PostingRef& list, QueryProfileNode* profile_node) : postings(list, profile_node) {
+        current = postings.docId();
+    }
+
+    void next() override {
+        postings.next();
+        current = postings.docId();
+    }
+
+    void advance(int target) override {
+        postings.advance(target);
+        current = postings.docId();
+    }
+};
+
+// готовый список doc_id (например, результат из кэша); курсор держит список, пока жив
+class ListCursor : public TermQueryCursor {
+private:
+    shared_ptr<const vector<int>> docs;
+
+public:
+    ListCursor(shared_ptr<const vector<int>> doc_list)
+        : TermQueryCursor(PostingRef{doc_list.get(), nullptr}), docs(move(doc_list)) {}
+};
+
+// Курсор поддерева, который записывает выданные доки. Если его прошли через next() до конца, не перепрыгнув
+// ни одного дока, запись - весь результат поддерева, и она отдается в on_complete (например, в кэш).
+// Курсор, который бросили раньше или двигали advance() через доки, ничего не отдает и записывать перестает
+class RecordingCursor : public QueryCursor {
+private:
+    unique_ptr<QueryCursor> source;
+    vector<int> docs;
+    function<void(vector<int>&)> on_complete;
+
+    void update() {
+        current = source->docId();
+        if (!on_complete) return;
+        if (!atEnd()) {
+            docs.push_back(current);
+            return;
+        }
+        on_complete(docs);
+        on_complete = nullptr;
+    }
+
+    void stopRecording() {
+        on_complete = nullptr;
+        vector<int>().swap(docs);
+    }
+
+public:
+    RecordingCursor(unique_ptr<QueryCursor> subtree, function<void(vector<int>&)> complete)
+        : source(move(subtree)), on_complete(move(complete)) {
+        update();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        source->next();
+        update();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        if (target != current + 1 && on_complete) stopRecording();
+        source->advance(target);
+        update();
+    }
+};
+
+// AND: обязательные операнды (по возрастанию оценки размера, первый - ведущий) выравниваются
+// прыжками advance() на максимальный doc_id, затем док проверяется по исключенным операндам (AND NOT),
+// которые собраны в один курсор
+template <typename Operand>
+class ConjunctionCursor : public QueryCursor {
+private:
+    vector<Operand> required;
+    unique_ptr<QueryCursor> excluded;
+
+    // ведущий операнд стоит на кандидате; остальные подтягиваются к нему, а при промахе
+    // ведущий прыгает на doc_id операнда, который ушел дальше
+    void findMatch() {
+        int candidate = required[0].docId();
+        size_t i = 1;
+        while (candidate != NO_MORE_DOCS) {
+            if (i == required.size()) {
+                if (!isExcluded(candidate)) break;
+                required[0].next();
+            } else {
+                required[i].advance(candidate);
+                if (required[i].docId() == candidate) {
+                    i++;
+                    continue;
+                }
+                // один из операндов кончился - пересечений больше нет
+                if (required[i].atEnd()) {
+                    candidate = NO_MORE_DOCS;
+                    break;
+                }
+                required[0].advance(required[i].docId());
+            }
+            candidate = required[0].docId();
+            i = 1;
+        }
+        current = candidate;
+    }
+
+    bool isExcluded(int doc_id) {
+        if (!excluded) return false;
+        excluded->advance(doc_id);
+        return excluded->docId() == doc_id;
+    }
+
+public:
+    ConjunctionCursor(vector<Operand> required_operands, unique_ptr<QueryCursor> excluded_operands)
+        : required(move(required_operands)), excluded(move(excluded_operands)) {
+        findMatch();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        required[0].next();
+        findMatch();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        required[0].advance(target);
+        findMatch();
+    }
+};
+
+// OR: текущий док - минимальный среди операндов; операндов в запросе немного, минимум ищется перебором
+template <typename Operand>
+class DisjunctionCursor : public QueryCursor {
+private:
+    vector<Operand> operands;
+
+    void update() {
+        current = NO_MORE_DOCS;
+        for (const auto& operand : operands) current = min(current, operand.docId());
+    }
+
+public:
+    DisjunctionCursor(vector<Operand> operand_iterators) : operands(move(operand_iterators)) { update(); }
+
+    void next() override {
+        if (atEnd()) return;
+        int next_doc = NO_MORE_DOCS;
+        for (auto& operand : operands) {
+            if (operand.docId() == current) operand.next();
+            next_doc = min(next_doc, operand.docId());
+        }
+        current = next_doc;
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        int next_doc = NO_MORE_DOCS;
+        for (auto& operand : operands) {
+            operand.advance(target);
+            next_doc = min(next_doc, operand.docId());
+        }
+        current = next_doc;
+    }
+};
+
+// OR большого числа операндов (обычно раскрытая подстановка): операнды лежат в min-куче по doc_id,
+// поэтому переход к следующему доку стоит O(log n) на каждый сдвинутый операнд, а не O(n)
+constexpr size_t LINEAR_DISJUNCTION_LIMIT = 16;
+
+template <typename Operand>
+class HeapDisjunctionCursor : public QueryCursor {
+private:
+    vector<Operand> operands;
+    vector<size_t> heap; // номера операндов, heap[0] - операнд с наименьшим doc_id
+
+    int docOf(size_t slot) const { return operands[heap[slot]].docId(); }
+
+    // вершина сдвинулась вперед - опускаем ее на место
+    void siftDown() {
+        size_t slot = 0, top = heap[0];
+        int doc_id = operands[top].docId();
+        while (true) {
+            size_t child = 2 * slot + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && docOf(child + 1) < docOf(child)) child++;
+            if (docOf(child) >= doc_id) break;
+            heap[slot] = heap[child];
+            slot = child;
+        }
+        heap[slot] = top;
+    }
+
+public:
+    HeapDisjunctionCursor(vector<Operand> operand_iterators) : operands(move(operand_iterators)), heap(operands.size()) {
+        iota(heap.begin(), heap.end(), 0);
+        make_heap(heap.begin(), heap.end(), [&](size_t a, size_t b) { return operands[a].docId() > operands[b].docId(); });
+        if (!heap.empty()) current = docOf(0);
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        while (docOf(0) == current) {
+            operands[heap[0]].next();
+            siftDown();
+        }
+        current = docOf(0);
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        while (docOf(0) < target) {
+            operands[heap[0]].advance(target);
+            siftDown();
+        }
+        current = docOf(0);
+    }
+};
+
+// Плотный широкий OR (суммарная длина списков сравнима с диапазоном doc_id) выгоднее сразу слить
+// в битовую карту, по которой курсор идет пословно. Слияние стоит O(суммы длин списков) без сравнений
+// между операндами, но результат строится целиком, а карта занимает бит на каждый doc_id до наибольшего.
+// Карта окупается, если на ее слово (64 doc_id) приходится хотя бы два постинга
+constexpr size_t BITMAP_DISJUNCTION_DENSITY = 32;
+
+inline bool denseDisjunction(const vector<PostingRef>& lists) {
+    size_t total = 0;
+    int max_doc_id = -1;
+    for (const PostingRef& list : lists) {
+        total += list.size();
+        max_doc_id = max(max_doc_id, list.lastDocId());
+    }
+    return total * BITMAP_DISJUNCTION_DENSITY > static_cast<size_t>(max_doc_id + 1);
+}
+
+class BitmapCursor : public QueryCursor {
+private:
+    DocBitmap docs;
+    size_t word = 0;
+    uint64_t bits = 0;
+
+    void findMatch() {
+        while (!bits) {
+            if (++word >= docs.words.size()) {
+                current = NO_MORE_DOCS;
+                return;
+            }
+            bits = docs.words[word];
+        }
+        current = static_cast<int>(word * 64 + __builtin_ctzll(bits));
+    }
+
+public:
+    BitmapCursor(const vector<PostingRef>& lists) {
+        for (const PostingRef& list : lists) {
+            for (PostingCursor cursor(list); !cursor.atEnd(); cursor.next()) docs.set(cursor.docId());
+        }
+        if (docs.words.empty()) return;
+        bits = docs.words[0];
+        findMatch();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        bits &= bits - 1;
+        findMatch();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        size_t target_word = target >> 6;
+        if (target_word >= docs.words.size()) {
+            current = NO_MORE_DOCS;
+            return;
+        }
+        if (target_word != word) {
+            word = target_word;
+            bits = docs.words[word];
+        }
+        bits &= ~uint64_t(0) << (target & 63);
+        findMatch();
+    }
+};
+
+// NOT: все доки источника без исключенных. Битовая карта всех доков читается по словам:
+// из очередного слова сразу вычеркиваются исключенные доки этого диапазона, остальные биты и есть результат
+class ComplementCursor : public QueryCursor {
+private:
+    const DocBitmap& docs;
+    unique_ptr<QueryCursor> excluded;
+    size_t word;
+    uint64_t bits;
+
+    void loadWord(size_t new_word) {
+        word = new_word;
+        bits = word < docs.words.size() ? docs.words[word] : 0;
+        int base = static_cast<int>(word * 64);
+        excluded->advance(base);
+        while (excluded->docId() < base + 64) {
+            bits &= ~(uint64_t(1) << (excluded->docId() - base));
+            excluded->next();
+        }
+    }
+
+    void findMatch() {
+        while (!bits) {
+            if (word + 1 >= docs.words.size()) {
+                current = NO_MORE_DOCS;
+                return;
+            }
+            loadWord(word + 1);
+        }
+        current = static_cast<int>(word * 64 + __builtin_ctzll(bits));
+    }
+
+public:
+    ComplementCursor(const DocBitmap& all_docs, unique_ptr<QueryCursor> excluded_docs)
+        : docs(all_docs), excluded(move(excluded_docs)) {
+        loadWord(0);
+        findMatch();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        bits &= bits - 1;
+        findMatch();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        size_t target_word = target >> 6;
+        if (target_word >= docs.words.size()) {
+            current = NO_MORE_DOCS;
+            return;
+        }
+        if (target_word != word) loadWord(target_word);
+        bits &= ~uint64_t(0) << (target & 63);
+        findMatch();
+    }
+};
+
+// результат без удаленных доков: удаленный док остается в списках своей части до уплотнения,
+// и этот курсор снимает его с результата всего запроса. Операторы проверяют док только по его же
+// спискам, поэтому фильтр наверху дает тот же ответ, что и удаление из всех списков (и из универсума NOT)
+class LiveDocsCursor : public QueryCursor {
+private:
+    unique_ptr<QueryCursor> source;
+    const DocBitmap& deleted;
+
+    void skipDeleted() {
+        while (!source->atEnd() && deleted.test(source->docId())) source->next();
+        current = source->docId();
+    }
+
+public:
+    LiveDocsCursor(unique_ptr<QueryCursor> docs, const DocBitmap& deleted_docs)
+        : source(move(docs)), deleted(deleted_docs) {
+        skipDeleted();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        source->next();
+        skipDeleted();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        source->advance(target);
+        skipDeleted();
+    }
+};
+
+// узел плана в режиме профиля: время next()/advance() вместе с операндами (если узел timed) и выданные доки
+// (у списка терма выданные доки считает сам список, count_output = false); число доков переносится в узел
+// при уничтожении курсора
+class ProfiledCursor : public QueryCursor {
+private:
+    unique_ptr<QueryCursor> source;
+    QueryProfileNode* node;
+    QueryProfileNode* timed_node;
+    bool count_output;
+    uint64_t output = 0;
+
+    void update() {
+        current = source->docId();
+        if (count_output && !atEnd()) output++;
+    }
+
+public:
+    ProfiledCursor(unique_ptr<QueryCursor> cursor, QueryProfileNode* profile_node, bool count_docs = true)
+        : source(move(cursor)), node(profile_node), timed_node(profile_node->timed ? profile_node : nullptr),
+          count_output(count_docs) {
+        update();
+    }
+
+    ~ProfiledCursor() override {
+        node->output += output;
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        ProfileScope scope(timed_node);
+        source->next();
+        update();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        ProfileScope scope(timed_node);
+        source->advance(target);
+        update();
+    }
+};
+
+// первая позиция >= target в упорядоченных позициях data[from..size). Позиции проверяются пачками:
+// AVX2 сравнивает 8 позиций за раз, SSE2 - 4, и пачка, где все позиции меньше target, пропускается целиком
+inline size_t advancePosition(const int* data, size_t size, size_t from, int target) {
+    size_t i = from;
+#if defined(__AVX2__)
+    __m256i bound = _mm256_set1_epi32(target);
+    for (; i + 8 <= size; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned below = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(bound, block))));
+        if (below != 0xFF) return i + __builtin_ctz(~below);
+    }
+#elif defined(__SSE2__)
+    __m128i bound = _mm_set1_epi32(target);
+    for (; i + 4 <= size; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned below = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(block, bound))));
+        if (below != 0xF) return i + __builtin_ctz(~below);
+    }
+#endif
+    while (i < size && data[i] < target) i++;
+    return i;
+}
+
+// вид позиционного оператора
+enum class ProximityMode {
+    PHRASE,    // термы точно на своих смещениях от начала фразы
+    ORDERED,   // ADJ/k: позиции термов по возрастанию в порядке запроса, от первой до последней не больше k
+    UNORDERED  // NEAR/k: позиции термов в любом порядке в окне не шире k
+};
+
+// Фраза и NEAR/ADJ над N термами за один проход: доки-кандидаты - общие доки всех термов, их ведет
+// самый редкий терм (остальные догоняют его прыжками), и только у кандидатов читаются позиции.
+// Позиции всех термов дока проходятся одним слиянием, указатели двигаются только вперед
+// (advancePosition). Для двух термов NEAR/k и ADJ/k совпадают с прежними попарными операторами.
+// Буферы нужны для распаковки сжатых позиций одного дока
+class ProximityCursor : public QueryCursor {
+private:
+    vector<PositionsRef> lists;
+    // смещения термов во фразе (для NEAR/ADJ не используются)
+    vector<int> offsets;
+    vector<PostingCursor> cursors;
+    // термы по возрастанию длины списка: первый ведет перебор доков
+    vector<size_t> order;
+    int max_distance;
+    ProximityMode mode;
+    vector<vector<int>> buffers;
+    vector<PositionSpan> spans;
+    vector<size_t> at;
+
+    // общий док всех курсоров не раньше текущего дока ведущего
+    bool alignDocs() {
+        PostingCursor& lead = cursors[order[0]];
+        while (!lead.atEnd()) {
+            int target = lead.docId();
+            bool aligned = true;
+            for (size_t k = 1; k < order.size(); ++k) {
+                PostingCursor& cursor = cursors[order[k]];
+                cursor.advance(target);
+                if (cursor.atEnd()) return false;
+                if (cursor.docId() != target) {
+                    lead.advance(cursor.docId());
+                    aligned = false;
+                    break;
+                }
+            }
+            if (aligned) return true;
+        }
+        return false;
+    }
+
+    void findMatch() {
+        while (alignDocs()) {
+            for (size_t t = 0; t < lists.size(); ++t) {
+                spans[t] = lists[t].positionsOf(cursors[t].index(), cursors[t].docId(), buffers[t]);
+                at[t] = 0;
+            }
+            if (positionsMatch()) {
+                current = cursors[order[0]].docId();
+                return;
+            }
+            cursors[order[0]].next();
+        }
+        current = NO_MORE_DOCS;
+    }
+
+    bool positionsMatch() {
+        switch (mode) {
+            case ProximityMode::PHRASE: return hasPhrase();
+            case ProximityMode::ORDERED: return hasOrderedWindow();
+            default: return hasWindow();
+        }
+    }
+
+    // начало фразы base: каждый терм t стоит на base + offsets[t]. Кандидаты дает терм с меньшим числом
+    // позиций в доке; терм, который проскочил свое место, переносит начало вперед
+    bool hasPhrase() {
+        size_t driver = 0;
+        for (size_t t = 1; t < spans.size(); ++t) {
+            if (spans[t].size < spans[driver].size) driver = t;
+        }
+        if (spans[driver].size == 0) return false;
+        int base = spans[driver].data[0] - offsets[driver];
+        while (true) {
+            bool found = true;
+            for (size_t t = 0; t < spans.size(); ++t) {
+                int target = base + offsets[t];
+                at[t] = advancePosition(spans[t].data, spans[t].size, at[t], target);
+                if (at[t] == spans[t].size) return false;
+                if (spans[t].data[at[t]] != target) {
+                    base = spans[t].data[at[t]] - offsets[t];
+                    found = false;
+                    break;
+                }
+            }
+            if (found) return true;
+        }
+    }
+
+    // от каждого начала (позиции первого терма) жадно берем для следующего терма первую позицию правее
+    // предыдущей: так конец окна наименьший. Концы окон растут вместе с началом, поэтому начало сразу
+    // переносится туда, откуда окно может уложиться в max_distance
+    bool hasOrderedWindow() {
+        const PositionSpan& first = spans[0];
+        while (at[0] < first.size) {
+            int start = first.data[at[0]];
+            int last = start;
+            for (size_t t = 1; t < spans.size(); ++t) {
+                at[t] = advancePosition(spans[t].data, spans[t].size, at[t], last + 1);
+                if (at[t] == spans[t].size) return false;
+                last = spans[t].data[at[t]];
+            }
+            if (last - start <= max_distance) return true;
+            at[0] = advancePosition(first.data, first.size, at[0] + 1, last - max_distance);
+        }
+        return false;
+    }
+
+    // наименьшее окно с позицией каждого терма: окно [самая левая, самая правая] текущих позиций;
+    // если оно шире max_distance, самая левая позиция ни в какое подходящее окно не входит,
+    // и ее терм прыгает сразу к позиции >= правая - max_distance
+    bool hasWindow() {
+        for (const auto& span : spans) {
+            if (span.size == 0) return false;
+        }
+        while (true) {
+            size_t left = 0;
+            int right = spans[0].data[at[0]];
+            for (size_t t = 1; t < spans.size(); ++t) {
+                int position = spans[t].data[at[t]];
+                if (position < spans[left].data[at[left]]) left = t;
+                right = max(right, position);
+            }
+            if (right - spans[left].data[at[left]] <= max_distance) return true;
+            at[left] = advancePosition(spans[left].data, spans[left].size, at[left] + 1, right - max_distance);
+            if (at[left] == spans[left].size) return false;
+        }
+    }
+
+public:
+    ProximityCursor(vector<PositionsRef> positions, vector<int> term_offsets, int distance, ProximityMode proximity_mode)
+        : lists(move(positions)), offsets(move(term_offsets)), max_distance(distance), mode(proximity_mode),
+          buffers(lists.size()), spans(lists.size()), at(lists.size()) {
+        for (const auto& list : lists) cursors.emplace_back(list.doc_ids);
+        order.resize(lists.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return lists[a].doc_ids.size() < lists[b].doc_ids.size();
+        });
+        if (!lists.empty()) findMatch();
+    }
+
+    void next() override {
+        if (atEnd()) return;
+        cursors[order[0]].next();
+        findMatch();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        cursors[order[0]].advance(target);
+        findMatch();
+    }
+};
+
+#endif
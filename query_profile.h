@@ -0,0 +1,294 @@
+#ifndef QUERY_PROFILE_H
+#define QUERY_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+// Профиль запроса (EXPLAIN ANALYZE): дерево узлов плана, как их на самом деле выполнили.
+// Корень - весь запрос (разбор, части индекса), под частью - операторы ее плана. Счетчики узла:
+//   input       - доков на входе: длина списка терма (или сумма длин у NEAR/ADJ/фраз) либо сумма выходов операндов
+//   output      - доков, которые узел выдал
+//   scanned     - позиций списка терма, на которых курсор побывал
+//   skipped     - позиций, которые курсор перепрыгнул (скипы, блоки, галоп)
+//   decoded     - байт doc_id, распакованных из сжатых блоков, на которых курсор останавливался
+//   allocations - выделений памяти за время узла вместе с операндами; считаются, только если в программу
+//                 скомпонован query_profile_alloc.cpp (он подменяет глобальный operator new), иначе 0
+//   nanoseconds - время узла вместе с операндами (selfNanoseconds - без них)
+// Термы внутри AND/OR читаются без отдельного курсора, поэтому у них есть счетчики, но нет своего времени.
+// Профиль собирается только по запросу: обычное выполнение его не трогает
+
+// выделения памяти текущим потоком
+inline uint64_t& queryAllocationCounter() {
+    thread_local uint64_t allocations = 0;
+    return allocations;
+}
+
+inline uint64_t profileClockNanoseconds() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct QueryProfileNode {
+    string operation;
+    string detail;
+    uint64_t input = 0;
+    uint64_t output = 0;
+    uint64_t scanned = 0;
+    uint64_t skipped = 0;
+    uint64_t decoded_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t nanoseconds = 0;
+    // время каждого шага курсоров (два чтения часов на next/advance); без него у операторов время
+    // только открытия, а время запроса, частей и разбора измеряется всегда. Узлы наследуют флаг родителя
+    bool timed = true;
+    vector<shared_ptr<QueryProfileNode>> children;
+
+    QueryProfileNode* addChild(const string& child_operation, const string& child_detail = "") {
+        children.push_back(make_shared<QueryProfileNode>());
+        children.back()->operation = child_operation;
+        children.back()->detail = child_detail;
+        children.back()->timed = timed;
+        return children.back().get();
+    }
+
+    // пометка к подписи узла (попадание в кэш, способ вычисления)
+    void note(const string& text) {
+        if (!detail.empty()) detail += ' ';
+        detail += text;
+    }
+
+    uint64_t selfNanoseconds() const {
+        uint64_t nested = 0;
+        for (const auto& child : children) nested += child->nanoseconds;
+        return nanoseconds > nested ? nanoseconds - nested : 0;
+    }
+
+    uint64_t selfAllocations() const {
+        uint64_t nested = 0;
+        for (const auto& child : children) nested += child->allocations;
+        return allocations > nested ? allocations - nested : 0;
+    }
+
+    // вход операторов, который не задан явно, - сумма выходов операндов
+    void finish() {
+        uint64_t children_output = 0;
+        for (const auto& child : children) {
+            child->finish();
+            children_output += child->output;
+        }
+        if (input == 0) input = children_output;
+    }
+
+    // дерево текстом, по строке на узел
+    string explain() const {
+        ostringstream out;
+        format(out, 0);
+        return out.str();
+    }
+
+    void format(ostream& out, int depth) const {
+        out << string(2 * depth, ' ') << operation;
+        if (!detail.empty()) out << " " << detail;
+        out << fixed << setprecision(3) << "  (time " << nanoseconds / 1e6 << " ms, self " << selfNanoseconds() / 1e6
+            << " ms, in " << input << ", out " << output;
+        if (scanned || skipped) out << ", scanned " << scanned << ", skipped " << skipped;
+        if (decoded_bytes) out << ", decoded " << decoded_bytes << " B";
+        if (allocations) out << ", allocations " << allocations;
+        out << ")\n";
+        for (const auto& child : children) child->format(out, depth + 1);
+    }
+};
+
+// время и выделения памяти за время жизни области прибавляются к узлу (nullptr - без профиля)
+class ProfileScope {
+private:
+    QueryProfileNode* node;
+    uint64_t start_ns = 0;
+    uint64_t start_allocations = 0;
+
+public:
+    explicit ProfileScope(QueryProfileNode* profile_node) : node(profile_node) {
+        if (!node) return;
+        start_allocations = queryAllocationCounter();
+        start_ns = profileClockNanoseconds();
+    }
+
+    ~ProfileScope() {
+        if (!node) return;
+        node->nanoseconds += profileClockNanoseconds() - start_ns;
+        node->allocations += queryAllocationCounter() - start_allocations;
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Гистограмма задержек: корзина b - от 2^b до 2^(b+1) нс, перцентили - по верхней границе корзины
+constexpr int LATENCY_BUCKETS = 40;
+
+struct LatencyHistogram {
+    uint64_t buckets[LATENCY_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    void add(uint64_t nanoseconds) {
+        int bucket = nanoseconds ? 63 - __builtin_clzll(nanoseconds) : 0;
+        buckets[min(bucket, LATENCY_BUCKETS - 1)]++;
+        count++;
+        total_ns += nanoseconds;
+        max_ns = max(max_ns, nanoseconds);
+    }
+
+    // верхняя оценка перцентиля (fraction от 0 до 1)
+    uint64_t percentile(double fraction) const {
+        if (count == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            seen += buckets[bucket];
+            if (seen >= rank) return min(max_ns, (uint64_t(2) << bucket) - 1);
+        }
+        return max_ns;
+    }
+};
+
+// сумма счетчиков всех узлов одного оператора (время и выделения - без операндов)
+struct OperatorMetrics {
+    uint64_t nodes = 0;
+    uint64_t input = 0;
+    uint64_t output = 0;
+    uint64_t scanned = 0;
+    uint64_t skipped = 0;
+    uint64_t decoded_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t self_nanoseconds = 0;
+};
+
+struct SlowQuery {
+    string kind;
+    string query;
+    uint64_t nanoseconds = 0;
+};
+
+// Число запоминаемых самых медленных запросов
+constexpr size_t SLOW_QUERY_LOG_SIZE = 20;
+
+// Сводные метрики запросов: гистограммы задержек по видам запросов, счетчики по операторам
+// и самые медленные запросы с текстом. Пока профилирование выключено (по умолчанию), запросы
+// выполняются как обычно и сюда ничего не пишется; включенное - профилирует каждый запрос,
+// но без времени шагов курсоров (см. QueryProfileNode::timed), чтобы счетчики стоили немного.
+// Общие для писателя и снимков, методы защищены мьютексом
+class QueryMetrics {
+private:
+    mutable mutex metrics_mutex;
+    atomic<bool> profiling{false};
+    map<string, LatencyHistogram> latency;
+    map<string, OperatorMetrics> operators;
+    // куча: на вершине самый быстрый из запомненных
+    vector<SlowQuery> slowest;
+
+    static bool faster(const SlowQuery& a, const SlowQuery& b) {
+        return a.nanoseconds > b.nanoseconds;
+    }
+
+    void addOperators(const QueryProfileNode& node) {
+        OperatorMetrics& metrics = operators[node.operation];
+        metrics.nodes++;
+        metrics.input += node.input;
+        metrics.output += node.output;
+        metrics.scanned += node.scanned;
+        metrics.skipped += node.skipped;
+        metrics.decoded_bytes += node.decoded_bytes;
+        metrics.allocations += node.selfAllocations();
+        metrics.self_nanoseconds += node.selfNanoseconds();
+        for (const auto& child : node.children) addOperators(*child);
+    }
+
+public:
+    void setEnabled(bool enabled) { profiling = enabled; }
+    bool enabled() const { return profiling.load(memory_order_relaxed); }
+
+    // профиль выполненного запроса: корень - вид запроса с текстом в detail
+    void record(const QueryProfileNode& root) {
+        lock_guard<mutex> lock(metrics_mutex);
+        latency[root.operation].add(root.nanoseconds);
+        for (const auto& child : root.children) addOperators(*child);
+        SlowQuery query{root.operation, root.detail, root.nanoseconds};
+        if (slowest.size() < SLOW_QUERY_LOG_SIZE) {
+            slowest.push_back(move(query));
+            push_heap(slowest.begin(), slowest.end(), faster);
+        } else if (query.nanoseconds > slowest.front().nanoseconds) {
+            pop_heap(slowest.begin(), slowest.end(), faster);
+            slowest.back() = move(query);
+            push_heap(slowest.begin(), slowest.end(), faster);
+        }
+    }
+
+    map<string, LatencyHistogram> latencies() const {
+        lock_guard<mutex> lock(metrics_mutex);
+        return latency;
+    }
+
+    map<string, OperatorMetrics> operatorMetrics() const {
+        lock_guard<mutex> lock(metrics_mutex);
+        return operators;
+    }
+
+    // самые медленные запросы, от медленного к быстрому
+    vector<SlowQuery> slowQueries() const {
+        lock_guard<mutex> lock(metrics_mutex);
+        vector<SlowQuery> result = slowest;
+        sort(result.begin(), result.end(), faster);
+        return result;
+    }
+
+    void reset() {
+        lock_guard<mutex> lock(metrics_mutex);
+        latency.clear();
+        operators.clear();
+        slowest.clear();
+    }
+
+    void dump(ostream& out) const {
+        auto latency_copy = latencies();
+        auto operators_copy = operatorMetrics();
+        auto slow = slowQueries();
+
+        out << fixed << setprecision(1);
+        out << "latency (us)\tqueries\tmean\tp50\tp90\tp99\tmax\n";
+        for (const auto& [kind, histogram] : latency_copy) {
+            out << kind << "\t" << histogram.count << "\t" << histogram.total_ns / 1e3 / max<uint64_t>(1, histogram.count)
+                << "\t" << histogram.percentile(0.5) / 1e3 << "\t" << histogram.percentile(0.9) / 1e3
+                << "\t" << histogram.percentile(0.99) / 1e3 << "\t" << histogram.max_ns / 1e3 << "\n";
+        }
+        out << "\noperator\tnodes\tinput\toutput\tscanned\tskipped\tdecoded B\tallocations\tself us\n";
+        for (const auto& [operation, metrics] : operators_copy) {
+            out << operation << "\t" << metrics.nodes << "\t" << metrics.input << "\t" << metrics.output << "\t"
+                << metrics.scanned << "\t" << metrics.skipped << "\t" << metrics.decoded_bytes << "\t"
+                << metrics.allocations << "\t" << metrics.self_nanoseconds / 1e3 << "\n";
+        }
+        out << "\nslowest queries (us)\n";
+        for (const auto& query : slow) out << query.nanoseconds / 1e3 << "\t" << query.kind << "\t" << query.query << "\n";
+    }
+
+    bool dumpToFile(const string& path) const {
+        ofstream out(path);
+        if (!out) return false;
+        dump(out);
+        return static_cast<bool>(out);
+    }
+};
+
+#endif
@@ -0,0 +1,37 @@
+// Подмена глобальных operator new/delete для счетчика выделений в профиле запросов (QueryProfileNode::allocations).
+// Компонуется только в программу, которой нужен этот счетчик (интерактивный test.cpp), и только один раз
+#include "query_profile.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// подменяются все формы new/delete, кроме выровненных, чтобы выделение и освобождение всегда были парными
+static void* countedAllocation(std::size_t size) noexcept {
+    queryAllocationCounter()++;
+    return std::malloc(size ? size : 1);
+}
+
+// как стандартный operator new: при нехватке памяти вызывается new_handler, пока он установлен,
+// а повторные попытки считаются тем же выделением
+static void* countedOrThrow(std::size_t size) {
+    void* memory = countedAllocation(size);
+    while (!memory) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+        memory = std::malloc(size ? size : 1);
+    }
+    return memory;
+}
+
+void* operator new(std::size_t size) { return countedOrThrow(size); }
+void* operator new[](std::size_t size) { return countedOrThrow(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocation(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocation(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
@@ -5,68 +5,47 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
-#include <set>
+#include <unordered_set>
+#include <deque>
 #include <algorithm>
 #include <memory>
 #include <cmath>
 #include <fstream>
 #include <sstream>
 #include <random>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+#include "segment.h"
+#include "tokenizer.h"
+#include "query_cursor.h"
+#include "query_cache.h"
 
 using namespace std;
 
-// Структура для хранения позиций терма в документе
-struct TermPositions {
-    int doc_id;
-    vector<int> positions; // тут упорядоченный список
-
-    TermPositions(int doc) : doc_id(doc) {}
-
-    // для сортировки по doc_id
-    bool operator<(const TermPositions& other) const {
-        return doc_id < other.doc_id;
-    }
-};
-
-// Структура для обратного индекса: терм -> упорядоченный список doc_id
-using InvertedIndex = unordered_map<string, vector<int>>;
-
-// Структура для координатного индекса: терм -> упорядоченный список (doc_id + позиции терма в доке)
-using CoordinateIndex = unordered_map<string, vector<TermPositions>>;
-
-// Структура для полей документа
-struct DocumentField {
-    string name;
-    string content;
-    vector<string> tokens;
-    vector<int> positions;
-};
-
-// Структура для узла скип-листа для обратного индекса
-struct SkipListNode {
-    int doc_id;
-    shared_ptr<SkipListNode> next;
-    shared_ptr<SkipListNode> skip;
-
-    SkipListNode(int doc) : doc_id(doc), next(nullptr), skip(nullptr) {}
-};
-
 // Типы операторов
 enum class OperatorType {
-    TERM, AND, OR, NOT, NEAR, ADJ
+    TERM, AND, OR, NOT, NEAR, ADJ, WILDCARD, PHRASE
 };
 
 // Структура для узла дерева разбора запроса
 struct ASTNode {
     OperatorType type;
-    string value;           // Для термов
+    string value;           // Для термов (для WILDCARD - шаблон "prefix*" или "*suffix")
     string field;          // Для поиска по полям (если пустая строка - ищем по всем полям)
-    int distance;          // Для операций NEAR и ADJ
+    int distance;          // Для операций NEAR и ADJ; у термов фразы - смещение терма от начала фразы
     shared_ptr<ASTNode> left;
     shared_ptr<ASTNode> right;
+    // операнды n-арных AND/OR после планирования, термы NEAR/ADJ и фразы (left/right тогда пустые)
+    vector<shared_ptr<ASTNode>> children;
+    size_t estimated_cost;                // верхняя оценка размера результата, 0 - результат точно пуст
 
     ASTNode(OperatorType t, const string& val = "", const string& fld = "", int dist = 0)
-        : type(t), value(val), field(fld), distance(dist), left(nullptr), right(nullptr) {}
+        : type(t), value(val), field(fld), distance(dist), left(nullptr), right(nullptr), estimated_cost(0) {}
 };
 
 
@@ -89,23 +68,24 @@ public:
 
 
 private:
-    // токенизируем запрос
+    // токенизируем запрос (UTF-8: пробелы Unicode разделяют токены, как и при индексации)
     void tokenizeQuery(const string& query) {
         string token;
         bool in_quotes = false;
 
-        for (char c : query) {
+        for (size_t i = 0; i < query.size(); ++i) {
+            char c = query[i];
+            int space_length = isspace(static_cast<unsigned char>(c)) ? 1 : unicodeSpaceLength(query.data() + i, query.size() - i);
             if (c == '"') {
+                // кавычки остаются в токене: фраза в кавычках (и с полем - title:"a b") - один токен
                 in_quotes = !in_quotes;
+                token += c;
+            } else if (space_length && !in_quotes) {
                 if (!token.empty()) {
                     tokens.push_back(token);
                     token.clear();
                 }
-            } else if (isspace(c) && !in_quotes) {
-                if (!token.empty()) {
-                    tokens.push_back(token);
-                    token.clear();
-                }
+                i += space_length - 1;
             } else if ((c == '(' || c == ')' || c == '~' || c == '/') && !in_quotes) {
                 if (!token.empty()) {
                     tokens.push_back(token);
@@ -126,7 +106,7 @@ private:
         for (int i = 0; i < tokens.size(); ++i) {
             if ((tokens[i] == "NEAR" || tokens[i] == "ADJ") &&
                 i + 2 < tokens.size() && tokens[i + 1] == "/" &&
-                !tokens[i + 2].empty() && isdigit(tokens[i + 2][0])) {
+                !tokens[i + 2].empty() && isdigit(static_cast<unsigned char>(tokens[i + 2][0]))) {
 
                 combined_tokens.push_back(tokens[i] + "/" + tokens[i + 2]);
                 i += 2;
@@ -221,512 +201,2529 @@ private:
                 current += 3;
                 auto node = make_shared<ASTNode>(op == "NEAR" ? OperatorType::NEAR : OperatorType::ADJ, "", "", distance);
 
-                // Обрабатываем термы с полями для левого и правого операндов
-                auto left_node = parseFieldTerm(term1);
-                auto right_node = parseFieldTerm(term2);
-                node->left = left_node;
-                node->right = right_node;
+                // Обрабатываем термы с полями (подстановки тут не поддерживаются). Цепочка с тем же
+                // оператором "a NEAR/3 b NEAR/3 c" - одно окно над всеми термами
+                addProximityOperand(*node, parseFieldTerm(term1, false));
+                addProximityOperand(*node, parseFieldTerm(term2, false));
+                while (current + 1 < tokens.size() && tokens[current] == op_with_dist) {
+                    addProximityOperand(*node, parseFieldTerm(tokens[current + 1], false));
+                    current += 2;
+                }
                 return node;
             }
         }
         string term = tokens[current];
         current++;
-        return parseFieldTerm(term);
+        return parseFieldTerm(term, true);
     }
 
     // Парсинг терма с возможным указанием поля
-    shared_ptr<ASTNode> parseFieldTerm(const string& term_str) {
+    shared_ptr<ASTNode> parseFieldTerm(const string& term_str, bool allow_wildcards) {
         size_t colon_pos = term_str.find(':');
         
-        if (colon_pos != string::npos && colon_pos > 0 && colon_pos < term_str.length() - 1) {
+        if (colon_pos != string::npos && colon_pos > 0 && colon_pos < term_str.length() - 1 && term_str.front() != '"') {
             // если есть указание поля, то удалим кавычки, если есть и парсим терм с указанием поля
             string field = term_str.substr(0, colon_pos);
             string term = term_str.substr(colon_pos + 1);
             if (term.length() >= 2 && term.front() == '"' && term.back() == '"') {
                 term = term.substr(1, term.length() - 2);
             }
-            return make_shared<ASTNode>(OperatorType::TERM, term, field);
+            return makeTermOrPhrase(term, field, allow_wildcards);
         } else {
             // если его нет, то парсим терм с field = ""
             string term = term_str;
             if (term.length() >= 2 && term.front() == '"' && term.back() == '"') {
                 term = term.substr(1, term.length() - 2);
             }
-            return make_shared<ASTNode>(OperatorType::TERM, term, "");
+            return makeTermOrPhrase(term, "", allow_wildcards);
         }
     }
-};
-
-class TextIndexer {
-private:
-    InvertedIndex inverted_index;
-    CoordinateIndex coordinate_index;
-    unordered_map<string, shared_ptr<SkipListNode>> skip_lists;
-
-    unordered_map<int, string> doc_titles; // doc_id -> заголовок
-    unordered_map<int, string> doc_contents; //doc_id -> содержание
-    int next_doc_id;
-    set<int> all_doc_ids;
-
-    // Отдельные индексы для полей
-    unordered_map<string, InvertedIndex> field_inverted_index; // field_name -> inverted_index
-    unordered_map<string, CoordinateIndex> field_coordinate_index; // field_name -> coordinate_index
-
-public:
-    TextIndexer() : next_doc_id(1) {}
-
-    // добавление документа с его полями
-    int addDocument(const vector<pair<string, string>>& document_pairs) {
-        int doc_id = next_doc_id++;
-        all_doc_ids.insert(doc_id);
 
-        string full_content;
-        string title;
-
-        // обрабатываем поля документа
-        for (const auto& [field_name, text] : document_pairs) {
-            DocumentField field;
-            field.name = field_name;
-            field.content = text;
+    // текст из нескольких токенов ("central bank rate" или a.b) - фраза: его термы должны стоять
+    // в доке подряд, на тех же позициях друг относительно друга, что и в запросе (токены, пустые после
+    // нормализации, занимают позицию, как и при индексации). Подстановки внутри фразы не раскрываются
+    static shared_ptr<ASTNode> makeTermOrPhrase(const string& text, const string& field, bool allow_wildcards) {
+        vector<string_view> words = tokenize(text);
+        if (words.size() <= 1) return makeTermNode(text, field, allow_wildcards);
+
+        auto phrase = make_shared<ASTNode>(OperatorType::PHRASE, "", field);
+        int first_position = -1;
+        for (size_t position = 0; position < words.size(); ++position) {
+            string term = normalizeTerm(words[position]);
+            if (term.empty()) continue;
+            if (first_position < 0) first_position = static_cast<int>(position);
+            phrase->children.push_back(make_shared<ASTNode>(OperatorType::TERM, term, field, position - first_position));
+        }
+        if (phrase->children.size() == 1) return phrase->children[0];
+        if (phrase->children.empty()) return make_shared<ASTNode>(OperatorType::TERM, text, field);
+        return phrase;
+    }
 
-            // токенизируем
-            vector<string> tokens = tokenize(text);
-            field.tokens = tokens;
-            full_content += text + " ";
+    // операнд NEAR/ADJ - терм; фраза становится своими термами по порядку
+    static void addProximityOperand(ASTNode& node, const shared_ptr<ASTNode>& operand) {
+        if (operand->type != OperatorType::PHRASE) {
+            node.children.push_back(operand);
+            return;
+        }
+        for (const auto& term : operand->children) {
+            node.children.push_back(make_shared<ASTNode>(OperatorType::TERM, term->value, term->field));
+        }
+    }
 
-            if (field_name == "title") {
-                title = text;
-                doc_titles[doc_id] = title;
+    // "prefix*" и "*suffix" - подстановка: шаблон хранится с нормализованной основой.
+    // Звездочка с обеих сторон или без основы подстановкой не считается (как и раньше, она просто отбрасывается)
+    static shared_ptr<ASTNode> makeTermNode(const string& term, const string& field, bool allow_wildcards) {
+        if (allow_wildcards && term.size() >= 2 && (term.back() == '*') != (term.front() == '*')) {
+            bool is_prefix = term.back() == '*';
+            string stem = normalizeTerm(is_prefix ? term.substr(0, term.size() - 1) : term.substr(1));
+            if (!stem.empty()) {
+                return make_shared<ASTNode>(OperatorType::WILDCARD, is_prefix ? stem + "*" : "*" + stem, field);
             }
+        }
+        return make_shared<ASTNode>(OperatorType::TERM, term, field);
+    }
+};
 
-            if (field_name == "content") {
-                doc_contents[doc_id] = text;
+// операнды NEAR/ADJ: термы в children (разбор) или left/right (узел, собранный вручную)
+inline vector<shared_ptr<ASTNode>> proximityOperands(const shared_ptr<ASTNode>& node) {
+    if (!node->children.empty()) return node->children;
+    return {node->left, node->right};
+}
+
+// Каноническая запись запроса (ключ кэша): термы нормализованы, операнды AND/OR раскрыты, упорядочены
+// и без повторов, NOT NOT x = x, операнды NEAR упорядочены (NEAR симметричен, ADJ - нет).
+// Запросы, которые отличаются только записью ("b AND a", "(a b) AND a", "A and B"), получают одну строку
+inline string canonicalQuery(const shared_ptr<ASTNode>& node);
+
+inline void collectCanonicalOperands(const shared_ptr<ASTNode>& node, OperatorType type, vector<string>& operands) {
+    // операнды как в QueryEvaluator::operandsOf: n-арные после планирования или left/right
+    vector<shared_ptr<ASTNode>> children = node->children;
+    if (children.empty()) {
+        children = {node->left};
+        if (node->right) children.push_back(node->right);
+    }
+    for (const auto& child : children) {
+        if (child && child->type == type) {
+            collectCanonicalOperands(child, type, operands);
+        } else {
+            operands.push_back(canonicalQuery(child));
+        }
+    }
+}
+
+// поле пишется с длиной: в кавычках оно может содержать пробелы и скобки
+inline string canonicalField(const string& field) {
+    return to_string(field.size()) + ":" + field;
+}
+
+inline string canonicalQuery(const shared_ptr<ASTNode>& node) {
+    if (!node) return "";
+    switch (node->type) {
+        case OperatorType::TERM:
+            return "T(" + canonicalField(node->field) + normalizeTerm(node->value) + ")";
+
+        case OperatorType::WILDCARD:
+            return "W(" + canonicalField(node->field) + node->value + ")";
+
+        case OperatorType::NEAR:
+        case OperatorType::ADJ: {
+            vector<string> operands;
+            for (const auto& operand : proximityOperands(node)) operands.push_back(canonicalQuery(operand));
+            if (node->type == OperatorType::NEAR) sort(operands.begin(), operands.end());
+            string result = (node->type == OperatorType::NEAR ? "NEAR/" : "ADJ/") + to_string(node->distance) + "(";
+            for (size_t i = 0; i < operands.size(); ++i) {
+                if (i) result += ' ';
+                result += operands[i];
             }
-
-            // и индексируем конкретное поле
-            indexField(doc_id, field_name, text);
+            return result + ")";
         }
 
-        // а тут индексируем документ целиком + не забываем отсортировать все индексы после добавления очередного дока
-        indexDocumentFields(doc_id, full_content);
-        sortIndexes();
+        case OperatorType::PHRASE: {
+            string result = "P(";
+            for (const auto& term : node->children) result += " " + to_string(term->distance) + canonicalQuery(term);
+            return result + ")";
+        }
 
-        return doc_id;
+        case OperatorType::NOT:
+            if (node->left && node->left->type == OperatorType::NOT) return canonicalQuery(node->left->left);
+            return "NOT(" + canonicalQuery(node->left) + ")";
+
+        default: {
+            vector<string> operands;
+            collectCanonicalOperands(node, node->type, operands);
+            sort(operands.begin(), operands.end());
+            operands.erase(unique(operands.begin(), operands.end()), operands.end());
+            if (operands.size() == 1) return operands[0];
+            string result = node->type == OperatorType::AND ? "AND(" : "OR(";
+            for (size_t i = 0; i < operands.size(); ++i) {
+                if (i) result += ' ';
+                result += operands[i];
+            }
+            return result + ")";
+        }
     }
+}
+
+// название оператора в профиле запроса
+inline string operatorName(OperatorType type) {
+    switch (type) {
+        case OperatorType::TERM: return "TERM";
+        case OperatorType::AND: return "AND";
+        case OperatorType::OR: return "OR";
+        case OperatorType::NOT: return "NOT";
+        case OperatorType::NEAR: return "NEAR";
+        case OperatorType::ADJ: return "ADJ";
+        case OperatorType::WILDCARD: return "WILDCARD";
+        default: return "PHRASE";
+    }
+}
+
+// узел части индекса в профиле запроса (nullptr - без профиля)
+inline QueryProfileNode* addPartProfile(QueryProfileNode* profile, const IndexReader& part) {
+    return profile ? profile->addChild("PART", to_string(part.allDocs().count()) + " docs") : nullptr;
+}
+
+// узел готового результата из кэша итоговых результатов
+inline QueryProfileNode* addResultCacheProfile(QueryProfileNode* profile, size_t found) {
+    if (!profile) return nullptr;
+    QueryProfileNode* node = profile->addChild("RESULT CACHE", "hit");
+    node->input = node->output = found;
+    return node;
+}
+
+// Удаленные доки (надгробия): док остается в списках своей части, пока уплотнение (TextIndexer::compact)
+// не перепишет ее, а запросы отсеивают его по этой карте. Номер состояния меняется при каждом
+// изменении карты и входит в ключи кэша итоговых результатов
+struct DeletedDocs {
+    DocBitmap docs;
+    uint64_t generation = nextIndexGeneration();
+};
 
-    // индексация конкретного поля
-    void indexField(int doc_id, const string& field_name, const string& text) {
-        vector<string> tokens = tokenize(text);
-        unordered_map<string, vector<int>> term_positions;
+// Вычисление запроса над одним источником списков (индекс в памяти или сегмент на диске)
+class QueryEvaluator {
+private:
+    const IndexReader& index;
+    // кэш результатов поддеревьев NOT и NEAR/ADJ (nullptr - без кэша)
+    QueryCache* cache;
+    // удаленные доки (nullptr - без удалений); поддеревья считаются без них, фильтр - в open()
+    const DeletedDocs* deleted;
+    // профиль (nullptr - без профиля): узел, под которым открываются операторы плана
+    QueryProfileNode* profile;
 
-        for (int pos = 0; pos < tokens.size(); ++pos) {
-            string term = normalizeTerm(tokens[pos]);
-            if (term.empty()) continue;
-            term_positions[term].push_back(pos);
-        }
+public:
+    QueryEvaluator(const IndexReader& reader, QueryCache* result_cache = nullptr, const DeletedDocs* deleted_docs = nullptr,
+                   QueryProfileNode* profile_node = nullptr)
+        : index(reader), cache(result_cache), deleted(deleted_docs), profile(profile_node) {}
 
-        // Обновляем индексы для конкретного поля
-        for (const auto& [term, positions] : term_positions) {
-            // обратный
-            auto& inv_list = field_inverted_index[field_name][term];
-            if (find(inv_list.begin(), inv_list.end(), doc_id) == inv_list.end()) {
-                inv_list.push_back(doc_id);
-            }
+    // курсор по результату запроса: доки выдаются по одному по мере продвижения
+    unique_ptr<QueryCursor> open(shared_ptr<ASTNode> ast) {
+        return openPlan(buildPlan(ast));
+    }
 
-            // координатный
-            auto& coord_list = field_coordinate_index[field_name][term];
-            bool doc_exists = false;
-            for (auto& term_pos : coord_list) {
-                if (term_pos.doc_id == doc_id) {
-                    term_pos.positions.insert(term_pos.positions.end(), positions.begin(), positions.end());
-                    doc_exists = true;
-                    break;
-                }
-            }
-            if (!doc_exists) {
-                TermPositions term_doc(doc_id);
-                term_doc.positions = positions;
-                coord_list.push_back(term_doc);
+    vector<int> execute(shared_ptr<ASTNode> ast) {
+        vector<int> result;
+        for (auto cursor = open(ast); !cursor->atEnd(); cursor->next()) {
+            result.push_back(cursor->docId());
+        }
+        return result;
+    }
+
+    // число найденных доков без сохранения самих doc_id; для одного терма без удалений - просто длина списка
+    size_t count(shared_ptr<ASTNode> ast) {
+        auto query_plan = buildPlan(ast);
+        if (query_plan && query_plan->type == OperatorType::TERM && !hasDeletions()) {
+            size_t found = lookupPostings(query_plan->value, query_plan->field).size();
+            if (profile) {
+                QueryProfileNode* node = profile->addChild("TERM", describeNode(query_plan) + " [list length]");
+                node->input = node->output = found;
             }
+            return found;
         }
+        auto cursor = openPlan(query_plan);
+        size_t found = 0;
+        for (; !cursor->atEnd(); cursor->next()) found++;
+        return found;
     }
 
-    // индексация документа целиком
-    void indexDocumentFields(int doc_id, const string& full_content) {
-        vector<string> tokens = tokenize(full_content);
-        unordered_map<string, vector<int>> term_positions;
+    // планирование запроса между разбором и вычислением: цепочки AND/OR раскрываются в n-арные узлы,
+    // операнды AND упорядочиваются по оценке размера (df), а NOT внутри AND становится вычитанием
+    shared_ptr<ASTNode> planQuery(shared_ptr<ASTNode> node) {
+        if (!node) return nullptr;
 
-        for (int pos = 0; pos < tokens.size(); ++pos) {
-            string term = normalizeTerm(tokens[pos]);
-            if (term.empty()) continue;
-            term_positions[term].push_back(pos);
-        }
+        switch (node->type) {
+            case OperatorType::TERM: {
+                auto plan = make_shared<ASTNode>(*node);
+                plan->estimated_cost = lookupPostings(node->value, node->field).size();
+                return plan;
+            }
 
-        // обновляем общие индексы
-        for (const auto& [term, positions] : term_positions) {
-            // обратный
-            auto& inv_list = inverted_index[term];
-            if (find(inv_list.begin(), inv_list.end(), doc_id) == inv_list.end()) {
-                inv_list.push_back(doc_id);
+            case OperatorType::NEAR:
+            case OperatorType::ADJ:
+            case OperatorType::PHRASE: {
+                auto plan = make_shared<ASTNode>(*node);
+                plan->estimated_cost = index.allDocs().count();
+                for (const auto& term : positionalOperands(node)) {
+                    plan->estimated_cost = min(plan->estimated_cost, lookupPostings(term->value, term->field).size());
+                }
+                return plan;
             }
 
-            // координатный
-            auto& coord_list = coordinate_index[term];
-            bool doc_exists = false;
-            for (auto& term_pos : coord_list) {
-                if (term_pos.doc_id == doc_id) {
-                    term_pos.positions.insert(term_pos.positions.end(), positions.begin(), positions.end());
-                    doc_exists = true;
-                    break;
+            case OperatorType::WILDCARD: {
+                // подстановка раскрывается в OR термов словаря этого источника
+                vector<string> expansions;
+                index.expandTerms(node->value, node->field, expansions);
+                auto plan = make_shared<ASTNode>(OperatorType::OR);
+                for (const auto& term : expansions) {
+                    auto operand = make_shared<ASTNode>(OperatorType::TERM, term, node->field);
+                    operand->estimated_cost = index.postings(term, node->field).size();
+                    plan->children.push_back(operand);
                 }
+                return planDisjunction(plan);
+            }
+
+            case OperatorType::NOT: {
+                auto operand = planQuery(node->left);
+                // NOT NOT x = x
+                if (operand && operand->type == OperatorType::NOT) return operand->left;
+                auto plan = make_shared<ASTNode>(OperatorType::NOT);
+                plan->left = operand;
+                plan->estimated_cost = index.allDocs().count();
+                return plan;
             }
-            if (!doc_exists) {
-                TermPositions term_doc(doc_id);
-                term_doc.positions = positions;
-                coord_list.push_back(term_doc);
+
+            case OperatorType::AND:
+            case OperatorType::OR: {
+                auto plan = make_shared<ASTNode>(node->type);
+                flattenOperands(node, node->type, plan->children);
+                return node->type == OperatorType::AND ? planConjunction(plan) : planDisjunction(plan);
             }
+
+            default:
+                return node;
         }
     }
 
-    // выполнение сложного запроса с рекурсивным вычислением его дерева
-    vector<int> executeQuery(const string& query) {
-        QueryParser parser(query);
-        auto ast = parser.parse();
-        if (!ast) return {};
-        return evaluateAST(ast);
+    // дерево курсоров по плану: операнды AND уже упорядочены планировщиком (ведущим идет самый редкий),
+    // NOT внутри AND исключает доки, одиночный NOT - дополнение до множества всех доков.
+    // В режиме профиля у каждого оператора свой узел, а курсор оператора считает время и выданные доки
+    unique_ptr<QueryCursor> openCursor(shared_ptr<ASTNode> node) {
+        if (!profile) return openOperator(node);
+        QueryProfileNode* parent = profile;
+        profile = parent->addChild(node ? operatorName(node->type) : "EMPTY", describeNode(node));
+        QueryProfileNode* operator_node = profile;
+        unique_ptr<QueryCursor> cursor;
+        {
+            ProfileScope scope(operator_node);
+            cursor = openOperator(node);
+        }
+        profile = parent;
+        bool term = node && node->type == OperatorType::TERM;
+        return make_unique<ProfiledCursor>(move(cursor), operator_node, !term);
     }
 
-    vector<int> evaluateAST(shared_ptr<ASTNode> node) {
-        if (!node) return {};
+    unique_ptr<QueryCursor> openOperator(shared_ptr<ASTNode> node) {
+        if (!node) return make_unique<TermQueryCursor>(emptyPostings());
 
         switch (node->type) {
             case OperatorType::TERM:
-                return searchTerm(node->value, node->field);
-
-            case OperatorType::AND:
-                return executeAND(evaluateAST(node->left), evaluateAST(node->right));
+                if (profile) return make_unique<CountingTermCursor>(lookupPostings(node->value, node->field), profile);
+                return make_unique<TermQueryCursor>(lookupPostings(node->value, node->field));
+
+            case OperatorType::AND: {
+                vector<shared_ptr<ASTNode>> positives, negatives;
+                for (const auto& operand : operandsOf(node)) {
+                    if (operand && operand->type == OperatorType::NOT) {
+                        negatives.push_back(operand->left);
+                    } else {
+                        positives.push_back(operand);
+                    }
+                }
+                if (profile && !negatives.empty()) profile->note("[" + to_string(negatives.size()) + " excluded]");
+                // одни отрицания: NOT a AND NOT b = NOT (a OR b)
+                if (positives.empty()) return make_unique<ComplementCursor>(index.allDocs(), openDisjunction(negatives));
+                unique_ptr<QueryCursor> excluded = negatives.empty() ? nullptr : openDisjunction(negatives);
+                if (positives.size() == 1 && !excluded) return openCursor(positives[0]);
+                if (allTerms(positives)) {
+                    if (profile) {
+                        return make_unique<ConjunctionCursor<CountingPostingIterator>>(countingOperands(positives),
+                                                                                         move(excluded));
+                    }
+                    return make_unique<ConjunctionCursor<PostingIterator>>(termOperands(positives), move(excluded));
+                }
+                return make_unique<ConjunctionCursor<SubqueryIterator>>(subqueryOperands(positives), move(excluded));
+            }
 
             case OperatorType::OR:
-                return executeOR(evaluateAST(node->left), evaluateAST(node->right));
+                return openDisjunction(operandsOf(node));
 
             case OperatorType::NOT:
-                return executeNOT(evaluateAST(node->left));
+                return openCached(node, [&]() -> unique_ptr<QueryCursor> {
+                    return make_unique<ComplementCursor>(index.allDocs(), openCursor(node->left));
+                });
 
             case OperatorType::NEAR:
-                return executeProximityQuery(
-                    node->left->value, node->right->value,
-                    node->left->field, node->right->field,
-                    node->distance, false);
-
             case OperatorType::ADJ:
-                return executeProximityQuery(
-                    node->left->value, node->right->value,
-                    node->left->field, node->right->field,
-                    node->distance, true);
+            case OperatorType::PHRASE:
+                return openCached(node, [&]() -> unique_ptr<QueryCursor> {
+                    // получаем списки позиций с учетом полей; без любого из термов совпадений нет
+                    vector<PositionsRef> lists;
+                    vector<int> offsets;
+                    for (const auto& term : positionalOperands(node)) {
+                        lists.emplace_back();
+                        if (!index.positions(normalizeTerm(term->value), term->field, lists.back())) {
+                            return make_unique<TermQueryCursor>(emptyPostings());
+                        }
+                        offsets.push_back(term->distance);
+                        if (profile) profile->input += lists.back().doc_ids.size();
+                    }
+                    ProximityMode mode = node->type == OperatorType::PHRASE ? ProximityMode::PHRASE :
+                                         node->type == OperatorType::ADJ ? ProximityMode::ORDERED : ProximityMode::UNORDERED;
+                    return make_unique<ProximityCursor>(move(lists), move(offsets), node->distance, mode);
+                });
 
             default:
-                return {};
+                return make_unique<TermQueryCursor>(emptyPostings());
+        }
+    }
+
+    unique_ptr<QueryCursor> openDisjunction(const vector<shared_ptr<ASTNode>>& operands) {
+        if (operands.size() == 1) return openCursor(operands[0]);
+        if (allTerms(operands)) {
+            // широкий OR термов (раскрытая подстановка): плотные списки дешевле слить в битовую карту,
+            // редкие - обходить кучей курсоров, не выделяя карту до наибольшего doc_id
+            if (operands.size() > LINEAR_DISJUNCTION_LIMIT) {
+                vector<PostingRef> lists;
+                for (const auto& operand : operands) lists.push_back(lookupPostings(operand->value, operand->field));
+                if (!denseDisjunction(lists)) {
+                    if (profile) {
+                        profile->note("[heap of " + to_string(lists.size()) + " lists]");
+                        return make_unique<HeapDisjunctionCursor<CountingPostingIterator>>(countingOperands(operands));
+                    }
+                    return make_unique<HeapDisjunctionCursor<PostingIterator>>(vector<PostingIterator>(lists.begin(), lists.end()));
+                }
+                if (profile) {
+                    // слияние в карту читает все списки целиком
+                    profile->note("[bitmap of " + to_string(lists.size()) + " lists]");
+                    for (const PostingRef& list : lists) {
+                        profile->input += list.size();
+                        profile->scanned += list.size();
+                        if (list.is_compressed) profile->decoded_bytes += sizeof(int) * list.size();
+                    }
+                }
+                return make_unique<BitmapCursor>(lists);
+            }
+            if (profile) return make_unique<DisjunctionCursor<CountingPostingIterator>>(countingOperands(operands));
+            return make_unique<DisjunctionCursor<PostingIterator>>(termOperands(operands));
         }
+        return make_unique<DisjunctionCursor<SubqueryIterator>>(subqueryOperands(operands));
     }
 
-    // Базовые операции
+    // список терма из индекса без копирования (для отсутствующего терма - пустой список)
+    PostingRef lookupPostings(const string& term, const string& field = "") {
+        return index.postings(normalizeTerm(term), field);
+    }
 
-    // Поиск по одному терму с учетом поля
-    vector<int> searchTerm(const string& term, const string& field = "") {
-        string normalized_term = normalizeTerm(term);
+    // термы фразы или NEAR/ADJ
+    static vector<shared_ptr<ASTNode>> positionalOperands(const shared_ptr<ASTNode>& node) {
+        return node->type == OperatorType::PHRASE ? node->children : proximityOperands(node);
+    }
 
-        // если field пустое, то ищем по всем полям, иначе - в конкретном
-        if (!field.empty()) {
-            auto field_it = field_inverted_index.find(field);
-            if (field_it != field_inverted_index.end()) {
-                auto term_it = field_it->second.find(normalized_term);
-                return term_it != field_it->second.end() ? term_it->second : vector<int>();
-            }
-            return vector<int>();
-        } else {
-            auto it = inverted_index.find(normalized_term);
-            return it != inverted_index.end() ? it->second : vector<int>();
+    // операнды AND/OR: n-арные после планирования или исходные left/right
+    static vector<shared_ptr<ASTNode>> operandsOf(shared_ptr<ASTNode> node) {
+        if (!node->children.empty()) return node->children;
+        vector<shared_ptr<ASTNode>> operands = {node->left};
+        if (node->right) operands.push_back(node->right);
+        return operands;
+    }
+
+private:
+    // Вспомогательные методы
+
+    bool hasDeletions() const {
+        return deleted && deleted->docs.count() > 0;
+    }
+
+    shared_ptr<ASTNode> buildPlan(const shared_ptr<ASTNode>& ast) {
+        if (!ast) return nullptr;
+        ProfileScope scope(profile ? profile->addChild("PLAN") : nullptr);
+        return planQuery(ast);
+    }
+
+    // курсор плана; удаленные доки снимаются с результата одним фильтром наверху
+    unique_ptr<QueryCursor> openPlan(const shared_ptr<ASTNode>& query_plan) {
+        if (!hasDeletions()) return openCursor(query_plan);
+        if (!profile) return make_unique<LiveDocsCursor>(openCursor(query_plan), deleted->docs);
+        QueryProfileNode* parent = profile;
+        profile = parent->addChild("LIVE DOCS", to_string(deleted->docs.count()) + " deleted");
+        QueryProfileNode* filter_node = profile;
+        unique_ptr<QueryCursor> cursor;
+        {
+            ProfileScope scope(filter_node);
+            cursor = make_unique<LiveDocsCursor>(openCursor(query_plan), deleted->docs);
         }
+        profile = parent;
+        return make_unique<ProfiledCursor>(move(cursor), filter_node);
     }
 
-    // Операция AND
-    vector<int> executeAND(const vector<int>& list1, const vector<int>& list2) {
-        vector<int> result;
-        if (list1.empty() || list2.empty()) return result;
-
-        int i = 0, j = 0;
-        while (i < list1.size() && j < list2.size()) {
-            if (list1[i] == list2[j]) {
-                result.push_back(list1[i]);
-                i++; j++;
-            } else if (list1[i] < list2[j]) {
-                i++;
-            } else {
-                j++;
+    // подпись узла в профиле: терм с полем, окно NEAR/ADJ, фраза
+    static string describeNode(const shared_ptr<ASTNode>& node) {
+        if (!node) return "";
+        auto term = [](const shared_ptr<ASTNode>& operand) {
+            return (operand->field.empty() ? "" : operand->field + ":") + normalizeTerm(operand->value);
+        };
+        switch (node->type) {
+            case OperatorType::TERM:
+                return term(node);
+            case OperatorType::NEAR:
+            case OperatorType::ADJ:
+            case OperatorType::PHRASE: {
+                string result = node->type == OperatorType::PHRASE ? "\"" : "/" + to_string(node->distance) + " (";
+                for (const auto& operand : positionalOperands(node)) {
+                    if (result.back() != '"' && result.back() != '(') result += ' ';
+                    result += term(operand);
+                }
+                return result + (node->type == OperatorType::PHRASE ? "\"" : ")");
             }
+            default:
+                return "";
         }
-        return result;
     }
 
-    // Операция OR
-    vector<int> executeOR(const vector<int>& list1, const vector<int>& list2) {
-        if (list1.empty()) return list2;
-        if (list2.empty()) return list1;
+    // Результат поддерева из кэша. При первом промахе поддерево остается ленивым: курсор записывает
+    // выданные доки и кладет их в кэш, только если его прошли до конца (страница, count с остановкой
+    // и AND не читают поддерево целиком). Повторный промах того же ключа - признак, что поддерево
+    // нужно часто, поэтому оно вычисляется до конца и запоминается.
+    // Ключ - состояние источника и каноническая запись поддерева
+    template <typename Open>
+    unique_ptr<QueryCursor> openCached(const shared_ptr<ASTNode>& node, Open&& open_cursor) {
+        if (!cache) return open_cursor();
+        string key = "S" + to_string(index.generation()) + " " + canonicalQuery(node);
+        shared_ptr<const CachedResult> cached = cache->find(key);
+        if (!cached && !cache->repeatedMiss(key)) {
+            if (profile) profile->note("[cache miss]");
+            return make_unique<RecordingCursor>(open_cursor(), [cache = cache, key](vector<int>& doc_ids) {
+                auto result = make_shared<CachedResult>();
+                result->doc_ids = move(doc_ids);
+                result->doc_ids.shrink_to_fit();
+                cache->insert(key, move(result));
+            });
+        }
+        if (profile) profile->note(cached ? "[cache hit]" : "[cache miss, stored]");
+        if (!cached) {
+            auto result = make_shared<CachedResult>();
+            for (auto cursor = open_cursor(); !cursor->atEnd(); cursor->next()) result->doc_ids.push_back(cursor->docId());
+            result->doc_ids.shrink_to_fit();
+            cache->insert(key, result);
+            cached = result;
+        }
+        return make_unique<ListCursor>(shared_ptr<const vector<int>>(cached, &cached->doc_ids));
+    }
+
+    static bool allTerms(const vector<shared_ptr<ASTNode>>& operands) {
+        return all_of(operands.begin(), operands.end(), [](const shared_ptr<ASTNode>& operand) {
+            return operand && operand->type == OperatorType::TERM;
+        });
+    }
 
-        vector<int> result;
-        int i = 0, j = 0;
+    vector<PostingIterator> termOperands(const vector<shared_ptr<ASTNode>>& operands) {
+        vector<PostingIterator> iterators;
+        for (const auto& operand : operands) iterators.emplace_back(lookupPostings(operand->value, operand->field));
+        return iterators;
+    }
 
-        while (i < list1.size() && j < list2.size()) {
-            if (list1[i] < list2[j]) {
-                result.push_back(list1[i++]);
-            } else if (list1[i] > list2[j]) {
-                result.push_back(list2[j++]);
+    // термы AND/OR в профиле: у каждого свой узел со счетчиками списка
+    vector<CountingPostingIterator> countingOperands(const vector<shared_ptr<ASTNode>>& operands) {
+        vector<CountingPostingIterator> iterators;
+        for (const auto& operand : operands) {
+            iterators.emplace_back(lookupPostings(operand->value, operand->field), profile->addChild("TERM", describeNode(operand)));
+        }
+        return iterators;
+    }
+
+    vector<SubqueryIterator> subqueryOperands(const vector<shared_ptr<ASTNode>>& operands) {
+        vector<SubqueryIterator> iterators;
+        for (const auto& operand : operands) iterators.emplace_back(openCursor(operand));
+        return iterators;
+    }
+
+    // раскрываем вложенные узлы того же типа (a AND (b AND c) -> AND(a, b, c)) и планируем операнды
+    void flattenOperands(shared_ptr<ASTNode> node, OperatorType type, vector<shared_ptr<ASTNode>>& operands) {
+        for (const auto& operand : operandsOf(node)) {
+            if (operand && operand->type == type) {
+                flattenOperands(operand, type, operands);
+                continue;
+            }
+            auto plan = planQuery(operand);
+            // после упрощения (NOT NOT) операнд мог сам стать узлом того же типа
+            if (plan && plan->type == type) {
+                operands.insert(operands.end(), plan->children.begin(), plan->children.end());
             } else {
-                result.push_back(list1[i++]);
-                j++;
+                operands.push_back(plan);
             }
         }
+    }
 
-        while (i < list1.size()) result.push_back(list1[i++]);
-        while (j < list2.size()) result.push_back(list2[j++]);
+    static size_t costOf(const shared_ptr<ASTNode>& node) {
+        return node ? node->estimated_cost : 0;
+    }
 
-        return result;
+    shared_ptr<ASTNode> planConjunction(shared_ptr<ASTNode> plan) {
+        auto& operands = plan->children;
+        // сначала позитивные операнды по возрастанию оценки, отрицания - в конце
+        stable_sort(operands.begin(), operands.end(), [](const shared_ptr<ASTNode>& a, const shared_ptr<ASTNode>& b) {
+            bool a_negative = a && a->type == OperatorType::NOT;
+            bool b_negative = b && b->type == OperatorType::NOT;
+            if (a_negative != b_negative) return b_negative;
+            return costOf(a) < costOf(b);
+        });
+
+        plan->estimated_cost = index.allDocs().count();
+        for (const auto& operand : operands) {
+            if (operand && operand->type == OperatorType::NOT) break;
+            plan->estimated_cost = min(plan->estimated_cost, costOf(operand));
+        }
+        // заведомо пустой операнд - весь AND пуст (пустой план = nullptr), остальное можно не вычислять
+        if (plan->estimated_cost == 0) return nullptr;
+        if (operands.size() == 1) return operands[0];
+        return plan;
     }
 
-    // Операция NOT
-    vector<int> executeNOT(const vector<int>& list) {
-        vector<int> result;
+    shared_ptr<ASTNode> planDisjunction(shared_ptr<ASTNode> plan) {
+        auto& operands = plan->children;
+        // заведомо пустые операнды ничего не добавляют
+        operands.erase(remove_if(operands.begin(), operands.end(),
+                                 [](const shared_ptr<ASTNode>& operand) { return costOf(operand) == 0; }),
+                       operands.end());
+        stable_sort(operands.begin(), operands.end(), [](const shared_ptr<ASTNode>& a, const shared_ptr<ASTNode>& b) {
+            return costOf(a) < costOf(b);
+        });
+
+        size_t cost = 0;
+        for (const auto& operand : operands) cost += costOf(operand);
+        plan->estimated_cost = min(cost, index.allDocs().count());
+        if (operands.empty()) return nullptr;
+        if (operands.size() == 1) return operands[0];
+        return plan;
+    }
+};
 
-        for (int doc_id : all_doc_ids) {
-            if (!binary_search(list.begin(), list.end(), doc_id)) {
-                result.push_back(doc_id);
+// on_term(терм, поле) для термов запроса вне NOT: термы, термы NEAR/ADJ и фраз и раскрытия подстановок
+// по всем частям (термы - как в запросе, до нормализации; повторы не отсекаются)
+template <typename Fn>
+void forEachQueryTerm(const shared_ptr<ASTNode>& node, const vector<const IndexReader*>& parts, Fn&& on_term, bool negated = false) {
+    if (!node) return;
+    switch (node->type) {
+        case OperatorType::TERM:
+            if (!negated) on_term(node->value, node->field);
+            break;
+        case OperatorType::WILDCARD:
+            if (!negated) {
+                vector<string> expansions;
+                for (const IndexReader* part : parts) part->expandTerms(node->value, node->field, expansions);
+                for (const auto& term : expansions) on_term(term, node->field);
             }
-        }
-        return result;
+            break;
+        case OperatorType::NEAR:
+        case OperatorType::ADJ:
+        case OperatorType::PHRASE:
+            if (!negated) {
+                for (const auto& term : QueryEvaluator::positionalOperands(node)) on_term(term->value, term->field);
+            }
+            break;
+        case OperatorType::NOT:
+            forEachQueryTerm(node->left, parts, on_term, !negated);
+            break;
+        default:
+            forEachQueryTerm(node->left, parts, on_term, negated);
+            forEachQueryTerm(node->right, parts, on_term, negated);
+            for (const auto& child : node->children) forEachQueryTerm(child, parts, on_term, negated);
+            break;
     }
+}
 
-    // поиск с ограничением расстояния между термами для NEAR и ADJ
-    vector<int> executeProximityQuery(const string& term1, const string& term2,
-                                     const string& field1, const string& field2,
-                                     int max_distance, bool adjacent_only = false) {
-        vector<int> results;
+// BM25: насыщение частоты терма и сила нормировки по длине дока
+constexpr double BM25_K1 = 1.2;
+constexpr double BM25_B = 0.75;
 
-        string norm_term1 = normalizeTerm(term1);
-        string norm_term2 = normalizeTerm(term2);
+// док с оценкой релевантности
+struct ScoredDocument {
+    int doc_id;
+    double score;
+};
 
-        // получаем списки позиций с учетом полей
-        const vector<TermPositions>* list1_ptr = nullptr;
-        const vector<TermPositions>* list2_ptr = nullptr;
+// Ранжированный поиск top-k по BM25 сразу по нескольким частям индекса. idf и средняя длина дока
+// считаются по всем частям, поэтому оценка дока не зависит от того, в какой части он лежит.
+// Запрос из термов через OR вычисляется WAND: курсоры термов идут вместе, а доки, у которых сумма
+// верхних границ оценок термов не превышает k-ю лучшую оценку, пропускаются без подсчета.
+// Для остальных запросов булев фильтр считает QueryEvaluator, а оцениваются только найденные доки.
+// Удаленные доки не оцениваются, но до уплотнения остаются в статистике (число доков, df, длины)
+class RankedEvaluator {
+private:
+    // терм запроса, влияющий на оценку (термы под NOT не влияют)
+    struct QueryTerm {
+        string term;
+        string field;
+        double idf;
+    };
+
+    // курсор терма в одной части индекса; частоты берутся из координатного списка
+    // с тем же порядком доков, что и в списке doc_id
+    struct TermScorer {
+        PostingCursor cursor;
+        PositionsRef positions;
+        size_t term;
+        double max_score;
+    };
+
+    const vector<const IndexReader*>& parts;
+    size_t k;
+    // кэш поддеревьев для булева фильтра (nullptr - без кэша)
+    QueryCache* cache;
+    // удаленные доки не оцениваются (nullptr - без удалений)
+    const DeletedDocs* deleted;
+    // профиль (nullptr - без профиля): под ним по узлу на часть индекса
+    QueryProfileNode* profile;
+    vector<QueryTerm> terms;
+    double average_length = 0;
+    // k лучших доков, на вершине худший из них
+    vector<ScoredDocument> heap;
+    // вклад каждого терма в оценку текущего дока
+    vector<double> contributions;
+    // позиции терма поля в доке (частота терма поля - число его позиций в диапазонах поля)
+    vector<int> positions_buffer;
+
+    // порядок результатов: оценка по убыванию, при равенстве doc_id по возрастанию
+    static bool better(const ScoredDocument& a, const ScoredDocument& b) {
+        return a.score > b.score || (a.score == b.score && a.doc_id < b.doc_id);
+    }
 
-        if (field1.empty()) {
-            auto it1 = coordinate_index.find(norm_term1);
-            if (it1 != coordinate_index.end()) list1_ptr = &it1->second;
-        } else {
-            auto field_it = field_coordinate_index.find(field1);
-            if (field_it != field_coordinate_index.end()) {
-                auto it1 = field_it->second.find(norm_term1);
-                if (it1 != field_it->second.end()) list1_ptr = &it1->second;
+public:
+    RankedEvaluator(const vector<const IndexReader*>& index_parts, size_t top_k, QueryCache* result_cache = nullptr,
+                    const DeletedDocs* deleted_docs = nullptr, QueryProfileNode* profile_node = nullptr)
+        : parts(index_parts), k(top_k), cache(result_cache), deleted(deleted_docs), profile(profile_node) {}
+
+    vector<ScoredDocument> execute(shared_ptr<ASTNode> ast) {
+        if (!ast || k == 0) return {};
+
+        {
+            ProfileScope scope(profile ? profile->addChild("TERM STATS") : nullptr);
+            uint64_t document_count = 0, total_length = 0;
+            for (const IndexReader* part : parts) {
+                document_count += part->allDocs().count();
+                total_length += part->totalLength();
             }
+            if (document_count == 0) return {};
+            average_length = max(1.0, static_cast<double>(total_length) / document_count);
+
+            collectTerms(ast);
+            for (auto& query_term : terms) {
+                size_t df = 0;
+                for (const IndexReader* part : parts) df += part->postings(query_term.term, query_term.field).size();
+                query_term.idf = log(1.0 + (document_count - df + 0.5) / (df + 0.5));
+            }
+            contributions.assign(terms.size(), 0.0);
         }
 
-        if (field2.empty()) {
-            auto it2 = coordinate_index.find(norm_term2);
-            if (it2 != coordinate_index.end()) list2_ptr = &it2->second;
-        } else {
-            auto field_it = field_coordinate_index.find(field2);
-            if (field_it != field_coordinate_index.end()) {
-                auto it2 = field_it->second.find(norm_term2);
-                if (it2 != field_it->second.end()) list2_ptr = &it2->second;
+        bool disjunction = !terms.empty() && isTermDisjunction(ast);
+        for (const IndexReader* part : parts) {
+            QueryProfileNode* part_node = addPartProfile(profile, *part);
+            ProfileScope scope(part_node);
+            if (disjunction) {
+                rankDisjunction(*part, part_node ? part_node->addChild("WAND") : nullptr);
+            } else {
+                rankMatches(*part, ast, part_node ? part_node->addChild("SCORE") : nullptr);
             }
+            if (part_node) part_node->output = part_node->children[0]->output;
         }
 
-        if (!list1_ptr || !list2_ptr) {
-            return results;
-        }
+        sort(heap.begin(), heap.end(), better);
+        return heap;
+    }
 
-        const auto& list1 = *list1_ptr;
-        const auto& list2 = *list2_ptr;
+private:
+    // термы, влияющие на оценку (повторы считаются один раз)
+    void collectTerms(const shared_ptr<ASTNode>& ast) {
+        forEachQueryTerm(ast, parts, [&](const string& value, const string& field) { addTerm(value, field); });
+    }
 
-        int i = 0, j = 0;
-        while (i < list1.size() && j < list2.size()) {
-            if (list1[i].doc_id == list2[j].doc_id) {
-                if (adjacent_only ?
-                    hasAdjacentPositions(list1[i].positions, list2[j].positions, max_distance) :
-                    hasClosePositions(list1[i].positions, list2[j].positions, max_distance)) {
-                    results.push_back(list1[i].doc_id);
-                }
-                i++; j++;
-            } else if (list1[i].doc_id < list2[j].doc_id) {
-                i++;
-            } else {
-                j++;
-            }
+    void addTerm(const string& value, const string& field) {
+        string term = normalizeTerm(value);
+        if (term.empty()) return;
+        for (const auto& query_term : terms) {
+            if (query_term.term == term && query_term.field == field) return;
         }
+        terms.push_back({term, field, 0.0});
+    }
 
-        return results;
+    // запрос - один терм или термы через OR (подстановка - тоже OR термов)
+    static bool isTermDisjunction(const shared_ptr<ASTNode>& node) {
+        if (!node) return false;
+        if (node->type == OperatorType::TERM || node->type == OperatorType::WILDCARD) return true;
+        return node->type == OperatorType::OR && isTermDisjunction(node->left) && isTermDisjunction(node->right);
     }
 
-    // методы для получения заголовка и содержания дока
-    string getDocumentTitle(int doc_id) {
-        auto it = doc_titles.find(doc_id);
-        return it != doc_titles.end() ? it->second : "Document " + to_string(doc_id);
+    double termScore(double idf, uint32_t tf, uint32_t length) const {
+        double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * length / average_length);
+        return idf * tf * (BM25_K1 + 1.0) / (tf + norm);
     }
 
-    string getDocumentContent(int doc_id) {
-        auto it = doc_contents.find(doc_id);
-        return it != doc_contents.end() ? it->second : "";
+    // верхняя граница оценки терма при частоте не больше max_tf (оценка максимальна у дока нулевой длины)
+    double scoreBound(double idf, uint32_t max_tf) const {
+        return termScore(idf, max_tf, 0);
     }
 
-private:
-    // Вспомогательные методы
+    bool isDeleted(int doc_id) const {
+        return deleted && deleted->docs.test(doc_id);
+    }
 
-    // токенизация
-    vector<string> tokenize(const string& text) {
-        vector<string> tokens;
-        string token;
+    // k-я лучшая оценка; док с оценкой не выше нее в результат не попадет
+    double threshold() const {
+        return heap.size() < k ? -1.0 : heap.front().score;
+    }
 
-        for (char c : text) {
-            if (isspace(c) || c == '.' || c == ',' || c == '!' || c == '?' || c == ';' || c == ':') {
-                if (!token.empty()) {
-                    tokens.push_back(token);
-                    token.clear();
-                }
-            } else {
-                token += c;
-            }
+    // граница проходит порог с запасом на погрешность суммирования
+    bool exceedsThreshold(double bound) const {
+        return bound + 1e-9 > threshold();
+    }
+
+    void offer(int doc_id, double score) {
+        ScoredDocument doc{doc_id, score};
+        if (heap.size() < k) {
+            heap.push_back(doc);
+            push_heap(heap.begin(), heap.end(), better);
+        } else if (better(doc, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = doc;
+            push_heap(heap.begin(), heap.end(), better);
         }
+    }
 
-        if (!token.empty()) {
-            tokens.push_back(token);
+    vector<TermScorer> openScorers(const IndexReader& part) {
+        vector<TermScorer> scorers;
+        for (size_t t = 0; t < terms.size(); ++t) {
+            PositionsRef positions;
+            if (!part.positions(terms[t].term, terms[t].field, positions)) continue;
+            PostingRef postings = part.postings(terms[t].term, terms[t].field);
+            if (postings.size() == 0) continue;
+            scorers.push_back({PostingCursor(postings), positions, t, scoreBound(terms[t].idf, positions.max_tf)});
         }
+        return scorers;
+    }
 
-        return tokens;
+    // вклады термов складываются в порядке термов запроса, чтобы оценка дока не зависела от порядка обхода
+    void scoreDocument(const IndexReader& part, int doc_id, const vector<TermScorer*>& matched) {
+        uint32_t length = part.documentLength(doc_id);
+        for (const TermScorer* scorer : matched) {
+            uint32_t tf = scorer->positions.frequency(scorer->cursor.index(), doc_id, positions_buffer);
+            contributions[scorer->term] = termScore(terms[scorer->term].idf, tf, length);
+        }
+        double score = 0;
+        for (double& contribution : contributions) {
+            score += contribution;
+            contribution = 0;
+        }
+        offer(doc_id, score);
     }
 
-    // нормализация терма
-    string normalizeTerm(const string& term) {
-        string result;
+    // WAND: курсоры упорядочены по текущему doc_id; опорный курсор - первый, на котором сумма границ
+    // превышает порог. Доки левее опорного не могут попасть в top-k, и курсоры перед ним сдвигаются сразу к нему.
+    // Если все курсоры до опорного уже стоят на одном доке, его граница уточняется по максимумам частот
+    // в блоках списков, и только если и она проходит порог, док оценивается полностью.
+    // В профиле: input - длины списков, scanned - доки-кандидаты, skipped - отсеянные по границе блоков,
+    // output - оцененные доки
+    void rankDisjunction(const IndexReader& part, QueryProfileNode* node) {
+        ProfileScope scope(node);
+        vector<TermScorer> scorers = openScorers(part);
+        if (node) {
+            for (const auto& scorer : scorers) node->input += part.postings(terms[scorer.term].term, terms[scorer.term].field).size();
+        }
+        vector<TermScorer*> order;
+        for (auto& scorer : scorers) order.push_back(&scorer);
+        vector<TermScorer*> matched;
+
+        while (true) {
+            order.erase(remove_if(order.begin(), order.end(), [](TermScorer* scorer) { return scorer->cursor.atEnd(); }),
+                        order.end());
+            sort(order.begin(), order.end(), [](TermScorer* a, TermScorer* b) {
+                return a->cursor.docId() < b->cursor.docId();
+            });
+
+            double bound = 0;
+            size_t pivot = 0;
+            while (pivot < order.size()) {
+                bound += order[pivot]->max_score;
+                if (exceedsThreshold(bound)) break;
+                ++pivot;
+            }
+            if (pivot == order.size()) break;
+            int pivot_doc = order[pivot]->cursor.docId();
+
+            if (order[0]->cursor.docId() != pivot_doc) {
+                for (size_t i = 0; i < pivot && order[i]->cursor.docId() < pivot_doc; ++i) {
+                    order[i]->cursor.advance(pivot_doc);
+                }
+                continue;
+            }
 
-        for (char c : term) {
-            if (isalnum(c)) {
-                result += tolower(c);
+            matched.clear();
+            double block_bound = 0;
+            for (TermScorer* scorer : order) {
+                if (scorer->cursor.docId() != pivot_doc) break;
+                matched.push_back(scorer);
+                const PositionsRef& positions = scorer->positions;
+                uint32_t block_tf = positions.block_max_tf
+                    ? positions.block_max_tf[scorer->cursor.index() / POSTING_BLOCK_SIZE] : positions.max_tf;
+                block_bound += scoreBound(terms[scorer->term].idf, block_tf);
             }
+            bool passes = exceedsThreshold(block_bound);
+            if (passes && !isDeleted(pivot_doc)) scoreDocument(part, pivot_doc, matched);
+            if (node) {
+                node->scanned++;
+                if (!passes) node->skipped++; else if (!isDeleted(pivot_doc)) node->output++;
+            }
+            for (TermScorer* scorer : matched) scorer->cursor.next();
         }
+    }
 
-        return result;
+    // булев фильтр + оценка найденных доков; когда сумма границ всех термов не проходит порог,
+    // остальные доки части уже не попадут в top-k. В профиле фильтр - операнд узла оценки
+    void rankMatches(const IndexReader& part, const shared_ptr<ASTNode>& ast, QueryProfileNode* node) {
+        ProfileScope scope(node);
+        vector<TermScorer> scorers = openScorers(part);
+        double bound = 0;
+        for (const auto& scorer : scorers) bound += scorer.max_score;
+
+        vector<TermScorer*> matched;
+        for (auto matches = QueryEvaluator(part, cache, deleted, node).open(ast); !matches->atEnd(); matches->next()) {
+            if (!exceedsThreshold(bound)) break;
+            int doc_id = matches->docId();
+            matched.clear();
+            for (auto& scorer : scorers) {
+                scorer.cursor.advance(doc_id);
+                if (!scorer.cursor.atEnd() && scorer.cursor.docId() == doc_id) matched.push_back(&scorer);
+            }
+            scoreDocument(part, doc_id, matched);
+            if (node) node->output++;
+        }
     }
+};
 
-    // сортировка индексов для поддержания структуры + удаление возможных дублей
-    void sortIndexes() {
-        // обратный индекс
-        for (auto& [term, doc_list] : inverted_index) {
-            sort(doc_list.begin(), doc_list.end());
-            auto last = unique(doc_list.begin(), doc_list.end());
-            doc_list.erase(last, doc_list.end());
+// Часть индекса в памяти для доков с doc_id >= first_doc_id: единый координатный индекс с полями
+// в постингах (см. field_ranges.h) и тексты доков. Часть, в которую идет запись, видит только писатель;
+// опубликованная часть (TextIndexer::publish) больше не меняется и читается из снимков без блокировок
+class MemoryIndex : public IndexReader {
+private:
+    // словарь части: каждый терм хранится один раз, списки адресуются его term_id
+    TermDictionary dictionary;
+    // единый индекс: term_id -> doc_id, позиции и маски полей терма. Обратный и координатный индексы
+    // держат один и тот же набор доков, поэтому doc_id хранятся один раз - в координатном списке.
+    // Отдельных индексов полей нет: запрос по полю фильтрует тот же список
+    deque<PositionalPostings> term_lists;
+    vector<SkipPointers> skip_lists; // term_id -> скипы по doc_id
+
+    // заголовки и содержание доков: запись i - док first_doc_id + i (см. doc_store.h)
+    DocStore doc_titles;
+    DocStore doc_contents;
+    DocBitmap all_doc_ids;
+    int first_doc_id;
+    // длина дока first_doc_id + i в термах и их сумма (для BM25)
+    vector<uint32_t> doc_lengths;
+    uint64_t total_length = 0;
+
+    // имена полей части (номер поля - индекс имени) и диапазоны полей доков
+    vector<string> field_names;
+    FieldRanges field_ranges;
+
+    // новые списки doc_id хранятся сжатыми блоками (см. posting_codec.h)
+    bool compress_postings;
+    // сжатые списки с неупакованным хвостом - упаковываются при финализации
+    vector<PostingList*> unsealed_lists;
+    // термы, списки которых менялись с последней финализации
+    unordered_set<uint32_t> dirty_terms;
+    // состояние части для ключей кэша: новый номер при каждом изменении
+    uint64_t index_generation = nextIndexGeneration();
+
+    // вхождение терма в док: позиция в сквозной нумерации полей дока и бит поля
+    struct TermOccurrence {
+        uint32_t term_id;
+        int position;
+        FieldMask field;
+
+        bool operator<(const TermOccurrence& other) const {
+            return term_id != other.term_id ? term_id < other.term_id : position < other.position;
         }
+    };
 
-        // координатный индекс
-        for (auto& [term, doc_positions] : coordinate_index) {
-            sort(doc_positions.begin(), doc_positions.end());
-            for (auto& term_pos : doc_positions) {
-                sort(term_pos.positions.begin(), term_pos.positions.end());
-                auto last = unique(term_pos.positions.begin(), term_pos.positions.end());
-                term_pos.positions.erase(last, term_pos.positions.end());
-            }
+    // буферы индексации дока, переиспользуются между доками: (term_id, позиция) поля,
+    // вхождения термов всего дока и диапазоны его полей
+    vector<pair<uint32_t, int>> field_terms;
+    vector<TermOccurrence> document_terms;
+    vector<FieldRange> document_fields;
+    vector<int> positions_buffer;
+    string term_buffer;
+
+public:
+    MemoryIndex(int first_doc, bool compress) : first_doc_id(first_doc), compress_postings(compress) {}
+
+    int firstDocId() const { return first_doc_id; }
+    // doc_id после последнего дока части (следующая часть начинается не раньше)
+    int nextDocId() const { return first_doc_id + static_cast<int>(doc_lengths.size()); }
+    size_t documentCount() const { return all_doc_ids.count(); }
+
+    // добавление документа с его полями (doc_id выдаются по возрастанию); поля - пары строк или string_view.
+    // Каждое поле токенизируется один раз, его термы идут в единый индекс с битом поля, а позиции
+    // продолжают нумерацию предыдущих полей (как если бы поля дока шли одним текстом)
+    template <typename Fields>
+    void addDocument(int doc_id, const Fields& document_pairs) {
+        index_generation = nextIndexGeneration();
+        all_doc_ids.set(doc_id);
+
+        document_terms.clear();
+        document_fields.clear();
+        uint32_t offset = 0;
+        for (const auto& [field_name, text] : document_pairs) {
+            if (field_name == "title") doc_titles.set(doc_id - first_doc_id, text);
+            if (field_name == "content") doc_contents.set(doc_id - first_doc_id, text);
+
+            uint32_t field = fieldId(field_name);
+            uint32_t token_count = collectTerms(text);
+            addOccurrences(offset, field);
+            document_fields.push_back({offset, offset + token_count, field});
+            offset += token_count;
         }
 
-        // и такие же индексы для полей
-        for (auto& [field_name, field_index] : field_inverted_index) {
-            for (auto& [term, doc_list] : field_index) {
-                sort(doc_list.begin(), doc_list.end());
-                auto last = unique(doc_list.begin(), doc_list.end());
-                doc_list.erase(last, doc_list.end());
+        field_ranges.add(doc_id - first_doc_id, document_fields.data(), document_fields.data() + document_fields.size());
+        setDocumentLength(doc_id, static_cast<uint32_t>(document_terms.size()));
+        appendTermPostings(doc_id);
+    }
+
+    // индексация еще одного поля уже добавленного дока: позиции поля продолжают нумерацию дока,
+    // а длина дока растет на число термов поля
+    void indexField(int doc_id, const string& field_name, const string& text) {
+        index_generation = nextIndexGeneration();
+        uint32_t field = fieldId(field_name);
+        uint32_t token_count = collectTerms(text);
+        document_terms.clear();
+        addOccurrences(field_ranges.extend(doc_id - first_doc_id, field, token_count), field);
+        setDocumentLength(doc_id, documentLength(doc_id) + static_cast<uint32_t>(document_terms.size()));
+        appendTermPostings(doc_id);
+    }
+
+    // дописать в конец части другие части с большими doc_id (по возрастанию диапазонов).
+    // Ключи в хеш-таблицах заводятся в одном потоке, а сами списки сливаются в thread_count потоков:
+    // задачи (термы) раздаются по одной, потому что списки частых термов сильно длиннее
+    void appendParts(const vector<const MemoryIndex*>& sources, int thread_count) {
+        index_generation = nextIndexGeneration();
+        vector<MergeTask> tasks;
+        unordered_map<const PositionalPostings*, size_t> task_of;
+        auto addSource = [&](PositionalPostings& list, const MergeSource& source) {
+            auto [it, inserted] = task_of.emplace(&list, tasks.size());
+            if (inserted) tasks.push_back({&list, {}});
+            tasks[it->second].sources.push_back(source);
+        };
+        // номера полей источника -> номера этой части (у каждого источника свой перевод)
+        vector<vector<uint32_t>> field_maps;
+        field_maps.reserve(sources.size());
+        vector<FieldRangesView> source_ranges;
+        source_ranges.reserve(sources.size());
+        for (const MemoryIndex* source : sources) {
+            // term_id источника -> term_id этой части
+            vector<uint32_t> term_ids(source->dictionary.size());
+            for (uint32_t id = 0; id < term_ids.size(); ++id) term_ids[id] = dictionary.intern(source->dictionary.term(id));
+            vector<uint32_t>& field_map = field_maps.emplace_back();
+            bool same_fields = true;
+            // поле без бита в источнике получило здесь бит: маски его списков строятся по позициям
+            bool gains_bits = false;
+            for (uint32_t field = 0; field < source->field_names.size(); ++field) {
+                field_map.push_back(fieldId(source->field_names[field]));
+                same_fields = same_fields && field_map.back() == field;
+                gains_bits = gains_bits || (field >= MAX_FIELDS && field_map.back() < MAX_FIELDS);
             }
-        }
+            const FieldRangesView* ranges = gains_bits ? &source_ranges.emplace_back(source->field_ranges.view(source->first_doc_id))
+                                                       : nullptr;
 
-        for (auto& [field_name, coord_index] : field_coordinate_index) {
-            for (auto& [term, doc_positions] : coord_index) {
-                sort(doc_positions.begin(), doc_positions.end());
-                for (auto& term_pos : doc_positions) {
-                    sort(term_pos.positions.begin(), term_pos.positions.end());
-                    auto last = unique(term_pos.positions.begin(), term_pos.positions.end());
-                    term_pos.positions.erase(last, term_pos.positions.end());
-                }
+            for (uint32_t id = 0; id < source->term_lists.size(); ++id) {
+                if (source->term_lists[id].empty()) continue;
+                dirty_terms.insert(term_ids[id]);
+                addSource(termLists(term_ids[id]), {&source->term_lists[id], same_fields ? nullptr : field_map.data(), ranges});
+            }
+            field_ranges.append(source->field_ranges, source->first_doc_id - first_doc_id, field_map.data());
+            doc_titles.append(source->doc_titles, source->first_doc_id - first_doc_id);
+            doc_contents.append(source->doc_contents, source->first_doc_id - first_doc_id);
+            for (int doc_id : source->all_doc_ids.toVector()) all_doc_ids.set(doc_id);
+            for (size_t i = 0; i < source->doc_lengths.size(); ++i) {
+                setDocumentLength(source->first_doc_id + static_cast<int>(i), source->doc_lengths[i]);
             }
         }
 
-        buildSkipLists();
+        atomic<size_t> next_task(0);
+        vector<thread> workers;
+        for (int t = 0; t < thread_count; ++t) {
+            workers.emplace_back([&] {
+                for (size_t k = next_task++; k < tasks.size(); k = next_task++) mergeSources(tasks[k]);
+            });
+        }
+        for (auto& worker : workers) worker.join();
     }
 
-    // построение скип-листов с шагом sqrt(n)
-    void buildSkipLists() {
-        skip_lists.clear();
-        for (const auto& [term, doc_list] : inverted_index) {
-            if (doc_list.empty()) continue;
-            auto head = make_shared<SkipListNode>(doc_list[0]);
-            auto current = head;
-            for (int i = 1; i < doc_list.size(); ++i) {
-                auto new_node = make_shared<SkipListNode>(doc_list[i]);
-                current->next = new_node;
-                current = new_node;
+    // копия части без удаленных доков: списки doc_id, координаты, поля, тексты и длины переписываются,
+    // скип-листы строятся заново, а термы, у которых не осталось доков, в словарь копии не попадают.
+    // Исходная часть не меняется, поэтому копию можно строить, пока ее читают запросы
+    shared_ptr<MemoryIndex> withoutDocuments(const DocBitmap& deleted) const {
+        auto result = make_shared<MemoryIndex>(first_doc_id, compress_postings);
+        result->field_names = field_names;
+        vector<uint32_t> term_ids(dictionary.size(), TermDictionary::NO_TERM);
+        auto resultTermId = [&](uint32_t term_id) {
+            if (term_ids[term_id] == TermDictionary::NO_TERM) term_ids[term_id] = result->dictionary.intern(dictionary.term(term_id));
+            return term_ids[term_id];
+        };
+        vector<int> buffer;
+        auto liveDocs = [&](const PositionalPostings& source) {
+            PositionalPostings list;
+            list.doc_ids.is_compressed = source.doc_ids.is_compressed;
+            vector<int> ids = source.doc_ids.toVector();
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (!deleted.test(ids[i])) list.append(ids[i], source.positionsOf(i, buffer), source.field_masks[i]);
             }
-            addSkipPointers(head, doc_list.size());
-            skip_lists[term] = head;
+            if (list.doc_ids.is_compressed) list.doc_ids.compressed.seal();
+            list.shrinkToFit();
+            return list;
+        };
+
+        for (uint32_t id = 0; id < term_lists.size(); ++id) {
+            if (term_lists[id].empty()) continue;
+            PositionalPostings list = liveDocs(term_lists[id]);
+            if (list.empty()) continue;
+            uint32_t term_id = resultTermId(id);
+            result->termLists(term_id) = move(list);
+            result->dirty_terms.insert(term_id);
         }
+
+        doc_titles.view().forEach([&](size_t i, string_view title) {
+            if (!deleted.test(first_doc_id + static_cast<int>(i))) result->doc_titles.set(i, title);
+        });
+        doc_contents.view().forEach([&](size_t i, string_view content) {
+            if (!deleted.test(first_doc_id + static_cast<int>(i))) result->doc_contents.set(i, content);
+        });
+        FieldRangesView ranges = field_ranges.view(first_doc_id);
+        for (int doc_id : all_doc_ids.toVector()) {
+            if (deleted.test(doc_id)) continue;
+            result->all_doc_ids.set(doc_id);
+            result->setDocumentLength(doc_id, documentLength(doc_id));
+            auto [first, last] = ranges.of(doc_id);
+            result->field_ranges.add(doc_id - first_doc_id, first, last);
+        }
+        result->finalizeIndexes();
+        result->shrinkStoredText();
+        return result;
     }
 
-    void addSkipPointers(shared_ptr<SkipListNode> head, int list_size) {
-        if (!head || list_size < 3) return;
-        int skip_step = static_cast<int>(sqrt(list_size));
-        auto current = head;
-        int count = 0;
-        while (current) {
-            if (count % skip_step == 0) {
-                auto skip_target = current;
-                for (int i = 0; i < skip_step && skip_target; i++) {
-                    skip_target = skip_target->next;
-                }
-                current->skip = skip_target;
-            }
-            current = current->next;
-            count++;
+    // финализация после добавления доков: перестраиваем скип-листы изменившихся термов
+    void finalizeIndexes() {
+        for (uint32_t term_id : dirty_terms) {
+            buildSkipList(term_id);
+        }
+        dirty_terms.clear();
+
+        for (PostingList* list : unsealed_lists) {
+            list->compressed.seal();
         }
+        unsealed_lists.clear();
     }
 
-    // Проверка близости позиций для реализации оператора NEAR
-    // (пользуемся тем, что все упорядочено)
-    bool hasClosePositions(const vector<int>& positions1, const vector<int>& positions2, int max_distance) {
-        int i = 0, j = 0;
-        while (i < positions1.size() && j < positions2.size()) {
-            int distance = abs(positions1[i] - positions2[j]);
-            if (distance <= max_distance) {
-                return true;
-            }
-            if (positions1[i] < positions2[j]) {
-                i++;
-            } else {
-                j++;
-            }
+    // запись части в сегмент на диске; next_doc_id - граница диапазона doc_id сегмента
+    bool saveSegment(const string& path, int next_doc_id) const {
+        SegmentWriter writer(first_doc_id, next_doc_id, all_doc_ids, doc_lengths, field_names, field_ranges,
+                             doc_titles, doc_contents);
+        vector<SegmentTerm> terms;
+        for (uint32_t id = 0; id < term_lists.size(); ++id) {
+            if (!term_lists[id].empty()) terms.push_back({&dictionary.term(id), &term_lists[id]});
         }
-        return false;
+        return writer.write(path, move(terms));
     }
 
-    // Проверка соседства позиций для реализации оператора ADJ
-    // (пользуемся тем, что все упорядочено)
-    bool hasAdjacentPositions(const vector<int>& positions1, const vector<int>& positions2, int max_distance) {
-        int i = 0, j = 0;
-        while (i < positions1.size() && j < positions2.size()) {
-            int distance = positions2[j] - positions1[i];
-            if (distance > 0 && distance <= max_distance) {
-                return true;
-            }
-            if (positions1[i] < positions2[j]) {
-                i++;
-            } else {
-                j++;
-            }
+    // без поля - список терма как есть (объединение по всем полям), с полем - он же с фильтром по полю
+    PostingRef postings(const string& term, const string& field) const override {
+        uint32_t term_id = dictionary.find(term);
+        const PositionalPostings* list = term_id != TermDictionary::NO_TERM ? findList(term_id) : nullptr;
+        if (!list) return emptyPostings();
+
+        bool has_skips = term_id < skip_lists.size() && skip_lists[term_id].step > 0;
+        PostingRef ref = list->doc_ids.ref(has_skips ? &skip_lists[term_id] : nullptr);
+        if (field.empty()) return ref;
+        PositionsRef field_list = list->ref();
+        field_list.doc_ids = ref;
+        return selectField(*list, findField(field), field_list) ? field_list.doc_ids : emptyPostings();
+    }
+
+    bool positions(const string& term, const string& field, PositionsRef& out) const override {
+        uint32_t term_id = dictionary.find(term);
+        const PositionalPostings* list = term_id != TermDictionary::NO_TERM ? findList(term_id) : nullptr;
+        if (!list) return false;
+        out = list->ref();
+        return field.empty() || selectField(*list, findField(field), out);
+    }
+
+    void expandTerms(const string& pattern, const string& field, vector<string>& out) const override {
+        uint32_t field_id = field.empty() ? NO_FIELD : findField(field);
+        vector<uint32_t> term_ids;
+        dictionary.expand(pattern, term_ids);
+        for (uint32_t term_id : term_ids) {
+            const PositionalPostings* list = findList(term_id);
+            if (!list) continue;
+            PositionsRef field_list = list->ref();
+            if (field.empty() || selectField(*list, field_id, field_list)) out.push_back(dictionary.term(term_id));
         }
-        return false;
+    }
+
+    // порядок словаря для подстановок строится до публикации части, дальше ее только читают
+    void prepareWildcards() const {
+        dictionary.prepareWildcards();
+    }
+
+    uint64_t generation() const override {
+        return index_generation;
+    }
+
+    const DocBitmap& allDocs() const override {
+        return all_doc_ids;
+    }
+
+    uint32_t documentLength(int doc_id) const override {
+        size_t i = doc_id - first_doc_id;
+        return doc_id >= first_doc_id && i < doc_lengths.size() ? doc_lengths[i] : 0;
+    }
+
+    uint64_t totalLength() const override {
+        return total_length;
+    }
+
+    bool storedText(StoredField field, int doc_id, string& buffer, string_view& out) const override {
+        if (doc_id < first_doc_id) return false;
+        const DocStore& store = field == StoredField::TITLE ? doc_titles : doc_contents;
+        return store.view().text(doc_id - first_doc_id, buffer, out);
+    }
+
+    // объем памяти под тексты доков (сжатые блоки, хвосты и смещения) и их объем до сжатия
+    size_t storedTextMemoryBytes() const {
+        return doc_titles.memoryBytes() + doc_contents.memoryBytes();
+    }
+
+    size_t storedTextRawBytes() const {
+        return doc_titles.rawBytes() + doc_contents.rawBytes();
+    }
+
+    // часть больше не растет (публикуется или собрана слиянием) - отдаем запас емкости хранилищ текстов
+    void shrinkStoredText() {
+        doc_titles.shrinkToFit();
+        doc_contents.shrinkToFit();
+    }
+
+    // объем памяти под координатные списки (позиции, маски полей и диапазоны полей доков)
+    size_t positionalMemoryBytes() const {
+        size_t bytes = field_ranges.memoryBytes();
+        for (const auto& list : term_lists) bytes += list.memoryBytes() - list.doc_ids.memoryBytes();
+        return bytes;
+    }
+
+    // объем памяти под списки doc_id
+    size_t postingMemoryBytes() const {
+        size_t bytes = 0;
+        for (const auto& list : term_lists) bytes += list.doc_ids.memoryBytes();
+        return bytes;
+    }
+
+    // число постингов (пар терм-док)
+    size_t postingCount() const {
+        size_t count = 0;
+        for (const auto& list : term_lists) count += list.doc_ids.size();
+        return count;
+    }
+
+private:
+    // Вспомогательные методы
+
+    void setDocumentLength(int doc_id, uint32_t length) {
+        size_t i = doc_id - first_doc_id;
+        if (i >= doc_lengths.size()) doc_lengths.resize(i + 1, 0);
+        total_length += length;
+        total_length -= doc_lengths[i];
+        doc_lengths[i] = length;
+    }
+
+    // термы текста по порядку в field_terms (пустые после нормализации пропускаются, но занимают позицию);
+    // возвращает число токенов
+    int collectTerms(string_view text) {
+        field_terms.clear();
+        int position = 0;
+        forEachToken(text, [&](string_view token) {
+            normalizeTerm(token, term_buffer);
+            if (!term_buffer.empty()) field_terms.push_back({dictionary.intern(term_buffer), position});
+            position++;
+        });
+        return position;
+    }
+
+    // номер поля части: новое имя получает следующий номер (бит в маске есть у номеров меньше MAX_FIELDS)
+    uint32_t fieldId(string_view field_name) {
+        uint32_t field = findField(field_name);
+        if (field != NO_FIELD) return field;
+        field_names.emplace_back(field_name);
+        return static_cast<uint32_t>(field_names.size() - 1);
+    }
+
+    // номер поля части; NO_FIELD, если такого поля в части нет
+    uint32_t findField(string_view field_name) const {
+        for (uint32_t field = 0; field < field_names.size(); ++field) {
+            if (field_names[field] == field_name) return field;
+        }
+        return NO_FIELD;
+    }
+
+    // список терма, отфильтрованный по полю field_id (см. PositionsRef::selectField)
+    bool selectField(const PositionalPostings& list, uint32_t field_id, PositionsRef& out) const {
+        return out.selectField(field_id, list.field_masks.data(), list.fieldCount(field_id), field_ranges.view(first_doc_id));
+    }
+
+    // термы поля из field_terms - во вхождения дока, со сдвигом позиций на начало поля
+    void addOccurrences(uint32_t offset, uint32_t field) {
+        for (const auto& [term_id, position] : field_terms) {
+            document_terms.push_back({term_id, static_cast<int>(offset) + position, fieldBit(field)});
+        }
+    }
+
+    // постинги дока по термам: вхождения сортируются по (term_id, позиция), позиции каждого терма
+    // собираются в общий буфер и дописываются в его список вместе с маской полей
+    void appendTermPostings(int doc_id) {
+        sort(document_terms.begin(), document_terms.end());
+        for (size_t begin = 0; begin < document_terms.size();) {
+            uint32_t term_id = document_terms[begin].term_id;
+            positions_buffer.clear();
+            FieldMask fields = 0;
+            size_t end = begin;
+            for (; end < document_terms.size() && document_terms[end].term_id == term_id; ++end) {
+                positions_buffer.push_back(document_terms[end].position);
+                fields |= document_terms[end].field;
+            }
+            dirty_terms.insert(term_id);
+            appendPosting(termLists(term_id), doc_id, positions_buffer, fields);
+            begin = end;
+        }
+    }
+
+    // список терма (массив растет вместе со словарем)
+    PositionalPostings& termLists(uint32_t term_id) {
+        if (term_id >= term_lists.size()) term_lists.resize(dictionary.size());
+        return term_lists[term_id];
+    }
+
+    // непустой список терма; nullptr, если терма в части нет
+    const PositionalPostings* findList(uint32_t term_id) const {
+        return term_id < term_lists.size() && !term_lists[term_id].empty() ? &term_lists[term_id] : nullptr;
+    }
+
+    // слияние списков одного терма из нескольких частей: источники идут по возрастанию диапазонов doc_id,
+    // у каждого - перевод номеров его полей (nullptr - номера те же)
+    struct MergeSource {
+        const PositionalPostings* list;
+        const uint32_t* field_map;
+        const FieldRangesView* ranges; // диапазоны полей источника, если маски строятся по позициям
+    };
+
+    struct MergeTask {
+        PositionalPostings* list;
+        vector<MergeSource> sources;
+    };
+
+    // дописываем источники в конец общих списков; сжатые списки сразу упаковываем,
+    // чтобы не трогать общий unsealed_lists из нескольких потоков
+    void mergeSources(MergeTask& task) {
+        PositionalPostings& list = *task.list;
+        if (list.empty()) list.doc_ids.is_compressed = compress_postings;
+        for (const MergeSource& source : task.sources) {
+            list.appendAll(*source.list, source.field_map, source.ranges);
+        }
+        if (list.doc_ids.is_compressed) list.doc_ids.compressed.seal();
+    }
+
+    // добавление постинга дока в список терма (doc_id + позиции + поля).
+    // doc_id выдаются по возрастанию (next_doc_id), поэтому док либо уже последний в списке,
+    // либо его надо дописать в конец - списки остаются упорядоченными без сортировки
+    void appendPosting(PositionalPostings& list, int doc_id, const vector<int>& positions, FieldMask fields) {
+        if (list.empty() || list.lastDocId() < doc_id) {
+            prepareAppend(list.doc_ids);
+            list.append(doc_id, positions, fields);
+        } else if (list.lastDocId() == doc_id) {
+            // к последнему доку добавили поле (indexField) - сливаем упорядоченные позиции
+            list.mergeIntoLast(positions, fields);
+        } else {
+            // док из прошлого (indexField вызвали вручную) - вставляем на место
+            list.insertDoc(doc_id, positions, fields);
+        }
+    }
+
+    // перед дописыванием в список doc_id: новый список создаем в нужном представлении,
+    // а у сжатого запоминаем появившийся неупакованный хвост - его упакует финализация
+    void prepareAppend(PostingList& list) {
+        if (list.empty()) {
+            list.is_compressed = compress_postings;
+        }
+        if (list.is_compressed && list.compressed.tail.empty()) {
+            unsealed_lists.push_back(&list);
+        }
+    }
+
+    // построение скип-указателей терма с шагом sqrt(n)
+    void buildSkipList(uint32_t term_id) {
+        if (term_id >= skip_lists.size()) skip_lists.resize(dictionary.size());
+        // у сжатых списков роль скипов играют последние doc_id блоков
+        const auto& doc_list = termLists(term_id).doc_ids;
+        if (doc_list.is_compressed || doc_list.size() < 3) {
+            skip_lists[term_id] = SkipPointers();
+            return;
+        }
+        skip_lists[term_id] = buildSkipPointers(doc_list.doc_ids);
+    }
+};
+
+// ключ кэша для результата по набору частей: состояния всех частей и карты удаленных доков
+// + каноническая запись запроса
+inline string resultCacheKey(const string& kind, const shared_ptr<ASTNode>& ast, const vector<const IndexReader*>& parts,
+                             const DeletedDocs* deleted) {
+    string key = kind;
+    for (const IndexReader* part : parts) key += " " + to_string(part->generation());
+    if (deleted) key += " D" + to_string(deleted->generation);
+    return key + " " + canonicalQuery(ast);
+}
+
+// поток результатов запроса по частям индекса: у частей непересекающиеся диапазоны doc_id по возрастанию,
+// поэтому доки идут по возрастанию doc_id. on_doc возвращает false, когда доков больше не нужно.
+// Если весь результат уже есть в кэше, доки берутся из него; иначе вычисление остается ленивым
+// (кэшируются только поддеревья)
+template <typename Fn>
+void forEachQueryResult(shared_ptr<ASTNode> ast, const vector<const IndexReader*>& parts, Fn&& on_doc,
+                        QueryCache* cache = nullptr, const DeletedDocs* deleted = nullptr,
+                        QueryProfileNode* profile = nullptr) {
+    if (!ast) return;
+    if (cache) {
+        if (auto cached = cache->find(resultCacheKey("Q", ast, parts, deleted))) {
+            addResultCacheProfile(profile, cached->doc_ids.size());
+            for (int doc_id : cached->doc_ids) {
+                if (!on_doc(doc_id)) return;
+            }
+            return;
+        }
+    }
+    for (const IndexReader* part : parts) {
+        QueryProfileNode* part_node = addPartProfile(profile, *part);
+        ProfileScope scope(part_node);
+        for (auto cursor = QueryEvaluator(*part, cache, deleted, part_node).open(ast); !cursor->atEnd(); cursor->next()) {
+            if (part_node) part_node->output++;
+            if (!on_doc(cursor->docId())) return;
+        }
+    }
+}
+
+// все найденные доки; с кэшем результат запоминается целиком
+inline vector<int> queryResults(shared_ptr<ASTNode> ast, const vector<const IndexReader*>& parts,
+                                QueryCache* cache = nullptr, const DeletedDocs* deleted = nullptr,
+                                QueryProfileNode* profile = nullptr) {
+    if (!ast) return {};
+    string key;
+    if (cache) {
+        key = resultCacheKey("Q", ast, parts, deleted);
+        if (auto cached = cache->find(key)) {
+            addResultCacheProfile(profile, cached->doc_ids.size());
+            return cached->doc_ids;
+        }
+    }
+    auto result = make_shared<CachedResult>();
+    for (const IndexReader* part : parts) {
+        QueryProfileNode* part_node = addPartProfile(profile, *part);
+        ProfileScope scope(part_node);
+        size_t before = result->doc_ids.size();
+        for (auto cursor = QueryEvaluator(*part, cache, deleted, part_node).open(ast); !cursor->atEnd(); cursor->next()) {
+            result->doc_ids.push_back(cursor->docId());
+        }
+        if (part_node) part_node->output = result->doc_ids.size() - before;
+    }
+    if (!cache) return move(result->doc_ids);
+    result->doc_ids.shrink_to_fit();
+    cache->insert(key, result);
+    return result->doc_ids;
+}
+
+// страница результатов: limit доков после первых offset; дальше страницы запрос не вычисляется
+inline vector<int> queryResultsPage(shared_ptr<ASTNode> ast, const vector<const IndexReader*>& parts,
+                                    size_t offset, size_t limit, QueryCache* cache = nullptr,
+                                    const DeletedDocs* deleted = nullptr, QueryProfileNode* profile = nullptr) {
+    vector<int> page;
+    if (limit == 0) return page;
+    size_t skipped = 0;
+    forEachQueryResult(ast, parts, [&](int doc_id) {
+        if (skipped < offset) {
+            skipped++;
+            return true;
+        }
+        page.push_back(doc_id);
+        return page.size() < limit;
+    }, cache, deleted, profile);
+    return page;
+}
+
+inline size_t countQueryResults(shared_ptr<ASTNode> ast, const vector<const IndexReader*>& parts,
+                                QueryCache* cache = nullptr, const DeletedDocs* deleted = nullptr,
+                                QueryProfileNode* profile = nullptr) {
+    size_t count = 0;
+    if (!ast) return count;
+    if (cache) {
+        if (auto cached = cache->find(resultCacheKey("Q", ast, parts, deleted))) {
+            addResultCacheProfile(profile, cached->doc_ids.size());
+            return cached->doc_ids.size();
+        }
+    }
+    for (const IndexReader* part : parts) {
+        QueryProfileNode* part_node = addPartProfile(profile, *part);
+        ProfileScope scope(part_node);
+        size_t found = QueryEvaluator(*part, cache, deleted, part_node).count(ast);
+        if (part_node) part_node->output = found;
+        count += found;
+    }
+    return count;
+}
+
+// k самых релевантных доков; с кэшем top-k запоминается вместе с оценками
+inline vector<ScoredDocument> rankedQueryResults(shared_ptr<ASTNode> ast, const vector<const IndexReader*>& parts,
+                                                 size_t k, QueryCache* cache = nullptr,
+                                                 const DeletedDocs* deleted = nullptr,
+                                                 QueryProfileNode* profile = nullptr) {
+    string key;
+    if (cache) {
+        key = resultCacheKey("R" + to_string(k), ast, parts, deleted);
+        if (auto cached = cache->find(key)) {
+            addResultCacheProfile(profile, cached->doc_ids.size());
+            vector<ScoredDocument> ranked;
+            for (size_t i = 0; i < cached->doc_ids.size(); ++i) ranked.push_back({cached->doc_ids[i], cached->scores[i]});
+            return ranked;
+        }
+    }
+    vector<ScoredDocument> ranked = RankedEvaluator(parts, k, cache, deleted, profile).execute(ast);
+    if (cache) {
+        auto result = make_shared<CachedResult>();
+        for (const auto& doc : ranked) {
+            result->doc_ids.push_back(doc.doc_id);
+            result->scores.push_back(doc.score);
+        }
+        cache->insert(key, result);
+    }
+    return ranked;
+}
+
+// параметры фрагмента дока под запрос (сниппета)
+struct SnippetOptions {
+    // длина фрагмента в токенах
+    size_t window = 30;
+    // обрамление найденных термов и отметка пропущенного текста
+    string open_tag = "[";
+    string close_tag = "]";
+    string ellipsis = "...";
+};
+
+// Фрагмент содержания дока, в котором больше всего разных термов запроса (при равенстве - больше вхождений),
+// с подсвеченными вхождениями. Вхождения берутся из координатного индекса с фильтром по полю content
+// (позиции сквозные по полям дока переводятся в номера токенов содержания), текст дока токенизируется
+// только ради границ токенов. Термы под NOT и термы других полей
+// не подсвечиваются; если термов запроса в содержании нет, фрагмент - начало текста
+inline string documentSnippet(const vector<const IndexReader*>& parts, int doc_id, const shared_ptr<ASTNode>& ast,
+                              const SnippetOptions& options = SnippetOptions()) {
+    const IndexReader* source = nullptr;
+    string buffer;
+    string_view content;
+    for (const IndexReader* part : parts) {
+        if (part->storedText(StoredField::CONTENT, doc_id, buffer, content)) {
+            source = part;
+            break;
+        }
+    }
+    if (!source || content.empty()) return "";
+
+    // вхождения (позиция, номер терма) термов запроса в содержание дока
+    vector<string> terms;
+    vector<pair<int, size_t>> hits;
+    vector<int> positions_buffer;
+    forEachQueryTerm(ast, parts, [&](const string& value, const string& field) {
+        if (!field.empty() && field != "content") return;
+        string term = normalizeTerm(value);
+        if (term.empty() || find(terms.begin(), terms.end(), term) != terms.end()) return;
+        terms.push_back(term);
+        PositionsRef list;
+        if (!source->positions(term, "content", list)) return;
+        PostingCursor cursor(list.doc_ids);
+        cursor.advance(doc_id);
+        if (cursor.atEnd() || cursor.docId() != doc_id) return;
+        // хранится текст последнего поля content дока - берем позиции из его диапазона
+        auto [first_range, last_range] = list.fields.of(doc_id);
+        const FieldRange* range = nullptr;
+        for (const FieldRange* it = first_range; it != last_range; ++it) {
+            if (it->field == list.field) range = it;
+        }
+        if (!range) return;
+        PositionSpan span = list.positionsOf(cursor.index(), doc_id, positions_buffer);
+        for (size_t k = 0; k < span.size; ++k) {
+            int position = span.data[k];
+            if (position >= static_cast<int>(range->start) && position < static_cast<int>(range->end)) {
+                hits.push_back({position - static_cast<int>(range->start), terms.size() - 1});
+            }
+        }
+    });
+    sort(hits.begin(), hits.end());
+
+    // лучшее окно: hits[best_first..best_last] укладываются в window токенов (скользящее окно по вхождениям)
+    size_t window = max<size_t>(1, options.window);
+    vector<size_t> term_hits(terms.size(), 0);
+    size_t distinct = 0, best_distinct = 0, best_count = 0, best_first = 0, best_last = 0;
+    for (size_t first = 0, last = 0; last < hits.size(); ++last) {
+        if (term_hits[hits[last].second]++ == 0) distinct++;
+        while (static_cast<size_t>(hits[last].first - hits[first].first) >= window) {
+            if (--term_hits[hits[first].second] == 0) distinct--;
+            first++;
+        }
+        size_t count = last - first + 1;
+        if (distinct > best_distinct || (distinct == best_distinct && count > best_count)) {
+            best_distinct = distinct;
+            best_count = count;
+            best_first = first;
+            best_last = last;
+        }
+    }
+
+    // запас контекста поровну слева и справа от найденных термов
+    vector<string_view> tokens = tokenize(content);
+    size_t start = 0;
+    if (!hits.empty()) {
+        size_t span = hits[best_last].first - hits[best_first].first + 1;
+        size_t lead = (window - span) / 2;
+        size_t first_hit = hits[best_first].first;
+        start = first_hit > lead ? first_hit - lead : 0;
+    }
+    size_t end = min(tokens.size(), start + window);
+    if (end - min(start, end) < window) start = end > window ? end - window : 0;
+
+    // текст между токенами (и до первого/после последнего токена дока) переносим как есть
+    string snippet;
+    if (start > 0) snippet += options.ellipsis;
+    const char* copied = start > 0 ? tokens[start].data() : content.data();
+    size_t hit = 0;
+    for (size_t t = start; t < end; ++t) {
+        snippet.append(copied, tokens[t].data());
+        while (hit < hits.size() && static_cast<size_t>(hits[hit].first) < t) hit++;
+        bool highlighted = hit < hits.size() && static_cast<size_t>(hits[hit].first) == t;
+        if (highlighted) snippet += options.open_tag;
+        snippet.append(tokens[t].data(), tokens[t].size());
+        if (highlighted) snippet += options.close_tag;
+        copied = tokens[t].data() + tokens[t].size();
+    }
+    if (end < tokens.size()) {
+        snippet += options.ellipsis;
+    } else {
+        snippet.append(copied, content.data() + content.size());
+    }
+    return snippet;
+}
+
+// результат запроса вместе с профилем его выполнения (EXPLAIN ANALYZE, см. query_profile.h)
+struct QueryProfile {
+    // найденные доки (profileQuery(query)) или top-k с оценками (profileQuery(query, k))
+    vector<int> doc_ids;
+    vector<ScoredDocument> ranked;
+    QueryProfileNode plan;
+
+    string explain() const { return plan.explain(); }
+};
+
+// Выполнение запроса с профилем: run(ast, profile) вычисляет разобранный запрос. Профиль собирается,
+// если его просят (root) или если включены метрики (тогда без времени шагов курсоров);
+// иначе run получает nullptr и запрос идет как обычно.
+// Корень профиля - вид запроса (kind) с текстом запроса, под ним разбор и части индекса
+template <typename Run>
+auto runProfiledQuery(const string& kind, const string& query, QueryMetrics* metrics, QueryProfileNode* root, Run&& run) {
+    bool recorded = metrics && metrics->enabled();
+    if (!root && !recorded) {
+        QueryParser parser(query);
+        return run(parser.parse(), nullptr);
+    }
+    QueryProfileNode local_root;
+    if (!root) {
+        root = &local_root;
+        root->timed = false;
+    }
+    root->operation = kind;
+    root->detail = query;
+
+    decltype(run(shared_ptr<ASTNode>(), root)) result;
+    {
+        ProfileScope scope(root);
+        shared_ptr<ASTNode> ast;
+        {
+            ProfileScope parse_scope(root->addChild("PARSE"));
+            QueryParser parser(query);
+            ast = parser.parse();
+        }
+        result = run(ast, root);
+    }
+    if constexpr (is_integral_v<decltype(result)>) {
+        root->output = result;
+    } else {
+        root->output = result.size();
+    }
+    root->finish();
+    if (recorded) metrics->record(*root);
+    return result;
+}
+
+// Неизменяемый снимок индекса: сегменты с диска и опубликованные части в памяти.
+// Читатель берет снимок через TextIndexer::snapshot() и работает с ним без блокировок;
+// части, из которых писатель уже ушел, освобождаются вместе с последним снимком, который на них ссылается
+struct IndexSnapshot {
+    vector<shared_ptr<const IndexReader>> parts;
+    // кэш результатов, общий с TextIndexer (nullptr - без кэша)
+    shared_ptr<QueryCache> cache;
+    // удаленные доки на момент публикации (nullptr - без удалений)
+    shared_ptr<const DeletedDocs> deleted;
+    // метрики запросов, общие с TextIndexer (nullptr - без метрик)
+    shared_ptr<QueryMetrics> metrics;
+
+    vector<int> executeQuery(const string& query) const {
+        return matchQuery(query, nullptr);
+    }
+
+    // k самых релевантных доков по BM25 (оценка по убыванию)
+    vector<ScoredDocument> executeQuery(const string& query, size_t k) const {
+        return rankQuery(query, k, nullptr);
+    }
+
+    // limit доков после первых offset (по возрастанию doc_id)
+    vector<int> executeQueryPage(const string& query, size_t offset, size_t limit) const {
+        return runProfiledQuery("page", query, metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return queryResultsPage(ast, readers(), offset, limit, cache.get(), deleted.get(), profile);
+        });
+    }
+
+    size_t countQuery(const string& query) const {
+        return runProfiledQuery("count", query, metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return countQueryResults(ast, readers(), cache.get(), deleted.get(), profile);
+        });
+    }
+
+    // доки по одному без сбора в вектор; on_doc(doc_id) возвращает false, чтобы остановиться
+    template <typename Fn>
+    void forEachResult(const string& query, Fn&& on_doc) const {
+        runProfiledQuery("foreach", query, metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            size_t delivered = 0;
+            forEachQueryResult(ast, readers(), [&](int doc_id) {
+                delivered++;
+                return on_doc(doc_id);
+            }, cache.get(), deleted.get(), profile);
+            return delivered;
+        });
+    }
+
+    // запрос с профилем выполнения: найденные доки и дерево плана со счетчиками операторов
+    QueryProfile profileQuery(const string& query) const {
+        QueryProfile profile;
+        profile.doc_ids = matchQuery(query, &profile.plan);
+        return profile;
+    }
+
+    QueryProfile profileQuery(const string& query, size_t k) const {
+        QueryProfile profile;
+        profile.ranked = rankQuery(query, k, &profile.plan);
+        return profile;
+    }
+
+    vector<const IndexReader*> readers() const {
+        vector<const IndexReader*> result;
+        for (const auto& part : parts) result.push_back(part.get());
+        return result;
+    }
+
+    // число доков без удаленных (в карте только доки, которые еще лежат в частях)
+    size_t documentCount() const {
+        size_t count = 0;
+        for (const auto& part : parts) count += part->allDocs().count();
+        return count - (deleted ? deleted->docs.count() : 0);
+    }
+
+    // заголовок или содержание дока без копирования: out указывает в часть снимка (живет, пока жив снимок)
+    // или в buffer, если текст пришлось распаковать. У удаленного дока текста нет, как у отсутствующего
+    bool documentText(StoredField field, int doc_id, string& buffer, string_view& out) const {
+        if (isDeleted(doc_id)) return false;
+        for (const auto& part : parts) {
+            if (part->storedText(field, doc_id, buffer, out)) return true;
+        }
+        return false;
+    }
+
+    string getDocumentTitle(int doc_id) const {
+        string buffer;
+        string_view text;
+        if (documentText(StoredField::TITLE, doc_id, buffer, text)) return string(text);
+        return "Document " + to_string(doc_id);
+    }
+
+    string getDocumentContent(int doc_id) const {
+        string buffer;
+        string_view text;
+        if (documentText(StoredField::CONTENT, doc_id, buffer, text)) return string(text);
+        return "";
+    }
+
+    // фрагмент содержания дока с подсвеченными термами запроса (см. documentSnippet)
+    string getDocumentSnippet(int doc_id, const string& query, const SnippetOptions& options = SnippetOptions()) const {
+        if (isDeleted(doc_id)) return "";
+        QueryParser parser(query);
+        return documentSnippet(readers(), doc_id, parser.parse(), options);
+    }
+
+    bool isDeleted(int doc_id) const {
+        return deleted && deleted->docs.test(doc_id);
+    }
+
+private:
+    vector<int> matchQuery(const string& query, QueryProfileNode* root) const {
+        return runProfiledQuery("query", query, metrics.get(), root, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return queryResults(ast, readers(), cache.get(), deleted.get(), profile);
+        });
+    }
+
+    vector<ScoredDocument> rankQuery(const string& query, size_t k, QueryProfileNode* root) const {
+        return runProfiledQuery("ranked", query, metrics.get(), root, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return rankedQueryResults(ast, readers(), k, cache.get(), deleted.get(), profile);
+        });
+    }
+};
+
+// Док из полей, ссылающихся на чужой буфер (например, на отображенный в память CSV):
+// тексты не копируются до индексации, буфер должен жить до конца addDocuments
+using DocumentView = vector<pair<string_view, string_view>>;
+
+// Индекс устроен как LSM: новые доки пишутся в небольшую текущую часть в памяти, которая запечатывается
+// (публикуется неизменяемой частью снимка), когда в ней набирается flush_documents доков, или по publish().
+// Опубликованные части сливаются в фоне по ярусам: ярус части - целая часть log_F(числа доков),
+// и merge_factor = F соседних частей одного яруса склеиваются в одну часть следующего яруса.
+// Поэтому загрузка дока стоит столько же при любом размере индекса (пишем только в текущую часть),
+// а частей остается O(F log n)
+constexpr size_t DEFAULT_FLUSH_DOCUMENTS = 1 << 16;
+constexpr size_t DEFAULT_MERGE_FACTOR = 4;
+
+// Индекс целиком: опубликованный снимок + текущая часть в памяти, в которую пишут новые доки.
+// Методы писателя сериализуются мьютексом; запросы из других потоков идут через snapshot()
+// и видят доки, опубликованные последним publish() (или commit(), или запечатыванием текущей части)
+class TextIndexer {
+private:
+    int next_doc_id;
+    // пакетная загрузка: пока флаг поднят, построение скип-листов откладывается до commit()
+    bool bulk_loading;
+    // новые списки doc_id хранятся сжатыми блоками (см. posting_codec.h)
+    bool compress_postings;
+
+    shared_ptr<MemoryIndex> memory;
+    // текущий снимок; подменяется атомарно, читатели загружают его через atomic_load
+    shared_ptr<const IndexSnapshot> published;
+    mutable mutex writer_mutex;
+    // кэш результатов запросов писателя и всех снимков
+    shared_ptr<QueryCache> query_cache;
+    // метрики запросов писателя и всех снимков
+    shared_ptr<QueryMetrics> query_metrics;
+    // удаленные доки для запросов писателя; снимок получает копию при публикации
+    DeletedDocs deleted_docs;
+
+    // фоновое уплотнение (compactInBackground)
+    mutex compaction_mutex;
+    thread compaction_thread;
+    atomic<bool> compacting{false};
+
+    // порог запечатывания текущей части в доках (0 - только по publish/commit) и множитель ярусов
+    size_t flush_documents = DEFAULT_FLUSH_DOCUMENTS;
+    atomic<size_t> merge_factor{DEFAULT_MERGE_FACTOR};
+    // фоновые слияния: поток заводится при первой публикации и ждет запросов на слияние
+    mutex merge_mutex;
+    condition_variable merge_signal;
+    thread merge_thread;
+    bool merge_requested = false;
+    bool merge_running = false;
+    bool merge_stopping = false;
+
+    // замена соседних частей снимка одной частью (слиянием или уплотненной копией)
+    struct PartReplacement {
+        vector<const IndexReader*> sources;
+        shared_ptr<const IndexReader> part;
+    };
+
+public:
+    TextIndexer(bool compress = false)
+        : next_doc_id(1), bulk_loading(false), compress_postings(compress),
+          memory(make_shared<MemoryIndex>(1, compress)), query_cache(make_shared<QueryCache>()),
+          query_metrics(make_shared<QueryMetrics>()) {
+        auto initial = make_shared<IndexSnapshot>();
+        initial->cache = query_cache;
+        initial->metrics = query_metrics;
+        initial->deleted = make_shared<const DeletedDocs>(deleted_docs);
+        published = initial;
+    }
+
+    ~TextIndexer() {
+        // уплотнение публикует снимок и может запросить слияния, поэтому дожидаемся его до остановки слияний
+        waitForCompaction();
+        {
+            lock_guard<mutex> lock(merge_mutex);
+            merge_stopping = true;
+        }
+        merge_signal.notify_all();
+        if (merge_thread.joinable()) merge_thread.join();
+    }
+
+    // политика LSM: текущая часть запечатывается по достижении flush_documents доков
+    // (0 - только по publish/commit), в фоне сливаются по merge_factor (не меньше 2) частей одного яруса
+    void setMergePolicy(size_t flush_documents_threshold, size_t merge_factor_value = DEFAULT_MERGE_FACTOR) {
+        lock_guard<mutex> lock(writer_mutex);
+        flush_documents = flush_documents_threshold;
+        merge_factor = max<size_t>(2, merge_factor_value);
+    }
+
+    // начало пакетной загрузки: addDocument только дописывает постинги,
+    // а построение скип-листов выполняется один раз в commit()
+    void beginBulkLoad() {
+        lock_guard<mutex> lock(writer_mutex);
+        bulk_loading = true;
+    }
+
+    // завершение пакета: достраиваем структуры только для тех списков, которые затронул пакет,
+    // и публикуем новые доки для читателей
+    void commit() {
+        lock_guard<mutex> lock(writer_mutex);
+        bulk_loading = false;
+        publishMemory();
+    }
+
+    // добавление документа с его полями
+    int addDocument(const vector<pair<string, string>>& document_pairs) {
+        lock_guard<mutex> lock(writer_mutex);
+        int doc_id = addLocked(document_pairs);
+        flushIfFull();
+        return doc_id;
+    }
+
+    // удаление дока: запросы писателя перестают его находить сразу, снимки - после publish().
+    // Списки не переписываются (док только отмечается в карте удаленных), место освобождает compact().
+    // false, если такого дока нет или он уже удален
+    bool deleteDocument(int doc_id) {
+        lock_guard<mutex> lock(writer_mutex);
+        return deleteLocked(doc_id);
+    }
+
+    // исправление дока: старая версия удаляется, новая добавляется под новым doc_id (doc_id только растут,
+    // а у частей индекса непересекающиеся диапазоны). Снимки видят обе перемены вместе после publish().
+    // Возвращает новый doc_id или -1, если дока нет (тогда индекс не меняется)
+    int updateDocument(int doc_id, const vector<pair<string, string>>& document_pairs) {
+        lock_guard<mutex> lock(writer_mutex);
+        if (!deleteLocked(doc_id)) return -1;
+        int new_doc_id = addLocked(document_pairs);
+        flushIfFull();
+        return new_doc_id;
+    }
+
+    // параллельная загрузка пакета: доки режутся на thread_count непрерывных диапазонов, каждый поток
+    // индексирует свой диапазон в частичный индекс с теми же doc_id, что выдал бы addDocument подряд.
+    // Затем частичные списки дописываются в общие по порядку диапазонов (разные термы - в разных потоках),
+    // так что индекс получается тем же, что и при последовательной загрузке
+    vector<int> addDocuments(const vector<vector<pair<string, string>>>& documents, int thread_count = 0) {
+        return addDocumentBatch(documents, thread_count);
+    }
+
+    // то же для доков без копий текстов (см. DocumentView)
+    vector<int> addDocuments(const vector<DocumentView>& documents, int thread_count = 0) {
+        return addDocumentBatch(documents, thread_count);
+    }
+
+    // резерв count подряд идущих doc_id под доки, которые индексируются вне индексатора
+    // (конвейер загрузки строит по ним частичный индекс и дописывает его через appendPartials).
+    // Пока зарезервированные доки не дописаны, другие доки добавлять нельзя
+    int reserveDocIds(size_t count) {
+        lock_guard<mutex> lock(writer_mutex);
+        int first_doc_id = next_doc_id;
+        next_doc_id += static_cast<int>(count);
+        return first_doc_id;
+    }
+
+    // дописать частичные индексы с зарезервированными doc_id (по возрастанию doc_id); части дописываются
+    // в порядке резерва, несколько готовых частей выгоднее дописать одним вызовом
+    void appendPartials(const vector<const MemoryIndex*>& partials, int thread_count = 1) {
+        lock_guard<mutex> lock(writer_mutex);
+        memory->appendParts(partials, thread_count);
+        if (!bulk_loading) {
+            memory->finalizeIndexes();
+        }
+        flushIfFull();
+    }
+
+    // индексация еще одного поля дока текущей части (опубликованные и запечатанные части и сегменты
+    // на диске не меняются): поле дописывается в конец дока и ищется как с полем, так и без него
+    void indexField(int doc_id, const string& field_name, const string& text) {
+        lock_guard<mutex> lock(writer_mutex);
+        if (doc_id < memory->firstDocId() || doc_id >= next_doc_id) return;
+        memory->indexField(doc_id, field_name, text);
+    }
+
+    // публикация новых доков: текущая часть в памяти замораживается и попадает в новый снимок,
+    // запись продолжается в новую пустую часть
+    void publish() {
+        lock_guard<mutex> lock(writer_mutex);
+        publishMemory();
+    }
+
+    // уплотнение: опубликованные части в памяти, где доля удаленных доков не меньше min_deleted_ratio,
+    // переписываются без них (списки, координаты, скип-листы, тексты) и подменяются в новом снимке,
+    // а их доки снимаются с карты удаленных. Перед этим публикуются накопленные изменения
+    // (кроме пакетной загрузки) и дожидаются фоновые слияния.
+    // Части перестраиваются вне блокировки писателя: запросы и запись идут параллельно, и только
+    // подмена частей берет блокировку ненадолго. Часть, которую за это время склеило фоновое слияние,
+    // остается до следующего уплотнения.
+    // Сегменты с диска не переписываются - их удаленные доки так и отсеиваются картой. Возвращает число доков, место которых освобождено
+    size_t compact(double min_deleted_ratio = 0.0) {
+        shared_ptr<const IndexSnapshot> base;
+        {
+            lock_guard<mutex> lock(writer_mutex);
+            // во время пакетной загрузки текущую часть не трогаем (см. reserveDocIds)
+            if (!bulk_loading) publishMemory();
+        }
+        // слияние, запущенное публикацией, иначе подменило бы части раньше уплотненных копий
+        waitForMerges();
+        {
+            lock_guard<mutex> lock(writer_mutex);
+            base = published;
+        }
+        const DocBitmap& deleted = base->deleted->docs;
+
+        vector<PartReplacement> replacements;
+        for (const auto& part : base->parts) {
+            auto memory_part = dynamic_cast<const MemoryIndex*>(part.get());
+            if (!memory_part) continue;
+            size_t removed = part->allDocs().intersectionCount(deleted);
+            if (removed == 0 || removed < min_deleted_ratio * part->allDocs().count()) continue;
+            auto compacted = memory_part->withoutDocuments(deleted);
+            compacted->prepareWildcards();
+            replacements.push_back({{part.get()}, compacted});
+        }
+        if (replacements.empty()) return 0;
+
+        lock_guard<mutex> lock(writer_mutex);
+        return replaceParts(replacements, deleted);
+    }
+
+    // уплотнение в фоновом потоке; false, если предыдущее фоновое уплотнение еще идет
+    bool compactInBackground(double min_deleted_ratio = 0.0) {
+        lock_guard<mutex> lock(compaction_mutex);
+        if (compacting) return false;
+        if (compaction_thread.joinable()) compaction_thread.join();
+        compacting = true;
+        compaction_thread = thread([this, min_deleted_ratio] {
+            compact(min_deleted_ratio);
+            compacting = false;
+        });
+        return true;
+    }
+
+    // дождаться конца фонового уплотнения
+    void waitForCompaction() {
+        lock_guard<mutex> lock(compaction_mutex);
+        if (compaction_thread.joinable()) compaction_thread.join();
+    }
+
+    // дождаться, пока фоновые слияния разберут все части, которые можно слить
+    void waitForMerges() {
+        unique_lock<mutex> lock(merge_mutex);
+        merge_signal.wait(lock, [this] { return merge_stopping || (!merge_requested && !merge_running); });
+    }
+
+    // текущий снимок для читателей; можно вызывать из любого потока параллельно с писателем
+    shared_ptr<const IndexSnapshot> snapshot() const {
+        return atomic_load(&published);
+    }
+
+    // выполнение сложного запроса на стороне писателя: опубликованный снимок + неопубликованные доки
+    vector<int> executeQuery(const string& query) {
+        lock_guard<mutex> lock(writer_mutex);
+        return matchQuery(query, nullptr);
+    }
+
+    // k самых релевантных доков по BM25 на стороне писателя (снимок + неопубликованные доки)
+    vector<ScoredDocument> executeQuery(const string& query, size_t k) {
+        lock_guard<mutex> lock(writer_mutex);
+        return rankQuery(query, k, nullptr);
+    }
+
+    // limit доков после первых offset (по возрастанию doc_id): вычисление останавливается на конце страницы
+    vector<int> executeQueryPage(const string& query, size_t offset, size_t limit) {
+        lock_guard<mutex> lock(writer_mutex);
+        return runProfiledQuery("page", query, query_metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return queryResultsPage(ast, readers(), offset, limit, query_cache.get(), &deleted_docs, profile);
+        });
+    }
+
+    // число найденных доков без сбора их doc_id
+    size_t countQuery(const string& query) {
+        lock_guard<mutex> lock(writer_mutex);
+        return runProfiledQuery("count", query, query_metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return countQueryResults(ast, readers(), query_cache.get(), &deleted_docs, profile);
+        });
+    }
+
+    // доки по одному без сбора в вектор; on_doc(doc_id) возвращает false, чтобы остановиться.
+    // Вызывается под блокировкой писателя - из on_doc нельзя обращаться к индексу
+    template <typename Fn>
+    void forEachResult(const string& query, Fn&& on_doc) {
+        lock_guard<mutex> lock(writer_mutex);
+        runProfiledQuery("foreach", query, query_metrics.get(), nullptr, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            size_t delivered = 0;
+            forEachQueryResult(ast, readers(), [&](int doc_id) {
+                delivered++;
+                return on_doc(doc_id);
+            }, query_cache.get(), &deleted_docs, profile);
+            return delivered;
+        });
+    }
+
+    // запрос с профилем выполнения (EXPLAIN ANALYZE): найденные доки и дерево плана, у каждого оператора -
+    // размеры входа и выхода, пройденные и пропущенные позиции списков, распакованные байты, выделения памяти и время
+    QueryProfile profileQuery(const string& query) {
+        lock_guard<mutex> lock(writer_mutex);
+        QueryProfile profile;
+        profile.doc_ids = matchQuery(query, &profile.plan);
+        return profile;
+    }
+
+    // то же для top-k по BM25
+    QueryProfile profileQuery(const string& query, size_t k) {
+        lock_guard<mutex> lock(writer_mutex);
+        QueryProfile profile;
+        profile.ranked = rankQuery(query, k, &profile.plan);
+        return profile;
+    }
+
+    // профилирование всех запросов писателя и снимков в сводные метрики (выключено по умолчанию)
+    void setQueryProfiling(bool enabled) {
+        query_metrics->setEnabled(enabled);
+    }
+
+    // сводные метрики: гистограммы задержек, счетчики операторов, самые медленные запросы
+    shared_ptr<QueryMetrics> queryMetrics() const {
+        return query_metrics;
+    }
+
+    bool dumpQueryMetrics(const string& path) const {
+        return query_metrics->dumpToFile(path);
+    }
+
+    // счетчики кэша результатов (попадания, промахи, вытеснения, объем)
+    QueryCacheStats queryCacheStats() const {
+        return query_cache->stats();
+    }
+
+    // объем кэша результатов в байтах; 0 - результаты не кэшируются
+    void setQueryCacheCapacity(size_t bytes) {
+        query_cache->setCapacity(bytes);
+    }
+
+    // сохранение доков из памяти в сегмент на диске (доки из загруженных сегментов и удаленные доки
+    // туда не попадают)
+    bool saveSegment(const string& path) {
+        lock_guard<mutex> lock(writer_mutex);
+        memory->finalizeIndexes();
+
+        vector<const MemoryIndex*> memory_parts;
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) memory_parts.push_back(memory_part);
+        }
+        auto save = [&](const MemoryIndex& source) {
+            if (source.allDocs().intersectionCount(deleted_docs.docs) == 0) return source.saveSegment(path, next_doc_id);
+            return source.withoutDocuments(deleted_docs.docs)->saveSegment(path, next_doc_id);
+        };
+        if (memory_parts.empty()) return save(*memory);
+
+        // опубликованных частей несколько - сначала склеиваем их в одну
+        memory_parts.push_back(memory.get());
+        MemoryIndex merged(memory_parts[0]->firstDocId(), compress_postings);
+        merged.appendParts(memory_parts, max(1, static_cast<int>(thread::hardware_concurrency())));
+        merged.finalizeIndexes();
+        return save(merged);
+    }
+
+    // подключение сегмента с диска без разбора в хеш-таблицы: файл отображается в память,
+    // запросы читают его напрямую. Сегмент должен продолжать уже загруженные доки,
+    // поэтому подключать сегменты можно только пока в памяти нет своих доков
+    bool loadSegment(const string& path) {
+        lock_guard<mutex> lock(writer_mutex);
+        if (memory->documentCount() > 0) return false;
+        for (const auto& part : published->parts) {
+            if (dynamic_cast<const MemoryIndex*>(part.get())) return false;
+        }
+        auto segment = make_shared<MappedSegment>();
+        if (!segment->open(path) || segment->firstDocId() < next_doc_id) return false;
+
+        next_doc_id = segment->nextDocId();
+        memory = make_shared<MemoryIndex>(next_doc_id, compress_postings);
+        auto next_snapshot = make_shared<IndexSnapshot>(*published);
+        next_snapshot->parts.push_back(segment);
+        atomic_store(&published, shared_ptr<const IndexSnapshot>(next_snapshot));
+        return true;
+    }
+
+    // число доков в индексе (снимок + неопубликованные) без удаленных
+    size_t documentCount() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t count = memory->documentCount();
+        for (const auto& part : published->parts) count += part->allDocs().count();
+        return count - deleted_docs.docs.count();
+    }
+
+    // объем памяти частей в памяти под координатные списки (позиции, маски полей и диапазоны полей доков)
+    size_t positionalMemoryBytes() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t bytes = memory->positionalMemoryBytes();
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) bytes += memory_part->positionalMemoryBytes();
+        }
+        return bytes;
+    }
+
+    // объем памяти частей в памяти под списки doc_id (один список на терм, поля - фильтр по нему)
+    size_t postingMemoryBytes() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t bytes = memory->postingMemoryBytes();
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) bytes += memory_part->postingMemoryBytes();
+        }
+        return bytes;
+    }
+
+    // число постингов в частях в памяти (к нему относятся оба объема выше)
+    size_t postingCount() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t count = memory->postingCount();
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) count += memory_part->postingCount();
+        }
+        return count;
+    }
+
+    // методы для получения заголовка и содержания дока (копией: текущая часть меняется под писателем,
+    // без копирования тексты читаются из снимка - IndexSnapshot::documentText)
+    string getDocumentTitle(int doc_id) {
+        lock_guard<mutex> lock(writer_mutex);
+        string buffer;
+        string_view text;
+        if (documentTextLocked(StoredField::TITLE, doc_id, buffer, text)) return string(text);
+        return "Document " + to_string(doc_id);
+    }
+
+    string getDocumentContent(int doc_id) {
+        lock_guard<mutex> lock(writer_mutex);
+        string buffer;
+        string_view text;
+        if (documentTextLocked(StoredField::CONTENT, doc_id, buffer, text)) return string(text);
+        return "";
+    }
+
+    // фрагмент содержания дока с подсвеченными термами запроса (см. documentSnippet)
+    string getDocumentSnippet(int doc_id, const string& query, const SnippetOptions& options = SnippetOptions()) {
+        lock_guard<mutex> lock(writer_mutex);
+        if (deleted_docs.docs.test(doc_id)) return "";
+        QueryParser parser(query);
+        return documentSnippet(readers(), doc_id, parser.parse(), options);
+    }
+
+    // объем памяти под тексты доков в частях в памяти и их объем до сжатия
+    size_t storedTextMemoryBytes() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t bytes = memory->storedTextMemoryBytes();
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) bytes += memory_part->storedTextMemoryBytes();
+        }
+        return bytes;
+    }
+
+    size_t storedTextRawBytes() const {
+        lock_guard<mutex> lock(writer_mutex);
+        size_t bytes = memory->storedTextRawBytes();
+        for (const auto& part : published->parts) {
+            if (auto memory_part = dynamic_cast<const MemoryIndex*>(part.get())) bytes += memory_part->storedTextRawBytes();
+        }
+        return bytes;
+    }
+
+private:
+    // текст дока из снимка писателя и текущей части (под writer_mutex)
+    bool documentTextLocked(StoredField field, int doc_id, string& buffer, string_view& out) const {
+        if (deleted_docs.docs.test(doc_id)) return false;
+        for (const IndexReader* part : readers()) {
+            if (part->storedText(field, doc_id, buffer, out)) return true;
+        }
+        return false;
+    }
+
+    // добавление дока под writer_mutex
+    int addLocked(const vector<pair<string, string>>& document_pairs) {
+        int doc_id = next_doc_id++;
+        memory->addDocument(doc_id, document_pairs);
+
+        // вне пакетного режима сразу достраиваем затронутые списки
+        if (!bulk_loading) {
+            memory->finalizeIndexes();
+        }
+
+        return doc_id;
+    }
+
+    // запечатывание текущей части, когда она набрала порог доков (под writer_mutex).
+    // Пакетная загрузка публикует доки только в commit(), поэтому до него часть не запечатывается
+    void flushIfFull() {
+        if (bulk_loading || flush_documents == 0) return;
+        if (memory->documentCount() >= flush_documents) publishMemory();
+    }
+
+    // удаление дока под writer_mutex
+    bool deleteLocked(int doc_id) {
+        if (deleted_docs.docs.test(doc_id) || !containsDocument(doc_id)) return false;
+        deleted_docs.docs.set(doc_id);
+        deleted_docs.generation = nextIndexGeneration();
+        return true;
+    }
+
+    // док есть в текущей части или в одной из опубликованных (под writer_mutex)
+    bool containsDocument(int doc_id) const {
+        if (memory->allDocs().test(doc_id)) return true;
+        for (const auto& part : published->parts) {
+            if (part->allDocs().test(doc_id)) return true;
+        }
+        return false;
+    }
+
+    // общая часть addDocuments для обоих видов доков
+    template <typename Document>
+    vector<int> addDocumentBatch(const vector<Document>& documents, int thread_count) {
+        lock_guard<mutex> lock(writer_mutex);
+        if (thread_count <= 0) thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+        thread_count = static_cast<int>(min<size_t>(thread_count, max<size_t>(documents.size(), 1)));
+
+        int first_doc_id = next_doc_id;
+        vector<int> doc_ids(documents.size());
+        iota(doc_ids.begin(), doc_ids.end(), first_doc_id);
+        if (documents.empty()) return doc_ids;
+
+        // частичные индексы, у каждого потока свой диапазон doc_id
+        vector<unique_ptr<MemoryIndex>> partials;
+        vector<const MemoryIndex*> sources;
+        vector<thread> workers;
+        for (int t = 0; t < thread_count; ++t) {
+            size_t begin = documents.size() * t / thread_count;
+            size_t end = documents.size() * (t + 1) / thread_count;
+            partials.push_back(make_unique<MemoryIndex>(first_doc_id + static_cast<int>(begin), false));
+            sources.push_back(partials.back().get());
+            workers.emplace_back([&documents, partial = partials.back().get(), first_doc_id, begin, end] {
+                for (size_t i = begin; i < end; ++i) partial->addDocument(first_doc_id + static_cast<int>(i), documents[i]);
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        next_doc_id = first_doc_id + static_cast<int>(documents.size());
+
+        memory->appendParts(sources, thread_count);
+        if (!bulk_loading) {
+            memory->finalizeIndexes();
+        }
+        flushIfFull();
+        return doc_ids;
+    }
+
+    // части для запроса: опубликованный снимок + текущая часть в памяти (под writer_mutex)
+    vector<const IndexReader*> readers() const {
+        vector<const IndexReader*> result = published->readers();
+        result.push_back(memory.get());
+        return result;
+    }
+
+    // запросы писателя (под writer_mutex); root - профиль по запросу или nullptr
+    vector<int> matchQuery(const string& query, QueryProfileNode* root) {
+        return runProfiledQuery("query", query, query_metrics.get(), root, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return queryResults(ast, readers(), query_cache.get(), &deleted_docs, profile);
+        });
+    }
+
+    vector<ScoredDocument> rankQuery(const string& query, size_t k, QueryProfileNode* root) {
+        return runProfiledQuery("ranked", query, query_metrics.get(), root, [&](shared_ptr<ASTNode> ast, QueryProfileNode* profile) {
+            return rankedQueryResults(ast, readers(), k, query_cache.get(), &deleted_docs, profile);
+        });
+    }
+
+    // заморозка текущей части в памяти и атомарная подмена снимка (вызывается под writer_mutex);
+    // вместе с доками снимок получает копию карты удаленных. Слияние частей - дело фонового потока
+    void publishMemory() {
+        memory->finalizeIndexes();
+        bool deletions_changed = published->deleted->generation != deleted_docs.generation;
+        if (memory->documentCount() == 0) {
+            // новых доков нет - публикуем только удаления, если они были
+            if (!deletions_changed) return;
+            auto next_snapshot = make_shared<IndexSnapshot>(*published);
+            next_snapshot->deleted = make_shared<const DeletedDocs>(deleted_docs);
+            atomic_store(&published, shared_ptr<const IndexSnapshot>(next_snapshot));
+            return;
+        }
+
+        auto next_snapshot = make_shared<IndexSnapshot>(*published);
+        if (deletions_changed) next_snapshot->deleted = make_shared<const DeletedDocs>(deleted_docs);
+        // порядок словаря для подстановок готовим до публикации: снимок читают без блокировок
+        memory->prepareWildcards();
+        memory->shrinkStoredText();
+        next_snapshot->parts.push_back(memory);
+        atomic_store(&published, shared_ptr<const IndexSnapshot>(next_snapshot));
+        // следующая часть начинается сразу за последним доком этой: doc_id, зарезервированные
+        // конвейером загрузки (reserveDocIds) и еще не дописанные, попадут в нее
+        memory = make_shared<MemoryIndex>(memory->nextDocId(), compress_postings);
+        requestMerges();
+    }
+
+    // разбудить фоновый поток слияний (заводится при первом запросе); после остановки ничего не делает
+    void requestMerges() {
+        lock_guard<mutex> lock(merge_mutex);
+        if (merge_stopping) return;
+        merge_requested = true;
+        if (!merge_thread.joinable()) merge_thread = thread([this] { mergeWorker(); });
+        merge_signal.notify_all();
+    }
+
+    void mergeWorker() {
+        unique_lock<mutex> lock(merge_mutex);
+        while (true) {
+            merge_signal.wait(lock, [this] { return merge_requested || merge_stopping; });
+            if (merge_stopping) {
+                merge_requested = false;
+                merge_signal.notify_all();
+                return;
+            }
+            merge_requested = false;
+            merge_running = true;
+            lock.unlock();
+            runMerges();
+            lock.lock();
+            merge_running = false;
+            merge_signal.notify_all();
+        }
+    }
+
+    static int mergeTier(size_t documents, size_t factor) {
+        int tier = 0;
+        for (; documents >= factor; documents /= factor) tier++;
+        return tier;
+    }
+
+    // ярусная политика: среди групп из merge_factor соседних частей в памяти одного яруса
+    // выбирается группа самого нижнего яруса (самое дешевое слияние); пусто - сливать нечего
+    vector<shared_ptr<const MemoryIndex>> mergeCandidates(const IndexSnapshot& base) const {
+        size_t factor = merge_factor;
+        vector<shared_ptr<const MemoryIndex>> best, group;
+        int best_tier = numeric_limits<int>::max(), group_tier = -1;
+        for (const auto& part : base.parts) {
+            auto memory_part = dynamic_pointer_cast<const MemoryIndex>(part);
+            if (!memory_part) {
+                group.clear();
+                continue;
+            }
+            int tier = mergeTier(memory_part->documentCount(), factor);
+            if (tier != group_tier) {
+                group.clear();
+                group_tier = tier;
+            }
+            group.push_back(memory_part);
+            if (group.size() < factor) continue;
+            if (tier < best_tier) {
+                best = group;
+                best_tier = tier;
+            }
+            group.clear();
+        }
+        return best;
+    }
+
+    // слияния, пока политика находит группу: части склеиваются вне блокировки писателя, блокировка
+    // берется только на подмену частей в снимке. Удаленные доки переходят в склеенную часть как есть -
+    // место освобождает только compact(), поэтому статистика BM25 не зависит от того, когда прошло слияние
+    void runMerges() {
+        while (true) {
+            shared_ptr<const IndexSnapshot> base = snapshot();
+            vector<shared_ptr<const MemoryIndex>> group = mergeCandidates(*base);
+            if (group.empty()) return;
+
+            vector<const MemoryIndex*> sources;
+            for (const auto& part : group) sources.push_back(part.get());
+            auto merged = make_shared<MemoryIndex>(group[0]->firstDocId(), compress_postings);
+            merged->appendParts(sources, max(1, static_cast<int>(thread::hardware_concurrency())));
+            merged->finalizeIndexes();
+            merged->prepareWildcards();
+            merged->shrinkStoredText();
+
+            lock_guard<mutex> lock(writer_mutex);
+            replaceParts({{vector<const IndexReader*>(sources.begin(), sources.end()), merged}}, DocBitmap());
+        }
+    }
+
+    // подмена в новом снимке групп соседних частей их заменами (под writer_mutex). Если группы уже
+    // нет в снимке подряд (ее успели заменить), замена пропускается. Доки из карты deleted, которых
+    // в заменах больше нет, снимаются с карт удаленных писателя и снимка; возвращает их число
+    size_t replaceParts(const vector<PartReplacement>& replacements, const DocBitmap& deleted) {
+        auto next_snapshot = make_shared<IndexSnapshot>(*published);
+        auto next_deleted = make_shared<DeletedDocs>(*published->deleted);
+        bool pending_deletions = published->deleted->generation != deleted_docs.generation;
+        auto& parts = next_snapshot->parts;
+        bool replaced = false;
+        size_t reclaimed = 0;
+        for (const auto& replacement : replacements) {
+            const auto& sources = replacement.sources;
+            auto it = find_if(parts.begin(), parts.end(),
+                              [&](const shared_ptr<const IndexReader>& part) { return part.get() == sources[0]; });
+            if (static_cast<size_t>(parts.end() - it) < sources.size()) continue;
+            bool adjacent = equal(sources.begin(), sources.end(), it,
+                                  [](const IndexReader* source, const shared_ptr<const IndexReader>& part) {
+                                      return source == part.get();
+                                  });
+            if (!adjacent) continue;
+
+            const DocBitmap& kept = replacement.part->allDocs();
+            for (const IndexReader* source : sources) {
+                const auto& words = source->allDocs().words;
+                for (size_t word = 0; word < min(words.size(), deleted.words.size()); ++word) {
+                    uint64_t kept_bits = word < kept.words.size() ? kept.words[word] : 0;
+                    for (uint64_t gone = words[word] & deleted.words[word] & ~kept_bits; gone; gone &= gone - 1) {
+                        int doc_id = static_cast<int>(word * 64 + __builtin_ctzll(gone));
+                        next_deleted->docs.reset(doc_id);
+                        deleted_docs.docs.reset(doc_id);
+                        reclaimed++;
+                    }
+                }
+            }
+            it = parts.erase(it + 1, it + sources.size()) - 1;
+            *it = replacement.part;
+            replaced = true;
+        }
+        if (!replaced) return 0;
+
+        if (reclaimed > 0) {
+            next_deleted->generation = nextIndexGeneration();
+            // без неопубликованных удалений карты писателя и снимка совпадают - пусть совпадают и номера
+            deleted_docs.generation = pending_deletions ? nextIndexGeneration() : next_deleted->generation;
+            next_snapshot->deleted = next_deleted;
+        }
+        atomic_store(&published, shared_ptr<const IndexSnapshot>(next_snapshot));
+        return reclaimed;
     }
 };
 
@@ -0,0 +1,675 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "posting_list.h"
+#include "term_dictionary.h"
+#include "doc_store.h"
+
+using namespace std;
+
+// Сегмент индекса на диске - неизменяемый снимок доков [first_doc_id, next_doc_id).
+// Файл целиком отображается в память, а запросы читают списки прямо из отображенных байтов:
+// словарь термов отсортирован и ищется двоичным поиском, списки doc_id лежат в том же блочном
+// формате, что и CompressedPostings, поэтому CompressedView указывает прямо в файл.
+//
+// Раскладка файла (все смещения - от начала файла, секции выровнены на 8 байт):
+//   SegmentHeader
+//   SegmentDictionary единого индекса: uint32 term_offsets[term_count + 1], байты термов,
+//                        uint32 reversed_order[term_count] (номера термов по возрастанию перевернутого терма),
+//                        SegmentTermEntry[term_count], списки doc_id, позиций и масок полей термов
+//   имена полей: uint32 name_offsets[field_count + 1] и байты имен (номер поля - индекс имени)
+//   диапазоны полей доков (field_ranges.h): uint32 doc_offsets[doc_count + 1], FieldRange[]
+//   uint64 слова битовой карты всех доков, uint32 длины доков (в термах)
+//   для заголовков и содержания - массивы DocStore (doc_store.h): битовая карта "поле есть",
+//   uint64 doc_offsets[doc_count + 1], block_starts[block_count], block_offsets[block_count + 1],
+//   сжатые блоки и несжатый хвост
+constexpr uint32_t SEGMENT_MAGIC = 0x47455349; // "ISEG"
+// версия 6: один словарь, поля - маски в постингах и диапазоны позиций доков;
+// версия 7: полей сколько угодно, у диапазонов полей сверх MAX_FIELDS настоящие номера; старые сегменты несовместимы
+constexpr uint32_t SEGMENT_VERSION = 7;
+
+struct SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t first_doc_id;
+    int32_t next_doc_id;
+    uint64_t file_size;
+    uint64_t dictionary_offset;
+    uint64_t field_count;
+    uint64_t field_names_offset;     // uint32 name_offsets[field_count + 1], за ними байты имен
+    uint64_t field_doc_offsets_offset;
+    uint64_t field_ranges_offset;
+    uint64_t docs_offset;       // слова битовой карты всех доков
+    uint64_t docs_words;
+    uint64_t lengths_offset;    // uint32 длина каждого дока диапазона
+    uint64_t total_length;
+    uint64_t titles_offset;     // SegmentDocStore заголовков
+    uint64_t contents_offset;   // SegmentDocStore содержания
+};
+
+struct SegmentDictionary {
+    uint64_t term_count;
+    uint64_t term_offsets_offset;
+    uint64_t term_bytes_offset;
+    uint64_t reversed_order_offset; // для подстановок "*suffix"
+    uint64_t entries_offset;
+};
+
+// Список терма: doc_id (общие для обратного и координатного списков), позиции и поля.
+// По postings_offset подряд лежат int block_last[packed_blocks], uint32 block_offset[packed_blocks],
+// int tail[tail_size], uint32 data[data_words], uint8 block_width[packed_blocks].
+// По positions_offset - uint32 offsets[count + 1] и разности позиций varbyte,
+// по scores_offset - uint32 block_max_tf[(count + 127) / 128], по field_masks_offset - uint8 маски полей[count];
+// field_counts[f] - число доков, в которых терм есть в поле f (у полей с битом в маске, f < MAX_FIELDS)
+struct SegmentTermEntry {
+    uint64_t postings_offset;
+    uint64_t positions_offset;
+    uint64_t scores_offset;
+    uint64_t field_masks_offset;
+    uint32_t field_counts[MAX_FIELDS];
+    uint32_t max_tf;
+    uint32_t count;
+    uint32_t packed_blocks;
+    uint32_t last_block_size;
+    uint32_t tail_size;
+    uint32_t data_words;
+};
+
+struct SegmentDocStore {
+    uint64_t doc_count;
+    uint64_t presence_offset;
+    uint64_t doc_offsets_offset;
+    uint64_t block_count;
+    uint64_t block_starts_offset;
+    uint64_t block_offsets_offset;
+    uint64_t compressed_offset;
+    uint64_t tail_offset;
+    uint64_t tail_start;
+};
+
+// терм словаря и его список (doc_id + позиции) в памяти
+struct SegmentTerm {
+    const string* term;
+    const PositionalPostings* list;
+};
+
+// Запись сегмента: поля и хранилища доков копятся по ссылкам, файл собирается в write()
+class SegmentWriter {
+private:
+    int first_doc_id;
+    int next_doc_id;
+    const DocBitmap* all_docs;
+    const vector<uint32_t>* doc_lengths;
+    const vector<string>* field_names;
+    const FieldRanges* field_ranges;
+    const DocStore* titles;
+    const DocStore* contents;
+    vector<char> bytes;
+
+public:
+    // lengths[i] - длина дока first_doc + i, диапазоны полей дока first_doc + i - i-я запись ranges
+    SegmentWriter(int first_doc, int next_doc, const DocBitmap& docs, const vector<uint32_t>& lengths,
+                  const vector<string>& fields, const FieldRanges& ranges,
+                  const DocStore& doc_titles, const DocStore& doc_contents)
+        : first_doc_id(first_doc), next_doc_id(next_doc), all_docs(&docs), doc_lengths(&lengths),
+          field_names(&fields), field_ranges(&ranges), titles(&doc_titles), contents(&doc_contents) {}
+
+    // сборка файла со словарем terms (пустые списки пропускаются); пишем во временный файл
+    // и переименовываем, чтобы не оставить полузаписанный сегмент
+    bool write(const string& path, vector<SegmentTerm> terms) {
+        bytes.clear();
+        SegmentHeader header = {};
+        header.magic = SEGMENT_MAGIC;
+        header.version = SEGMENT_VERSION;
+        header.first_doc_id = first_doc_id;
+        header.next_doc_id = next_doc_id;
+        append(&header, sizeof(header));
+
+        SegmentDictionary dictionary = writeDictionary(move(terms));
+        header.dictionary_offset = append(&dictionary, sizeof(dictionary));
+        header.field_count = field_names->size();
+        header.field_names_offset = writeFieldNames();
+        writeFieldRanges(header);
+
+        header.docs_offset = append(all_docs->words.data(), all_docs->words.size() * sizeof(uint64_t));
+        header.docs_words = all_docs->words.size();
+        vector<uint32_t> lengths(next_doc_id - first_doc_id, 0);
+        copy_n(doc_lengths->begin(), min(lengths.size(), doc_lengths->size()), lengths.begin());
+        header.lengths_offset = append(lengths.data(), lengths.size() * sizeof(uint32_t));
+        for (uint32_t length : lengths) header.total_length += length;
+        header.titles_offset = writeDocStore(*titles);
+        header.contents_offset = writeDocStore(*contents);
+        header.file_size = bytes.size();
+        memcpy(bytes.data(), &header, sizeof(header));
+
+        string temp_path = path + ".tmp";
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            if (!file) return false;
+            file.write(bytes.data(), bytes.size());
+            if (!file) return false;
+        }
+        return rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    // дописать данные с выравниванием на 8 байт, вернуть их смещение
+    uint64_t append(const void* data, size_t size) {
+        uint64_t offset = reserve(size);
+        if (size) memcpy(bytes.data() + offset, data, size);
+        return offset;
+    }
+
+    // дописать данные вплотную к предыдущим (массивы одного списка лежат подряд)
+    uint64_t appendPacked(const void* data, size_t size) {
+        uint64_t offset = bytes.size();
+        bytes.resize(offset + size);
+        if (size) memcpy(bytes.data() + offset, data, size);
+        return offset;
+    }
+
+    uint64_t reserve(size_t size) {
+        bytes.resize((bytes.size() + 7) & ~size_t(7), 0);
+        uint64_t offset = bytes.size();
+        bytes.resize(offset + size, 0);
+        return offset;
+    }
+
+    SegmentDictionary writeDictionary(vector<SegmentTerm> terms) {
+        terms.erase(remove_if(terms.begin(), terms.end(), [](const SegmentTerm& term) { return term.list->empty(); }),
+                    terms.end());
+        sort(terms.begin(), terms.end(), [](const SegmentTerm& a, const SegmentTerm& b) { return *a.term < *b.term; });
+
+        SegmentDictionary dictionary = {};
+        dictionary.term_count = terms.size();
+
+        vector<uint32_t> term_offsets = {0};
+        string term_bytes;
+        for (const SegmentTerm& term : terms) {
+            term_bytes += *term.term;
+            term_offsets.push_back(static_cast<uint32_t>(term_bytes.size()));
+        }
+        dictionary.term_offsets_offset = append(term_offsets.data(), term_offsets.size() * sizeof(uint32_t));
+        dictionary.term_bytes_offset = append(term_bytes.data(), term_bytes.size());
+
+        vector<uint32_t> reversed_order(terms.size());
+        for (uint32_t t = 0; t < reversed_order.size(); ++t) reversed_order[t] = t;
+        sort(reversed_order.begin(), reversed_order.end(), [&](uint32_t a, uint32_t b) {
+            return reversedTermLess(*terms[a].term, *terms[b].term);
+        });
+        dictionary.reversed_order_offset = append(reversed_order.data(), reversed_order.size() * sizeof(uint32_t));
+
+        vector<SegmentTermEntry> entries(terms.size());
+        dictionary.entries_offset = reserve(entries.size() * sizeof(SegmentTermEntry));
+        for (size_t t = 0; t < terms.size(); ++t) {
+            const PositionalPostings& list = *terms[t].list;
+            entries[t] = writePostings(list.doc_ids);
+            entries[t].positions_offset = writePositions(list);
+            entries[t].scores_offset = append(list.block_max_tf.data(), list.block_max_tf.size() * sizeof(uint32_t));
+            entries[t].field_masks_offset = appendPacked(list.field_masks.data(), list.field_masks.size());
+            copy_n(list.field_counts, MAX_FIELDS, entries[t].field_counts);
+            entries[t].max_tf = list.max_tf;
+        }
+        memcpy(bytes.data() + dictionary.entries_offset, entries.data(), entries.size() * sizeof(SegmentTermEntry));
+        return dictionary;
+    }
+
+    // список doc_id в блочном формате; несжатые списки из памяти сжимаются здесь
+    SegmentTermEntry writePostings(const PostingList& list) {
+        CompressedPostings encoded;
+        const CompressedPostings* compressed = &list.compressed;
+        if (!list.is_compressed) {
+            encoded = CompressedPostings::encode(list.doc_ids);
+            compressed = &encoded;
+        }
+
+        SegmentTermEntry entry = {};
+        entry.count = static_cast<uint32_t>(compressed->size());
+        entry.packed_blocks = static_cast<uint32_t>(compressed->block_last.size());
+        entry.last_block_size = static_cast<uint32_t>(compressed->last_block_size);
+        entry.tail_size = static_cast<uint32_t>(compressed->tail.size());
+        entry.data_words = static_cast<uint32_t>(compressed->data.size());
+        entry.postings_offset = append(compressed->block_last.data(), compressed->block_last.size() * sizeof(int));
+        appendPacked(compressed->block_offset.data(), compressed->block_offset.size() * sizeof(uint32_t));
+        appendPacked(compressed->tail.data(), compressed->tail.size() * sizeof(int));
+        appendPacked(compressed->data.data(), compressed->data.size() * sizeof(uint32_t));
+        appendPacked(compressed->block_width.data(), compressed->block_width.size());
+        return entry;
+    }
+
+    // позиции всегда пишем разностями varbyte
+    uint64_t writePositions(const PositionalPostings& list) {
+        if (list.doc_ids.is_compressed) {
+            uint64_t offset = append(list.offsets.data(), list.offsets.size() * sizeof(uint32_t));
+            appendPacked(list.packed_positions.data(), list.packed_positions.size());
+            return offset;
+        }
+
+        vector<uint32_t> offsets = {0};
+        vector<uint8_t> packed;
+        for (size_t i = 0; i + 1 < list.offsets.size(); ++i) {
+            int prev = 0;
+            for (uint32_t k = list.offsets[i]; k < list.offsets[i + 1]; ++k) {
+                appendVarint(packed, static_cast<uint32_t>(list.positions[k] - prev));
+                prev = list.positions[k];
+            }
+            offsets.push_back(static_cast<uint32_t>(packed.size()));
+        }
+        uint64_t offset = append(offsets.data(), offsets.size() * sizeof(uint32_t));
+        appendPacked(packed.data(), packed.size());
+        return offset;
+    }
+
+    uint64_t writeFieldNames() {
+        vector<uint32_t> name_offsets = {0};
+        string name_bytes;
+        for (const string& name : *field_names) {
+            name_bytes += name;
+            name_offsets.push_back(static_cast<uint32_t>(name_bytes.size()));
+        }
+        uint64_t offset = append(name_offsets.data(), name_offsets.size() * sizeof(uint32_t));
+        appendPacked(name_bytes.data(), name_bytes.size());
+        return offset;
+    }
+
+    // диапазоны полей по всем докам диапазона сегмента (у доков без записи диапазонов нет)
+    void writeFieldRanges(SegmentHeader& header) {
+        size_t doc_count = next_doc_id - first_doc_id;
+        FieldRangesView view = field_ranges->view(first_doc_id);
+        vector<uint32_t> doc_offsets(view.doc_offsets, view.doc_offsets + min(doc_count, view.doc_count) + 1);
+        doc_offsets.resize(doc_count + 1, doc_offsets.back());
+        header.field_doc_offsets_offset = append(doc_offsets.data(), doc_offsets.size() * sizeof(uint32_t));
+        header.field_ranges_offset = append(view.ranges, doc_offsets.back() * sizeof(FieldRange));
+    }
+
+    // хранилище текстов поля: массивы DocStore копируются как есть, сжатые блоки не пересжимаются
+    uint64_t writeDocStore(const DocStore& store) {
+        DocStoreView view = store.view();
+        SegmentDocStore doc_store = {};
+        doc_store.doc_count = view.doc_count;
+        doc_store.presence_offset = append(view.presence, (view.doc_count + 63) / 64 * sizeof(uint64_t));
+        doc_store.doc_offsets_offset = append(view.doc_offsets, (view.doc_count + 1) * sizeof(uint64_t));
+        doc_store.block_count = view.block_count;
+        doc_store.block_starts_offset = append(view.block_starts, view.block_count * sizeof(uint64_t));
+        doc_store.block_offsets_offset = append(view.block_offsets, (view.block_count + 1) * sizeof(uint64_t));
+        doc_store.compressed_offset = append(view.compressed, view.block_offsets[view.block_count]);
+        doc_store.tail_offset = append(view.tail, view.doc_offsets[view.doc_count] - view.tail_start);
+        doc_store.tail_start = view.tail_start;
+        return append(&doc_store, sizeof(doc_store));
+    }
+};
+
+// Сегмент, отображенный в память. Ничего не распаковывается при открытии: словари, списки
+// и тексты доков читаются по смещениям прямо из отображения (копируется только битовая карта доков)
+class MappedSegment : public IndexReader {
+private:
+    const char* base;
+    size_t mapped_size;
+    const SegmentHeader* header;
+    const SegmentDictionary* dictionary;
+    DocBitmap all_docs;
+    // диапазоны полей доков смотрят прямо в отображение
+    FieldRangesView field_ranges;
+    // хранилища текстов смотрят прямо в отображение
+    DocStoreView titles;
+    DocStoreView contents;
+    uint64_t segment_generation;
+
+public:
+    MappedSegment()
+        : base(nullptr), mapped_size(0), header(nullptr), dictionary(nullptr), segment_generation(nextIndexGeneration()) {}
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+
+    ~MappedSegment() {
+        if (base) munmap(const_cast<char*>(base), mapped_size);
+    }
+
+    // отображение файла + проверка заголовка и границ всех секций; false, если файла нет, формат не тот
+    // или файл обрезан либо испорчен (тогда индекс строится заново)
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SegmentHeader)) {
+            close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        base = static_cast<const char*>(mapped);
+        mapped_size = info.st_size;
+
+        header = at<SegmentHeader>(0);
+        if (header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION ||
+            header->file_size != mapped_size || !validSections()) {
+            return false;
+        }
+        dictionary = at<SegmentDictionary>(header->dictionary_offset);
+        field_ranges.doc_offsets = at<uint32_t>(header->field_doc_offsets_offset);
+        field_ranges.ranges = at<FieldRange>(header->field_ranges_offset);
+        field_ranges.doc_count = header->next_doc_id - header->first_doc_id;
+        field_ranges.first_doc_id = header->first_doc_id;
+        const uint64_t* words = at<uint64_t>(header->docs_offset);
+        all_docs.words.assign(words, words + header->docs_words);
+        for (uint64_t word : all_docs.words) all_docs.bit_count += __builtin_popcountll(word);
+        titles = docStoreAt(header->titles_offset);
+        contents = docStoreAt(header->contents_offset);
+        return true;
+    }
+
+    uint64_t generation() const override {
+        return segment_generation;
+    }
+
+    int firstDocId() const { return header->first_doc_id; }
+    int nextDocId() const { return header->next_doc_id; }
+    bool contains(int doc_id) const { return doc_id >= header->first_doc_id && doc_id < header->next_doc_id; }
+
+    // без поля - список терма как есть, с полем - он же с фильтром по полю
+    PostingRef postings(const string& term, const string& field) const override {
+        const SegmentTermEntry* entry = findTerm(term);
+        if (!entry) return emptyPostings();
+        if (field.empty()) return PostingRef::of(viewOf(*entry));
+        PositionsRef field_list = positionsOf(*entry);
+        return selectField(*entry, findField(field), field_list) ? field_list.doc_ids : emptyPostings();
+    }
+
+    bool positions(const string& term, const string& field, PositionsRef& out) const override {
+        const SegmentTermEntry* entry = findTerm(term);
+        if (!entry || !entry->positions_offset) return false;
+        out = positionsOf(*entry);
+        return field.empty() || selectField(*entry, findField(field), out);
+    }
+
+    void expandTerms(const string& pattern, const string& field, vector<string>& out) const override {
+        if (pattern.size() < 2) return;
+        uint32_t field_id = field.empty() ? NO_FIELD : findField(field);
+        if (!field.empty() && field_id == NO_FIELD) return;
+        const SegmentTermEntry* entries = at<SegmentTermEntry>(dictionary->entries_offset);
+        auto termAt = [&](size_t index) { return termOf(*dictionary, index); };
+        // с полем подходят только термы, которые в этом поле встречаются
+        auto addTerm = [&](size_t index, string_view term) {
+            PositionsRef field_list = positionsOf(entries[index]);
+            if (field.empty() || selectField(entries[index], field_id, field_list)) out.emplace_back(term);
+        };
+
+        if (pattern.back() == '*') {
+            string_view prefix(pattern.data(), pattern.size() - 1);
+            for (size_t index = lowerBound(*dictionary, prefix); index < dictionary->term_count; ++index) {
+                string_view term = termAt(index);
+                if (term.substr(0, prefix.size()) != prefix) break;
+                addTerm(index, term);
+            }
+        } else if (pattern.front() == '*') {
+            string_view suffix(pattern.data() + 1, pattern.size() - 1);
+            const uint32_t* order = at<uint32_t>(dictionary->reversed_order_offset);
+            size_t lo = 0, hi = dictionary->term_count;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (reversedTermLess(termAt(order[mid]), suffix)) lo = mid + 1; else hi = mid;
+            }
+            for (; lo < dictionary->term_count; ++lo) {
+                string_view term = termAt(order[lo]);
+                if (term.size() < suffix.size() || term.substr(term.size() - suffix.size()) != suffix) break;
+                addTerm(order[lo], term);
+            }
+        }
+    }
+
+    const DocBitmap& allDocs() const override {
+        return all_docs;
+    }
+
+    uint32_t documentLength(int doc_id) const override {
+        return contains(doc_id) ? at<uint32_t>(header->lengths_offset)[doc_id - header->first_doc_id] : 0;
+    }
+
+    uint64_t totalLength() const override {
+        return header->total_length;
+    }
+
+    bool storedText(StoredField field, int doc_id, string& buffer, string_view& out) const override {
+        if (!contains(doc_id)) return false;
+        const DocStoreView& store = field == StoredField::TITLE ? titles : contents;
+        return store.text(doc_id - header->first_doc_id, buffer, out);
+    }
+
+private:
+    template <typename T>
+    const T* at(uint64_t offset) const {
+        return reinterpret_cast<const T*>(base + offset);
+    }
+
+    // массив T[count] по смещению offset выровнен и целиком лежит в файле
+    template <typename T>
+    bool fits(uint64_t offset, uint64_t count) const {
+        return offset % alignof(T) == 0 && offset <= mapped_size && count <= (mapped_size - offset) / sizeof(T);
+    }
+
+    // массив смещений values[count + 1] лежит в файле, не убывает и не выходит за limit
+    // (смещение в соседнем массиве, который он размечает, - тот проверяется по values[count])
+    template <typename T>
+    bool fitsOffsets(uint64_t offset, uint64_t count, uint64_t limit = UINT64_MAX) const {
+        if (count >= mapped_size || !fits<T>(offset, count + 1)) return false;
+        const T* values = at<T>(offset);
+        for (uint64_t i = 0; i < count; ++i) {
+            if (values[i] > values[i + 1]) return false;
+        }
+        return values[count] <= limit;
+    }
+
+    // Границы секций по заголовку: словарь и списки всех термов, имена и диапазоны полей, доки,
+    // хранилища текстов. Упакованные блоки и varbyte не распаковываются - проверяются только
+    // размеры и смещения, по которым читаются списки, чтобы чтение не вышло за отображение
+    bool validSections() const {
+        if (header->next_doc_id < header->first_doc_id) return false;
+        uint64_t doc_count = static_cast<uint64_t>(header->next_doc_id) - header->first_doc_id;
+        if (doc_count >= mapped_size || !fits<uint64_t>(header->docs_offset, header->docs_words) ||
+            !fits<uint32_t>(header->lengths_offset, doc_count)) {
+            return false;
+        }
+
+        if (!fitsOffsets<uint32_t>(header->field_names_offset, header->field_count) ||
+            !fits<char>(header->field_names_offset + (header->field_count + 1) * sizeof(uint32_t),
+                        at<uint32_t>(header->field_names_offset)[header->field_count])) {
+            return false;
+        }
+        if (!fitsOffsets<uint32_t>(header->field_doc_offsets_offset, doc_count) ||
+            !fits<FieldRange>(header->field_ranges_offset, at<uint32_t>(header->field_doc_offsets_offset)[doc_count]) ||
+            !validFieldRanges(doc_count)) {
+            return false;
+        }
+
+        if (!fits<SegmentDictionary>(header->dictionary_offset, 1)) return false;
+        const SegmentDictionary& terms = *at<SegmentDictionary>(header->dictionary_offset);
+        if (!fitsOffsets<uint32_t>(terms.term_offsets_offset, terms.term_count) ||
+            !fits<char>(terms.term_bytes_offset, at<uint32_t>(terms.term_offsets_offset)[terms.term_count]) ||
+            !fits<uint32_t>(terms.reversed_order_offset, terms.term_count) ||
+            !fits<SegmentTermEntry>(terms.entries_offset, terms.term_count)) {
+            return false;
+        }
+        const uint32_t* order = at<uint32_t>(terms.reversed_order_offset);
+        const SegmentTermEntry* entries = at<SegmentTermEntry>(terms.entries_offset);
+        for (uint64_t t = 0; t < terms.term_count; ++t) {
+            if (order[t] >= terms.term_count || !validEntry(entries[t])) return false;
+        }
+        // поиск терма и подстановки - двоичные: термы строго по возрастанию, reversed_order - по перевернутым термам
+        for (uint64_t t = 1; t < terms.term_count; ++t) {
+            if (!(termOf(terms, t - 1) < termOf(terms, t)) ||
+                !reversedTermLess(termOf(terms, order[t - 1]), termOf(terms, order[t]))) {
+                return false;
+            }
+        }
+        return validDocStore(header->titles_offset) && validDocStore(header->contents_offset);
+    }
+
+    // массивы списка терма (раскладка - у SegmentTermEntry)
+    bool validEntry(const SegmentTermEntry& entry) const {
+        uint64_t words = 2 * uint64_t(entry.packed_blocks) + entry.tail_size + entry.data_words;
+        uint64_t blocks = (uint64_t(entry.count) + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+        uint64_t packed_count = entry.packed_blocks ? (entry.packed_blocks - 1) * uint64_t(POSTING_BLOCK_SIZE) : 0;
+        if (entry.last_block_size == 0 || entry.last_block_size > POSTING_BLOCK_SIZE ||
+            packed_count + (entry.packed_blocks ? entry.last_block_size : 0) + entry.tail_size != entry.count ||
+            !fits<uint32_t>(entry.postings_offset, words) ||
+            !fits<uint8_t>(entry.postings_offset + words * sizeof(uint32_t), entry.packed_blocks) ||
+            !fits<uint32_t>(entry.scores_offset, blocks) || !fits<FieldMask>(entry.field_masks_offset, entry.count)) {
+            return false;
+        }
+        // упакованный блок целиком лежит в data
+        CompressedView view = viewOf(entry);
+        for (size_t block = 0; block < view.packed_blocks; ++block) {
+            int n = block + 1 == view.packed_blocks ? view.last_block_size : POSTING_BLOCK_SIZE;
+            int vectors = (n + POSTING_BLOCK_LANES - 1) / POSTING_BLOCK_LANES;
+            if (view.block_width[block] > 32 ||
+                view.block_offset[block] + uint64_t(packedWords(view.block_width[block], vectors)) > entry.data_words) {
+                return false;
+            }
+        }
+        return !entry.positions_offset ||
+               (fitsOffsets<uint32_t>(entry.positions_offset, entry.count) &&
+                fits<uint8_t>(entry.positions_offset + (uint64_t(entry.count) + 1) * sizeof(uint32_t),
+                              at<uint32_t>(entry.positions_offset)[entry.count]));
+    }
+
+    // диапазоны полей каждого дока идут по возрастанию без перекрытий (на это опирается фильтр позиций),
+    // а номер поля - одно из полей сегмента
+    bool validFieldRanges(uint64_t doc_count) const {
+        const uint32_t* doc_offsets = at<uint32_t>(header->field_doc_offsets_offset);
+        const FieldRange* ranges = at<FieldRange>(header->field_ranges_offset);
+        for (uint64_t i = 0; i < doc_count; ++i) {
+            uint32_t end = 0;
+            for (uint32_t r = doc_offsets[i]; r < doc_offsets[i + 1]; ++r) {
+                if (ranges[r].start < end || ranges[r].end < ranges[r].start ||
+                    ranges[r].field >= header->field_count) {
+                    return false;
+                }
+                end = ranges[r].end;
+            }
+        }
+        return true;
+    }
+
+    // массивы хранилища текстов (раскладка - у SegmentDocStore)
+    bool validDocStore(uint64_t store_offset) const {
+        if (!fits<SegmentDocStore>(store_offset, 1)) return false;
+        const SegmentDocStore& store = *at<SegmentDocStore>(store_offset);
+        if (store.doc_count >= mapped_size || store.block_count >= mapped_size ||
+            !fits<uint64_t>(store.presence_offset, (store.doc_count + 63) / 64) ||
+            !fitsOffsets<uint64_t>(store.doc_offsets_offset, store.doc_count) ||
+            !fits<uint64_t>(store.block_starts_offset, store.block_count) ||
+            !fitsOffsets<uint64_t>(store.block_offsets_offset, store.block_count) ||
+            !fits<char>(store.compressed_offset, at<uint64_t>(store.block_offsets_offset)[store.block_count])) {
+            return false;
+        }
+        // первый блок начинается с нуля, начала блоков растут и не заходят за хвост,
+        // хвост - от tail_start до конца последнего текста
+        const uint64_t* block_starts = at<uint64_t>(store.block_starts_offset);
+        if (store.block_count ? block_starts[0] != 0 : store.tail_start != 0) return false;
+        for (uint64_t b = 0; b < store.block_count; ++b) {
+            if (block_starts[b] > store.tail_start || (b && block_starts[b] <= block_starts[b - 1])) return false;
+        }
+        uint64_t text_end = at<uint64_t>(store.doc_offsets_offset)[store.doc_count];
+        return store.tail_start <= text_end && fits<char>(store.tail_offset, text_end - store.tail_start);
+    }
+
+    // номер поля сегмента; NO_FIELD, если такого поля в сегменте нет
+    uint32_t findField(const string& field) const {
+        const uint32_t* name_offsets = at<uint32_t>(header->field_names_offset);
+        const char* names = reinterpret_cast<const char*>(name_offsets + header->field_count + 1);
+        for (uint32_t f = 0; f < header->field_count; ++f) {
+            if (string_view(names + name_offsets[f], name_offsets[f + 1] - name_offsets[f]) == field) return f;
+        }
+        return NO_FIELD;
+    }
+
+    static uint32_t fieldCount(const SegmentTermEntry& entry, uint32_t field) {
+        return field < MAX_FIELDS ? entry.field_counts[field] : 0;
+    }
+
+    // список терма с позициями (без позиций - только doc_id)
+    PositionsRef positionsOf(const SegmentTermEntry& entry) const {
+        PositionsRef out;
+        out.doc_ids = PostingRef::of(viewOf(entry));
+        if (!entry.positions_offset) return out;
+        out.offsets = at<uint32_t>(entry.positions_offset);
+        out.packed_positions = reinterpret_cast<const uint8_t*>(out.offsets + entry.count + 1);
+        out.block_max_tf = at<uint32_t>(entry.scores_offset);
+        out.max_tf = entry.max_tf;
+        return out;
+    }
+
+    // список терма, отфильтрованный по полю field_id (см. PositionsRef::selectField); полю без бита
+    // нужны позиции, поэтому у списка без позиций оно пустое
+    bool selectField(const SegmentTermEntry& entry, uint32_t field_id, PositionsRef& out) const {
+        if (field_id >= MAX_FIELDS && !entry.positions_offset) return false;
+        return out.selectField(field_id, at<FieldMask>(entry.field_masks_offset), fieldCount(entry, field_id), field_ranges);
+    }
+
+    string_view termOf(const SegmentDictionary& dictionary, size_t index) const {
+        const uint32_t* term_offsets = at<uint32_t>(dictionary.term_offsets_offset);
+        return string_view(at<char>(dictionary.term_bytes_offset) + term_offsets[index],
+                           term_offsets[index + 1] - term_offsets[index]);
+    }
+
+    // номер первого терма словаря >= value
+    size_t lowerBound(const SegmentDictionary& dictionary, string_view value) const {
+        size_t lo = 0, hi = dictionary.term_count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (termOf(dictionary, mid) < value) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    // двоичный поиск терма в отсортированном словаре
+    const SegmentTermEntry* findTerm(const string& term) const {
+        size_t index = lowerBound(*dictionary, term);
+        if (index == dictionary->term_count || termOf(*dictionary, index) != term) return nullptr;
+        return at<SegmentTermEntry>(dictionary->entries_offset) + index;
+    }
+
+    CompressedView viewOf(const SegmentTermEntry& entry) const {
+        CompressedView view;
+        view.block_last = at<int>(entry.postings_offset);
+        view.block_offset = reinterpret_cast<const uint32_t*>(view.block_last + entry.packed_blocks);
+        view.tail = reinterpret_cast<const int*>(view.block_offset + entry.packed_blocks);
+        view.data = reinterpret_cast<const uint32_t*>(view.tail + entry.tail_size);
+        view.block_width = reinterpret_cast<const uint8_t*>(view.data + entry.data_words);
+        view.packed_blocks = entry.packed_blocks;
+        view.last_block_size = static_cast<int>(entry.last_block_size);
+        view.tail_size = entry.tail_size;
+        view.count = entry.count;
+        return view;
+    }
+
+    DocStoreView docStoreAt(uint64_t store_offset) const {
+        const SegmentDocStore* store = at<SegmentDocStore>(store_offset);
+        DocStoreView view;
+        view.presence = at<uint64_t>(store->presence_offset);
+        view.doc_offsets = at<uint64_t>(store->doc_offsets_offset);
+        view.doc_count = store->doc_count;
+        view.block_starts = at<uint64_t>(store->block_starts_offset);
+        view.block_offsets = at<uint64_t>(store->block_offsets_offset);
+        view.block_count = store->block_count;
+        view.compressed = at<char>(store->compressed_offset);
+        view.tail = at<char>(store->tail_offset);
+        view.tail_start = store->tail_start;
+        return view;
+    }
+};
+
+#endif
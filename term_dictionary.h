@@ -0,0 +1,92 @@
+#ifndef TERM_DICTIONARY_H
+#define TERM_DICTIONARY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// сравнение термов с конца - порядок перевернутых строк без их построения (подстановки "*suffix")
+inline bool reversedTermLess(string_view a, string_view b) {
+    return lexicographical_compare(a.rbegin(), a.rend(), b.rbegin(), b.rend());
+}
+
+// Словарь термов части индекса: каждый терм хранится один раз и получает плотный номер term_id,
+// по которому адресуются все списки части (общий индекс и индексы полей).
+// Для подстановок prefix* и *suffix держим term_id, упорядоченные по терму и по перевернутому терму:
+// нужные термы лежат в них одним непрерывным диапазоном, который находится двоичным поиском
+class TermDictionary {
+public:
+    static constexpr uint32_t NO_TERM = UINT32_MAX;
+
+private:
+    deque<string> terms;                      // term_id -> терм (deque не переносит строки при росте)
+    unordered_map<string_view, uint32_t> ids; // ключи указывают на строки в terms
+    // порядки для подстановок; перестраиваются, когда словарь вырос (см. prepareWildcards)
+    mutable vector<uint32_t> sorted_ids;
+    mutable vector<uint32_t> reversed_ids;
+
+    static bool endsWith(string_view term, string_view suffix) {
+        return term.size() >= suffix.size() && term.substr(term.size() - suffix.size()) == suffix;
+    }
+
+public:
+    size_t size() const { return terms.size(); }
+    const string& term(uint32_t id) const { return terms[id]; }
+
+    // term_id терма, новый терм добавляется в конец словаря
+    uint32_t intern(const string& term) {
+        auto it = ids.find(term);
+        if (it != ids.end()) return it->second;
+        uint32_t id = static_cast<uint32_t>(terms.size());
+        terms.push_back(term);
+        ids.emplace(terms.back(), id);
+        return id;
+    }
+
+    uint32_t find(string_view term) const {
+        auto it = ids.find(term);
+        return it != ids.end() ? it->second : NO_TERM;
+    }
+
+    // упорядочить словарь для подстановок. Часть, которую читают из нескольких потоков, готовится
+    // заранее (при публикации), иначе порядок строится при первой подстановке после роста словаря
+    void prepareWildcards() const {
+        if (sorted_ids.size() == terms.size()) return;
+        sorted_ids.resize(terms.size());
+        for (uint32_t id = 0; id < terms.size(); ++id) sorted_ids[id] = id;
+        reversed_ids = sorted_ids;
+        sort(sorted_ids.begin(), sorted_ids.end(), [this](uint32_t a, uint32_t b) { return terms[a] < terms[b]; });
+        sort(reversed_ids.begin(), reversed_ids.end(), [this](uint32_t a, uint32_t b) {
+            return reversedTermLess(terms[a], terms[b]);
+        });
+    }
+
+    // term_id термов, подходящих под "prefix*" или "*suffix"
+    void expand(const string& pattern, vector<uint32_t>& out) const {
+        if (pattern.size() < 2) return;
+        prepareWildcards();
+        if (pattern.back() == '*') {
+            string_view prefix(pattern.data(), pattern.size() - 1);
+            auto it = lower_bound(sorted_ids.begin(), sorted_ids.end(), prefix,
+                                  [this](uint32_t id, string_view value) { return terms[id] < value; });
+            for (; it != sorted_ids.end() && string_view(terms[*it]).substr(0, prefix.size()) == prefix; ++it) {
+                out.push_back(*it);
+            }
+        } else if (pattern.front() == '*') {
+            string_view suffix(pattern.data() + 1, pattern.size() - 1);
+            auto it = lower_bound(reversed_ids.begin(), reversed_ids.end(), suffix,
+                                  [this](uint32_t id, string_view value) { return reversedTermLess(terms[id], value); });
+            for (; it != reversed_ids.end() && endsWith(terms[*it], suffix); ++it) {
+                out.push_back(*it);
+            }
+        }
+    }
+};
+
+#endif
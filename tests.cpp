@@ -0,0 +1,900 @@
+// Проверки индекса без внешних библиотек: кодеки, разбор CSV, дифференциальная проверка запросов против наивного
+// вычисления по текстам доков (удаления, исправления, уплотнение, слияния, сегменты), испорченные сегменты,
+// изоляция снимков, очередь конвейера и параллельные читатели с писателем.
+// Код возврата - число проваленных проверок (0 - все прошли). Запуск - make test;
+// гонки ищутся той же программой под ThreadSanitizer - make test_tsan
+#include "search_class.h"
+#include "csv_reader.h"
+#include "bounded_queue.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <map>
+
+using namespace std;
+
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool passed, const char* expression, const char* file, int line, const string& context = "") {
+    if (passed) return;
+    failures++;
+    cerr << file << ":" << line << ": failed " << expression;
+    if (!context.empty()) cerr << " [" << context << "]";
+    cerr << endl;
+}
+
+// ---------------------------------------------------------------- кодеки
+
+void testCompressedPostings() {
+    mt19937 rng(1);
+    for (size_t size : {0, 1, 2, 127, 128, 129, 255, 256, 1000, 5000}) {
+        for (int max_gap : {1, 3, 1000, 1 << 18}) {
+            vector<int> list;
+            int doc_id = 0;
+            for (size_t i = 0; i < size; ++i) {
+                doc_id += 1 + static_cast<int>(rng() % max_gap);
+                list.push_back(doc_id);
+            }
+            string context = "size " + to_string(size) + " gap " + to_string(max_gap);
+            CompressedPostings encoded = CompressedPostings::encode(list);
+            check(encoded.size() == list.size(), "encoded size", __FILE__, __LINE__, context);
+            check(encoded.decodeAll() == list, "decodeAll round-trip", __FILE__, __LINE__, context);
+
+            // дописанный по одному и не запечатанный список читается так же
+            CompressedPostings appended;
+            for (int id : list) appended.push_back(id);
+            check(appended.decodeAll() == list, "push_back round-trip", __FILE__, __LINE__, context);
+
+            // переходы курсора совпадают с lower_bound
+            CompressedCursor cursor(encoded.view());
+            size_t expected = 0;
+            while (!cursor.atEnd()) {
+                int target = cursor.docId() + 1 + static_cast<int>(rng() % (3 * max_gap));
+                cursor.advance(target);
+                expected = lower_bound(list.begin(), list.end(), target) - list.begin();
+                if (expected == list.size()) break;
+                if (cursor.atEnd() || cursor.docId() != list[expected] || cursor.index() != expected) {
+                    check(false, "advance == lower_bound", __FILE__, __LINE__, context);
+                    break;
+                }
+            }
+            check(expected == list.size() ? cursor.atEnd() : true, "cursor at end", __FILE__, __LINE__, context);
+        }
+    }
+}
+
+void testPositionCodec() {
+    mt19937 rng(2);
+    for (bool compress : {false, true}) {
+        PositionalPostings list;
+        list.doc_ids.is_compressed = compress;
+        vector<vector<int>> expected;
+        for (int doc_id = 1; doc_id <= 700; ++doc_id) {
+            vector<int> positions;
+            int position = static_cast<int>(rng() % 50);
+            for (size_t count = 1 + rng() % 6; count > 0; --count) {
+                positions.push_back(position);
+                position += 1 + static_cast<int>(rng() % (rng() % 2 ? 3 : 100000));
+            }
+            list.append(doc_id, positions, fieldBit(doc_id % 3));
+            expected.push_back(positions);
+        }
+        vector<int> buffer;
+        PositionsRef ref = list.ref();
+        for (size_t i = 0; i < expected.size(); ++i) {
+            PositionSpan span = list.positionsOf(i, buffer);
+            bool same = span.size == expected[i].size() && equal(span.data, span.data + span.size, expected[i].begin());
+            check(same, "positions round-trip", __FILE__, __LINE__, (compress ? "compressed doc " : "doc ") + to_string(i));
+            check(ref.frequency(i, static_cast<int>(i) + 1, buffer) == expected[i].size(), "frequency", __FILE__, __LINE__);
+        }
+        for (uint32_t field = 0; field < 3; ++field) CHECK(list.fieldCount(field) == (field == 1 ? 234u : 233u));
+    }
+}
+
+void testDocStore() {
+    mt19937 rng(3);
+    // отдельный блок: повторы (в том числе перекрывающиеся), случайные байты, пустой вход
+    for (size_t size : {0, 1, 4, 100, 5000, 70000}) {
+        for (int alphabet : {1, 4, 256}) {
+            string raw(size, '\0');
+            for (char& c : raw) c = static_cast<char>(rng() % alphabet);
+            string packed;
+            compressBlock(raw, packed);
+            string restored(size, '\0');
+            bool decoded = decompressBlock(packed.data(), packed.size(), &restored[0], size, size);
+            check(decoded && restored == raw, "LZ77 block round-trip", __FILE__, __LINE__,
+                  "size " + to_string(size) + " alphabet " + to_string(alphabet));
+        }
+    }
+
+    // хранилище: доки без текста, пустые тексты, замена последней записи, несколько сжатых блоков
+    DocStore store;
+    vector<pair<bool, string>> expected;
+    for (size_t i = 0; i < 3000; ++i) {
+        if (rng() % 7 == 0) {
+            expected.push_back({false, ""});
+            continue;
+        }
+        string text;
+        for (size_t words = rng() % 40; words > 0; --words) text += "word" + to_string(rng() % 50) + ' ';
+        if (rng() % 5 == 0) {
+            store.set(i, "replaced");
+        }
+        store.set(i, text);
+        expected.push_back({true, text});
+    }
+    DocStoreView view = store.view();
+    string buffer;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        string_view text;
+        bool found = view.text(i, buffer, text);
+        check(found == expected[i].first && (!found || text == expected[i].second), "doc store text", __FILE__, __LINE__,
+              "doc " + to_string(i));
+    }
+    size_t visited = 0;
+    view.forEach([&](size_t i, string_view text) {
+        visited++;
+        check(expected[i].first && text == expected[i].second, "doc store forEach", __FILE__, __LINE__, "doc " + to_string(i));
+    });
+    CHECK(visited == static_cast<size_t>(count_if(expected.begin(), expected.end(), [](const auto& e) { return e.first; })));
+}
+
+// ---------------------------------------------------------------- CSV
+
+vector<vector<string>> parseCsv(string data) {
+    CsvReader reader(&data[0], data.size());
+    vector<vector<string>> records;
+    vector<string_view> fields;
+    while (reader.next(fields)) records.emplace_back(fields.begin(), fields.end());
+    return records;
+}
+
+void testCsvReader() {
+    using Records = vector<vector<string>>;
+    CHECK(parseCsv("a,b\r\n\r\nc,d") == Records({{"a", "b"}, {"c", "d"}}));
+    CHECK(parseCsv("\xEF\xBB\xBFtitle,content\n") == Records({{"title", "content"}}));
+    CHECK(parseCsv("  a b ,\tc\t\n") == Records({{"a b", "c"}}));
+    CHECK(parseCsv("\"a, \"\"b\"\"\nc\",d\n") == Records({{"a, \"b\"\nc", "d"}}));
+    CHECK(parseCsv(",\"\",x") == Records({{"", "", "x"}}));
+    // текст после закрывающей кавычки остается как есть, пробелы в конце поля отбрасываются
+    CHECK(parseCsv("a,\"b\" c,d\n") == Records({{"a", "b c", "d"}}));
+    CHECK(parseCsv("\"b\"  c d \r\n") == Records({{"b  c d"}}));
+    CHECK(parseCsv("\"b\"  ,c") == Records({{"b", "c"}}));
+    // незакрытая кавычка продолжает поле до конца данных
+    CHECK(parseCsv("a,\"b,c\nd") == Records({{"a", "b,c\nd"}}));
+}
+
+// ---------------------------------------------------------------- наивное вычисление запросов
+
+using Document = vector<pair<string, string>>;
+
+// док модели: позиции термов нумеруются сквозь поля по порядку, как в индексе
+struct ModelDocument {
+    unordered_map<string, vector<int>> positions;
+    // поле -> диапазоны позиций [start, end)
+    unordered_map<string, vector<pair<int, int>>> fields;
+};
+
+class NaiveIndex {
+private:
+    map<int, ModelDocument> documents;
+
+    static vector<int> termPositions(const ModelDocument& document, const string& term, const string& field) {
+        auto it = document.positions.find(term);
+        if (it == document.positions.end()) return {};
+        if (field.empty()) return it->second;
+        vector<int> result;
+        auto ranges = document.fields.find(field);
+        if (ranges == document.fields.end()) return {};
+        for (int position : it->second) {
+            for (auto [start, end] : ranges->second) {
+                if (position >= start && position < end) result.push_back(position);
+            }
+        }
+        return result;
+    }
+
+    static bool matchesWildcard(const string& term, const string& pattern) {
+        if (pattern.back() == '*') return term.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0;
+        size_t stem = pattern.size() - 1;
+        return term.size() >= stem && term.compare(term.size() - stem, stem, pattern, 1, stem) == 0;
+    }
+
+    // NEAR: окно шириной не больше distance с позицией каждого терма (левый край окна - чья-то позиция)
+    static bool hasWindow(const vector<vector<int>>& lists, int distance) {
+        for (const auto& candidates : lists) {
+            for (int left : candidates) {
+                bool found = all_of(lists.begin(), lists.end(), [&](const vector<int>& positions) {
+                    return any_of(positions.begin(), positions.end(), [&](int p) { return p >= left && p <= left + distance; });
+                });
+                if (found) return true;
+            }
+        }
+        return false;
+    }
+
+    // ADJ: позиции термов строго по порядку, от первой до последней не больше distance
+    // (для каждого начала ближайшая следующая позиция дает наименьший конец)
+    static bool hasOrderedWindow(const vector<vector<int>>& lists, int distance) {
+        for (int start : lists[0]) {
+            int last = start;
+            bool found = true;
+            for (size_t t = 1; t < lists.size() && found; ++t) {
+                auto next = upper_bound(lists[t].begin(), lists[t].end(), last);
+                found = next != lists[t].end();
+                if (found) last = *next;
+            }
+            if (found && last - start <= distance) return true;
+        }
+        return false;
+    }
+
+    bool matches(const ModelDocument& document, const shared_ptr<ASTNode>& node) const {
+        switch (node->type) {
+            case OperatorType::TERM:
+                return !termPositions(document, normalizeTerm(node->value), node->field).empty();
+            case OperatorType::WILDCARD:
+                for (const auto& [term, positions] : document.positions) {
+                    if (matchesWildcard(term, node->value) && !termPositions(document, term, node->field).empty()) return true;
+                }
+                return false;
+            case OperatorType::AND:
+                return matches(document, node->left) && matches(document, node->right);
+            case OperatorType::OR:
+                return matches(document, node->left) || matches(document, node->right);
+            case OperatorType::NOT:
+                return !matches(document, node->left);
+            case OperatorType::PHRASE: {
+                auto first = termPositions(document, normalizeTerm(node->children[0]->value), node->field);
+                for (int start : first) {
+                    bool found = true;
+                    for (const auto& term : node->children) {
+                        auto positions = termPositions(document, normalizeTerm(term->value), node->field);
+                        found = found && find(positions.begin(), positions.end(), start + term->distance) != positions.end();
+                    }
+                    if (found) return true;
+                }
+                return false;
+            }
+            default: {
+                vector<vector<int>> lists;
+                for (const auto& operand : proximityOperands(node)) {
+                    lists.push_back(termPositions(document, normalizeTerm(operand->value), operand->field));
+                    if (lists.back().empty()) return false;
+                }
+                return node->type == OperatorType::ADJ ? hasOrderedWindow(lists, node->distance) : hasWindow(lists, node->distance);
+            }
+        }
+    }
+
+public:
+    void add(int doc_id, const Document& document) {
+        ModelDocument& model = documents[doc_id];
+        int position = 0;
+        for (const auto& [field, text] : document) {
+            int start = position;
+            for (string_view token : tokenize(text)) {
+                string term = normalizeTerm(token);
+                if (!term.empty()) model.positions[term].push_back(position);
+                position++;
+            }
+            model.fields[field].push_back({start, position});
+        }
+    }
+
+    void remove(int doc_id) { documents.erase(doc_id); }
+
+    vector<int> query(const string& query) const {
+        auto ast = QueryParser(query).parse();
+        vector<int> result;
+        if (!ast) return result;
+        for (const auto& [doc_id, document] : documents) {
+            if (matches(document, ast)) result.push_back(doc_id);
+        }
+        return result;
+    }
+};
+
+// словарь w0..w19 с перекосом частот, чтобы у запросов были и пустые, и длинные результаты
+string randomWord(mt19937& rng) {
+    int rank = static_cast<int>(rng() % 20);
+    if (rng() % 2) rank /= 4;
+    return "w" + to_string(rank);
+}
+
+string randomText(mt19937& rng, int min_words, int max_words) {
+    string text;
+    for (int words = min_words + static_cast<int>(rng() % (max_words - min_words + 1)); words > 0; --words) {
+        if (!text.empty()) text += rng() % 10 ? " " : ", ";
+        text += randomWord(rng);
+        if (rng() % 25 == 0) text[0] = 'W';
+    }
+    return text;
+}
+
+// поля в разном порядке, иногда без заголовка, иногда с полем tags
+Document randomDocument(mt19937& rng) {
+    Document document;
+    if (rng() % 5) document.push_back({"title", randomText(rng, 1, 5)});
+    document.push_back({"content", randomText(rng, 3, 25)});
+    if (rng() % 4 == 0) document.push_back({"tags", randomText(rng, 1, 3)});
+    if (rng() % 3 == 0) swap(document.front(), document.back());
+    return document;
+}
+
+string randomOperand(mt19937& rng) {
+    static const char* const fields[] = {"", "", "title:", "content:", "tags:"};
+    return fields[rng() % 5] + randomWord(rng);
+}
+
+string randomAtom(mt19937& rng) {
+    switch (rng() % 8) {
+        case 0: return randomOperand(rng) + " NEAR/" + to_string(rng() % 5) + " " + randomOperand(rng);
+        case 1: return randomOperand(rng) + " ADJ/" + to_string(1 + rng() % 3) + " " + randomOperand(rng);
+        case 2: {
+            string op = "NEAR/" + to_string(2 + rng() % 6);
+            return randomWord(rng) + " " + op + " " + randomWord(rng) + " " + op + " " + randomWord(rng);
+        }
+        case 3: return string(rng() % 2 ? "" : "title:") + "\"" + randomWord(rng) + " " + randomWord(rng) + "\"";
+        case 4: return "\"" + randomWord(rng) + " " + randomWord(rng) + " " + randomWord(rng) + "\"";
+        case 5: return string(rng() % 2 ? "content:" : "") + (rng() % 2 ? "w1*" : "*" + to_string(rng() % 10));
+        default: return randomOperand(rng);
+    }
+}
+
+string randomQuery(mt19937& rng) {
+    string left = randomAtom(rng), right = randomAtom(rng);
+    switch (rng() % 7) {
+        case 0: return left;
+        case 1: return left + " AND " + right;
+        case 2: return left + " OR " + right;
+        case 3: return left + " AND NOT " + right;
+        case 4: return "NOT " + left;
+        case 5: return "(" + left + " OR " + right + ") AND " + randomAtom(rng);
+        default: return left + " " + right + " OR " + randomAtom(rng);
+    }
+}
+
+// результаты писателя и опубликованного снимка против модели; ранжирование - подмножество результата
+void compareQueries(TextIndexer& indexer, const NaiveIndex& model, const vector<string>& queries, const string& scenario,
+                    bool check_snapshot = true) {
+    auto snapshot = indexer.snapshot();
+    for (const string& query : queries) {
+        vector<int> expected = model.query(query);
+        string context = scenario + ": " + query;
+        vector<int> found = indexer.executeQuery(query);
+        check(found == expected, "writer results == naive", __FILE__, __LINE__,
+              context + " (" + to_string(found.size()) + " vs " + to_string(expected.size()) + ")");
+        if (check_snapshot) {
+            check(snapshot->executeQuery(query) == expected, "snapshot results == naive", __FILE__, __LINE__, context);
+            check(snapshot->countQuery(query) == expected.size(), "countQuery", __FILE__, __LINE__, context);
+        }
+
+        auto ranked = indexer.executeQuery(query, 10);
+        bool subset = ranked.size() <= expected.size();
+        for (size_t i = 0; i < ranked.size(); ++i) {
+            subset = subset && binary_search(expected.begin(), expected.end(), ranked[i].doc_id);
+            subset = subset && (i == 0 || ranked[i - 1].score >= ranked[i].score);
+        }
+        check(subset, "ranked results are matches by descending score", __FILE__, __LINE__, context);
+    }
+}
+
+void testQueriesAgainstNaive() {
+    mt19937 rng(4);
+    vector<string> queries;
+    for (int i = 0; i < 300; ++i) queries.push_back(randomQuery(rng));
+    for (string query : {"title:w1 ADJ/1 content:w0", "content:w3 NEAR/2 title:w2", "tags:w1", "w0 ADJ/1 w0",
+                         "\"w0 w0\"", "nofield:w1", "w99", "NOT w0", "w1* AND NOT *0"}) {
+        queries.push_back(query);
+    }
+
+    for (bool compress : {false, true}) {
+        string mode = compress ? "compressed " : "";
+        vector<Document> documents;
+        for (int i = 0; i < 600; ++i) documents.push_back(randomDocument(rng));
+
+        // последовательная загрузка: писатель до публикации, затем снимок
+        {
+            TextIndexer indexer(compress);
+            NaiveIndex model;
+            for (const auto& document : documents) model.add(indexer.addDocument(document), document);
+            compareQueries(indexer, model, queries, mode + "unpublished", false);
+            indexer.publish();
+            compareQueries(indexer, model, queries, mode + "published");
+        }
+
+        // параллельная пакетная загрузка, удаления, исправления, уплотнение, сегмент
+        TextIndexer indexer(compress);
+        NaiveIndex model;
+        indexer.beginBulkLoad();
+        vector<int> doc_ids = indexer.addDocuments(documents, 4);
+        indexer.commit();
+        for (size_t i = 0; i < documents.size(); ++i) model.add(doc_ids[i], documents[i]);
+        compareQueries(indexer, model, queries, mode + "bulk");
+
+        for (size_t i = 0; i < doc_ids.size(); i += 5) {
+            CHECK(indexer.deleteDocument(doc_ids[i]));
+            model.remove(doc_ids[i]);
+        }
+        CHECK(!indexer.deleteDocument(doc_ids[0]));
+        for (size_t i = 2; i < doc_ids.size(); i += 9) {
+            if (i % 5 == 0) {
+                CHECK(indexer.updateDocument(doc_ids[i], randomDocument(rng)) == -1);
+                continue;
+            }
+            Document document = randomDocument(rng);
+            int doc_id = indexer.updateDocument(doc_ids[i], document);
+            CHECK(doc_id > doc_ids.back());
+            model.remove(doc_ids[i]);
+            model.add(doc_id, document);
+        }
+        compareQueries(indexer, model, queries, mode + "deletes and updates", false);
+        indexer.publish();
+        compareQueries(indexer, model, queries, mode + "deletes and updates published");
+        CHECK(indexer.compact() > 0);
+        compareQueries(indexer, model, queries, mode + "compacted");
+
+        string path = "tests_segment.seg";
+        CHECK(indexer.saveSegment(path));
+        TextIndexer loaded(compress);
+        CHECK(loaded.loadSegment(path));
+        compareQueries(loaded, model, queries, mode + "segment");
+        remove(path.c_str());
+    }
+}
+
+// несколько частей: маленький порог запечатывания и фоновые слияния по ярусам
+void testMergedParts() {
+    mt19937 rng(5);
+    vector<string> queries;
+    for (int i = 0; i < 150; ++i) queries.push_back(randomQuery(rng));
+    for (bool compress : {false, true}) {
+        TextIndexer indexer(compress);
+        indexer.setMergePolicy(16, 2);
+        NaiveIndex model;
+        for (int i = 0; i < 300; ++i) {
+            Document document = randomDocument(rng);
+            model.add(indexer.addDocument(document), document);
+            if (i % 37 == 0) {
+                CHECK(indexer.deleteDocument(i / 2 + 1));
+                model.remove(i / 2 + 1);
+            }
+        }
+        indexer.publish();
+        compareQueries(indexer, model, queries, compress ? "compressed parts" : "parts");
+        indexer.waitForMerges();
+        compareQueries(indexer, model, queries, compress ? "compressed merged parts" : "merged parts");
+    }
+}
+
+// доки с полями f0..f13 в случайном порядке: у каждой части свои номера полей, поэтому при слиянии
+// поле, у которого в одной части нет бита в маске, в другой его получает
+Document manyFieldsDocument(mt19937& rng) {
+    Document document;
+    for (int field = 0; field < 14; ++field) {
+        if (rng() % 3 == 0) document.push_back({"f" + to_string(field), randomText(rng, 1, 4)});
+    }
+    if (document.empty()) document.push_back({"f13", randomText(rng, 1, 4)});
+    shuffle(document.begin(), document.end(), rng);
+    return document;
+}
+
+// полей больше MAX_FIELDS: первые отбираются по маскам, остальные - по позициям
+void testManyFields() {
+    mt19937 rng(8);
+    auto randomField = [&] { return "f" + to_string(rng() % 14) + ":"; };
+    vector<string> queries;
+    for (int i = 0; i < 200; ++i) {
+        switch (rng() % 5) {
+            case 0: queries.push_back(randomField() + randomWord(rng)); break;
+            case 1: queries.push_back(randomField() + "\"" + randomWord(rng) + " " + randomWord(rng) + "\""); break;
+            case 2: queries.push_back(randomField() + randomWord(rng) + " NEAR/3 " + randomField() + randomWord(rng)); break;
+            case 3: queries.push_back(randomField() + "w1* AND NOT " + randomField() + randomWord(rng)); break;
+            default: queries.push_back(randomField() + randomWord(rng) + " OR " + randomField() + randomWord(rng)); break;
+        }
+    }
+    for (bool compress : {false, true}) {
+        string mode = compress ? "compressed " : "";
+        TextIndexer indexer(compress);
+        indexer.setMergePolicy(16, 2);
+        NaiveIndex model;
+        vector<int> doc_ids;
+        for (int i = 0; i < 300; ++i) {
+            Document document = manyFieldsDocument(rng);
+            doc_ids.push_back(indexer.addDocument(document));
+            model.add(doc_ids.back(), document);
+        }
+        compareQueries(indexer, model, queries, mode + "many fields", false);
+        indexer.publish();
+        indexer.waitForMerges();
+        compareQueries(indexer, model, queries, mode + "many fields merged");
+        for (size_t i = 0; i < doc_ids.size(); i += 4) {
+            CHECK(indexer.deleteDocument(doc_ids[i]));
+            model.remove(doc_ids[i]);
+        }
+        indexer.publish();
+        CHECK(indexer.compact() > 0);
+        compareQueries(indexer, model, queries, mode + "many fields compacted");
+
+        string path = "tests_fields.seg";
+        CHECK(indexer.saveSegment(path));
+        TextIndexer loaded(compress);
+        CHECK(loaded.loadSegment(path));
+        compareQueries(loaded, model, queries, mode + "many fields segment");
+        remove(path.c_str());
+    }
+}
+
+// обрезанный или испорченный сегмент не открывается (индекс тогда строится заново), целый - открывается
+void testCorruptedSegment() {
+    mt19937 rng(7);
+    TextIndexer indexer(true);
+    for (int i = 0; i < 400; ++i) indexer.addDocument(randomDocument(rng));
+    string path = "tests_corrupted.seg";
+    CHECK(indexer.saveSegment(path));
+    string original;
+    {
+        ifstream file(path, ios::binary);
+        original.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    auto opens = [&](const string& bytes) {
+        ofstream(path, ios::binary | ios::trunc).write(bytes.data(), bytes.size());
+        MappedSegment segment;
+        return segment.open(path);
+    };
+    auto withHeaderField = [&](string bytes, size_t field_offset, uint64_t value) {
+        memcpy(&bytes[field_offset], &value, sizeof(value));
+        return bytes;
+    };
+    CHECK(opens(original));
+
+    // обрезанный файл с подправленным размером в заголовке: секции выходят за конец
+    for (size_t size : {sizeof(SegmentHeader), original.size() / 4, original.size() / 2, original.size() - 8}) {
+        string truncated = withHeaderField(original.substr(0, size), offsetof(SegmentHeader, file_size), size);
+        check(!opens(truncated), "truncated segment rejected", __FILE__, __LINE__, to_string(size));
+    }
+
+    // смещения и размеры секций в заголовке за концом файла
+    for (size_t field : {offsetof(SegmentHeader, dictionary_offset), offsetof(SegmentHeader, field_count),
+                         offsetof(SegmentHeader, field_names_offset), offsetof(SegmentHeader, field_doc_offsets_offset),
+                         offsetof(SegmentHeader, field_ranges_offset), offsetof(SegmentHeader, docs_offset),
+                         offsetof(SegmentHeader, docs_words), offsetof(SegmentHeader, lengths_offset),
+                         offsetof(SegmentHeader, titles_offset), offsetof(SegmentHeader, contents_offset)}) {
+        for (uint64_t value : {uint64_t(original.size()), uint64_t(original.size()) - 4, UINT64_MAX}) {
+            check(!opens(withHeaderField(original, field, value)), "bad header field rejected", __FILE__, __LINE__,
+                  to_string(field) + " = " + to_string(value));
+        }
+    }
+    CHECK(!opens(withHeaderField(original, offsetof(SegmentHeader, next_doc_id), 0)));
+
+    // словарь и списки термов: число термов, смещения массивов, список одного терма
+    SegmentHeader header;
+    memcpy(&header, original.data(), sizeof(header));
+    for (size_t field : {offsetof(SegmentDictionary, term_count), offsetof(SegmentDictionary, term_offsets_offset),
+                         offsetof(SegmentDictionary, reversed_order_offset), offsetof(SegmentDictionary, entries_offset)}) {
+        check(!opens(withHeaderField(original, header.dictionary_offset + field, original.size())), "bad dictionary rejected",
+              __FILE__, __LINE__, to_string(field));
+    }
+    SegmentDictionary dictionary;
+    memcpy(&dictionary, original.data() + header.dictionary_offset, sizeof(dictionary));
+    size_t entry = dictionary.entries_offset + (dictionary.term_count / 2) * sizeof(SegmentTermEntry);
+    for (size_t field : {offsetof(SegmentTermEntry, postings_offset), offsetof(SegmentTermEntry, positions_offset),
+                         offsetof(SegmentTermEntry, scores_offset), offsetof(SegmentTermEntry, field_masks_offset)}) {
+        check(!opens(withHeaderField(original, entry + field, (original.size() + 8) & ~size_t(7))), "bad term entry rejected",
+              __FILE__, __LINE__, to_string(field));
+    }
+    string bad_count = original;
+    uint32_t count = UINT32_MAX;
+    memcpy(&bad_count[entry + offsetof(SegmentTermEntry, count)], &count, sizeof(count));
+    CHECK(!opens(bad_count));
+
+    // словарь не по порядку: первый терм становится больше всех, или соседние термы меняются местами
+    // в перевернутом порядке - двоичный поиск по такому словарю находил бы не те термы
+    vector<uint32_t> term_offsets(dictionary.term_count + 1);
+    memcpy(term_offsets.data(), original.data() + dictionary.term_offsets_offset, term_offsets.size() * sizeof(uint32_t));
+    string unsorted = original;
+    fill_n(&unsorted[dictionary.term_bytes_offset], term_offsets[1], '\xff');
+    CHECK(!opens(unsorted));
+    string bad_order = original;
+    swap_ranges(&bad_order[dictionary.reversed_order_offset], &bad_order[dictionary.reversed_order_offset + 4],
+                &bad_order[dictionary.reversed_order_offset + 4]);
+    CHECK(!opens(bad_order));
+
+    // диапазон поля с номером за пределами полей сегмента
+    string bad_range = original;
+    uint32_t field = static_cast<uint32_t>(header.field_count);
+    memcpy(&bad_range[header.field_ranges_offset + offsetof(FieldRange, field)], &field, sizeof(field));
+    CHECK(!opens(bad_range));
+
+    // позиции терма из одних байтов продолжения: сегмент открывается (разметка цела), а разбор позиций
+    // останавливается на конце позиций дока и не читает соседние данные
+    SegmentTermEntry term_entry;
+    memcpy(&term_entry, original.data() + entry, sizeof(term_entry));
+    uint32_t position_bytes;
+    memcpy(&position_bytes, original.data() + term_entry.positions_offset + term_entry.count * sizeof(uint32_t),
+           sizeof(position_bytes));
+    string bad_positions = original;
+    fill_n(&bad_positions[term_entry.positions_offset + (term_entry.count + 1) * sizeof(uint32_t)], position_bytes, '\xff');
+    CHECK(opens(bad_positions));
+    {
+        MappedSegment segment;
+        CHECK(segment.open(path));
+        size_t term_index = (entry - dictionary.entries_offset) / sizeof(SegmentTermEntry);
+        string term = original.substr(dictionary.term_bytes_offset + term_offsets[term_index],
+                                      term_offsets[term_index + 1] - term_offsets[term_index]);
+        PositionsRef positions;
+        CHECK(segment.positions(term, "", positions));
+        vector<int> buffer;
+        size_t decoded = 0;
+        for (size_t i = 0; i < term_entry.count; ++i) decoded += positions.allPositions(i, buffer).size;
+        // каждые 5 байт продолжения читаются как одно число
+        CHECK(decoded <= position_bytes && decoded >= position_bytes / 5);
+    }
+    const uint8_t unterminated[] = {0x81, 0x82};
+    const uint8_t* in = unterminated;
+    CHECK(readVarint(in, unterminated + 2) == (1 | 2 << 7) && in == unterminated + 2);
+
+    // хранилище текстов: смещение сжатых блоков
+    CHECK(!opens(withHeaderField(original, header.contents_offset + offsetof(SegmentDocStore, compressed_offset),
+                                 original.size())));
+
+    TextIndexer rebuilt;
+    CHECK(opens(original) && rebuilt.loadSegment(path));
+    CHECK(rebuilt.documentCount() == 400);
+    remove(path.c_str());
+}
+
+// широкий OR: курсор на куче против объединения списков; в индексе редкие списки идут через кучу,
+// плотные - через битовую карту
+void testWideDisjunction() {
+    mt19937 rng(6);
+    for (int round = 0; round < 50; ++round) {
+        vector<vector<int>> lists(17 + rng() % 20);
+        vector<int> merged;
+        for (auto& list : lists) {
+            int doc_id = -1;
+            for (size_t i = rng() % 40; i > 0; --i) list.push_back(doc_id += 1 + static_cast<int>(rng() % 300));
+            merged.insert(merged.end(), list.begin(), list.end());
+        }
+        sort(merged.begin(), merged.end());
+        merged.erase(unique(merged.begin(), merged.end()), merged.end());
+        vector<PostingIterator> operands;
+        for (const auto& list : lists) operands.emplace_back(PostingRef{&list, nullptr});
+        HeapDisjunctionCursor<PostingIterator> cursor(move(operands));
+        size_t expected = 0;
+        while (expected < merged.size() && !cursor.atEnd() && cursor.docId() == merged[expected]) {
+            if (rng() % 2) {
+                cursor.next();
+                expected++;
+            } else {
+                int target = cursor.docId() + static_cast<int>(rng() % 500);
+                cursor.advance(target);
+                expected = lower_bound(merged.begin(), merged.end(), target) - merged.begin();
+            }
+        }
+        check(expected == merged.size() && cursor.atEnd(), "heap cursor == merged lists", __FILE__, __LINE__,
+              "round " + to_string(round));
+    }
+
+    TextIndexer indexer;
+    vector<int> all, rare;
+    for (int i = 0; i < 3000; ++i) {
+        string content = "filler t" + to_string(i % 20);
+        if (i % 150 == 0) content += " zq" + to_string(i / 150);
+        all.push_back(indexer.addDocument({{"title", "x"}, {"content", content}}));
+        if (i % 150 == 0) rare.push_back(all.back());
+    }
+    indexer.publish();
+    CHECK(indexer.profileQuery("zq*").explain().find("[heap of 20 lists]") != string::npos);
+    CHECK(indexer.profileQuery("t*").explain().find("[bitmap of 20 lists]") != string::npos);
+    CHECK(indexer.executeQuery("zq*") == rare);
+    CHECK(indexer.executeQueryPage("zq* AND filler", 5, 3) == vector<int>(rare.begin() + 5, rare.begin() + 8));
+    CHECK(indexer.executeQuery("t* AND filler") == all);
+}
+
+// узел профиля по имени оператора (первый при обходе в глубину)
+const QueryProfileNode* findOperator(const QueryProfileNode& node, const string& operation) {
+    if (node.operation == operation) return &node;
+    for (const auto& child : node.children) {
+        if (const QueryProfileNode* found = findOperator(*child, operation)) return found;
+    }
+    return nullptr;
+}
+
+// страница запроса с NOT/NEAR при промахе кэша читает поддерево только до конца страницы;
+// в кэш попадает поддерево, пройденное целиком, или ключ, промахнувшийся повторно
+void testLazySubtreeCache() {
+    TextIndexer indexer;
+    for (int i = 0; i < 2000; ++i) indexer.addDocument({{"title", "x"}, {"content", i % 10 ? "a b c" : "a c"}});
+    indexer.publish();
+    vector<const IndexReader*> parts = indexer.snapshot()->readers();
+
+    for (auto [query, operation] : {pair<string, string>("a NEAR/1 b", "NEAR"), pair<string, string>("NOT b", "NOT")}) {
+        QueryCache cache;
+        // выход узла оператора на странице из 5 доков после первых 3 и его пометка о кэше
+        auto runPage = [&] {
+            QueryProfileNode root;
+            queryResultsPage(QueryParser(query).parse(), parts, 3, 5, &cache, nullptr, &root);
+            const QueryProfileNode* node = findOperator(root, operation);
+            return node ? make_pair(node->output, node->detail) : make_pair(uint64_t(0), string());
+        };
+        auto [output, detail] = runPage();
+        check(output == 8 && detail.find("[cache miss]") != string::npos, "page reads only the page", __FILE__, __LINE__, query);
+        check(cache.stats().insertions == 0, "partial subtree is not cached", __FILE__, __LINE__, query);
+        // повторный промах: поддерево вычисляется целиком и запоминается, дальше страницы идут из кэша
+        tie(output, detail) = runPage();
+        check(detail.find("[cache miss, stored]") != string::npos && cache.stats().insertions == 1, "repeated miss is cached",
+              __FILE__, __LINE__, query);
+        tie(output, detail) = runPage();
+        check(output == 8 && detail.find("[cache hit]") != string::npos, "page from the cached subtree", __FILE__, __LINE__, query);
+
+        // поддерево, пройденное до конца, кэшируется с первого раза
+        QueryCache full_cache;
+        vector<int> expected = queryResultsPage(QueryParser(query).parse(), parts, 0, 10000, &full_cache);
+        check(full_cache.stats().insertions == 1, "fully read subtree is cached", __FILE__, __LINE__, query);
+        check(queryResultsPage(QueryParser(query).parse(), parts, 0, 10000, &full_cache) == expected &&
+              full_cache.stats().hits == 1, "cached subtree result", __FILE__, __LINE__, query);
+    }
+}
+
+// ---------------------------------------------------------------- снимки и потоки
+
+// снимок не видит ни новых доков, ни удалений, опубликованных после него
+void testSnapshotIsolation() {
+    TextIndexer indexer;
+    int first = indexer.addDocument({{"title", "alpha"}, {"content", "one two"}});
+    indexer.addDocument({{"title", "alpha"}, {"content", "two three"}});
+    indexer.publish();
+    auto before = indexer.snapshot();
+
+    indexer.addDocument({{"title", "alpha"}, {"content", "three four"}});
+    indexer.deleteDocument(first);
+    int updated = indexer.updateDocument(first + 1, {{"title", "beta"}, {"content", "two"}});
+    CHECK(before->executeQuery("alpha").size() == 2);
+    CHECK(indexer.snapshot() == before);
+    CHECK(indexer.executeQuery("alpha").size() == 1);
+
+    indexer.publish();
+    auto after = indexer.snapshot();
+    CHECK(before->executeQuery("alpha") == vector<int>({first, first + 1}));
+    CHECK(before->getDocumentContent(first) == "one two");
+    CHECK(after->executeQuery("alpha").size() == 1);
+    CHECK(after->executeQuery("two") == vector<int>({updated}));
+    CHECK(after->getDocumentContent(first).empty());
+
+    indexer.compact();
+    CHECK(before->executeQuery("two") == vector<int>({first, first + 1}));
+    CHECK(indexer.snapshot()->executeQuery("two") == vector<int>({updated}));
+}
+
+// Читатели берут снимки, пока писатель добавляет, удаляет, публикует, сливает и уплотняет.
+// В каждом доке есть терм common, поэтому внутри любого снимка число его доков равно числу живых доков.
+// Пакет batchN может быть виден частично (фоновое уплотнение публикует накопленные доки писателя),
+// но не больше своего размера
+void testConcurrentReaders() {
+    for (bool compress : {false, true}) {
+        TextIndexer indexer(compress);
+        indexer.setMergePolicy(64, 2);
+        atomic<bool> writing{true};
+        atomic<int> checked{0};
+        const int batches = 60, batch_size = 20;
+
+        vector<thread> readers;
+        for (int r = 0; r < 3; ++r) {
+            readers.emplace_back([&, r] {
+                mt19937 rng(100 + r);
+                while (writing || checked < 10) {
+                    auto snapshot = indexer.snapshot();
+                    size_t live = snapshot->documentCount();
+                    vector<int> common = snapshot->executeQuery("common");
+                    check(common.size() == live, "snapshot common == live docs", __FILE__, __LINE__);
+                    check(is_sorted(common.begin(), common.end()), "sorted results", __FILE__, __LINE__);
+                    int batch = static_cast<int>(rng() % batches);
+                    size_t in_batch = snapshot->countQuery("batch" + to_string(batch));
+                    check(in_batch <= batch_size, "batch size", __FILE__, __LINE__, to_string(in_batch));
+                    snapshot->executeQuery("w1 NEAR/3 common", 5);
+                    checked++;
+                }
+            });
+        }
+
+        mt19937 rng(6);
+        for (int batch = 0; batch < batches; ++batch) {
+            vector<int> doc_ids;
+            for (int i = 0; i < batch_size; ++i) {
+                doc_ids.push_back(indexer.addDocument({{"title", "batch" + to_string(batch)},
+                                                       {"content", "common " + randomText(rng, 2, 10)}}));
+            }
+            // каждый третий пакет наполовину удаляется той же публикацией
+            if (batch % 3 == 0) {
+                for (int i = 0; i < batch_size; i += 2) indexer.deleteDocument(doc_ids[i]);
+            }
+            indexer.publish();
+            if (batch % 10 == 9) indexer.compactInBackground();
+        }
+        indexer.waitForCompaction();
+        writing = false;
+        for (auto& reader : readers) reader.join();
+        CHECK(indexer.snapshot()->countQuery("common") == indexer.documentCount());
+    }
+}
+
+// индексатор разрушается, пока фоновое уплотнение еще идет (раньше деструктор мог зависнуть)
+void testDestroyDuringCompaction() {
+    for (int round = 0; round < 100; ++round) {
+        TextIndexer indexer;
+        indexer.setMergePolicy(4, 2);
+        for (int i = 0; i < 40; ++i) indexer.addDocument({{"title", "t" + to_string(i)}, {"content", "a b " + to_string(i % 7)}});
+        indexer.publish();
+        for (int i = 1; i < 40; i += 2) indexer.deleteDocument(i);
+        indexer.compactInBackground();
+    }
+}
+
+// несколько писателей и читателей: каждый элемент доходит ровно один раз, наибольшая глубина не больше емкости
+void testBoundedQueue() {
+    const int producers = 4, consumers = 2, per_producer = 20000;
+    BoundedQueue<int> queue(8);
+    atomic<long long> sum(0);
+    atomic<int> popped(0);
+    vector<thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (int i = 1; i <= per_producer; ++i) queue.push(p * per_producer + i);
+        });
+    }
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            int value;
+            while (popped.load() < producers * per_producer) {
+                if (!queue.tryPop(value)) {
+                    this_thread::yield();
+                    continue;
+                }
+                sum += value;
+                popped++;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    long long total = static_cast<long long>(producers) * per_producer;
+    CHECK(sum.load() == total * (total + 1) / 2);
+    CHECK(queue.depth() == 0);
+    CHECK(queue.maxDepth() > 0);
+    CHECK(queue.maxDepth() <= queue.capacity());
+}
+
+int main() {
+    const pair<const char*, function<void()>> tests[] = {
+        {"compressed postings", testCompressedPostings},
+        {"position codec", testPositionCodec},
+        {"doc store", testDocStore},
+        {"csv reader", testCsvReader},
+        {"queries against naive evaluation", testQueriesAgainstNaive},
+        {"merged parts", testMergedParts},
+        {"many fields", testManyFields},
+        {"corrupted segment", testCorruptedSegment},
+        {"wide disjunction", testWideDisjunction},
+        {"lazy subtree cache", testLazySubtreeCache},
+        {"snapshot isolation", testSnapshotIsolation},
+        {"concurrent readers", testConcurrentReaders},
+        {"destroy during compaction", testDestroyDuringCompaction},
+        {"bounded queue", testBoundedQueue},
+    };
+    for (const auto& [name, run] : tests) {
+        int before = failures;
+        run();
+        cout << (failures == before ? "ok      " : "FAILED  ") << name << endl;
+    }
+    return failures;
+}
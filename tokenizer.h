@@ -0,0 +1,321 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Токенизация за один проход без копирования: токены - куски string_view исходного текста (UTF-8).
+// Разделители - пробельные символы ASCII (isspace в локали "C": ' ', '\t', '\n', '\v', '\f', '\r'),
+// . , ! ? ; : и пробелы Unicode (неразрывный, U+2000..U+200B, U+2028, U+2029, U+202F, U+205F, U+3000).
+// Текст читается блоками по 64 байта: для блока строится битовая маска разделителей ASCII
+// (AVX2 - два сравнения по 32 байта, SSE2 - четыре по 16, иначе побайтно), а границы токенов
+// внутри блока находятся по маске через ctz, без посимвольных ветвлений.
+// Пробелы Unicode начинаются с байтов 0xC2, 0xE2, 0xE3 - их маска строится тем же проходом,
+// и только такие позиции (в кириллице их нет) разбираются поштучно
+
+inline bool isDelimiter(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || c == '.' || c == ',' || c == '!' || c == '?' || c == ';' || c == ':';
+}
+
+// код символа UTF-8 в начале data и его длина в байтах; 0 - битая или неполная последовательность
+inline int decodeUtf8(const unsigned char* data, size_t size, uint32_t& code_point) {
+    unsigned char lead = data[0];
+    if (lead < 0x80) {
+        code_point = lead;
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        if (size < 2 || (data[1] & 0xC0) != 0x80) return 0;
+        code_point = (lead & 0x1F) << 6 | (data[1] & 0x3F);
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        if (size < 3 || (data[1] & 0xC0) != 0x80 || (data[2] & 0xC0) != 0x80) return 0;
+        code_point = (lead & 0x0F) << 12 | (data[1] & 0x3F) << 6 | (data[2] & 0x3F);
+        // слишком длинная запись и суррогаты недопустимы
+        if (code_point < 0x800 || (code_point >= 0xD800 && code_point <= 0xDFFF)) return 0;
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        if (size < 4 || (data[1] & 0xC0) != 0x80 || (data[2] & 0xC0) != 0x80 || (data[3] & 0xC0) != 0x80) return 0;
+        code_point = (lead & 0x07) << 18 | (data[1] & 0x3F) << 12 | (data[2] & 0x3F) << 6 | (data[3] & 0x3F);
+        if (code_point < 0x10000 || code_point > 0x10FFFF) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+// длина пробела Unicode в начале data или 0
+inline int unicodeSpaceLength(const char* data, size_t size) {
+    unsigned char lead = data[0];
+    if (lead != 0xC2 && lead != 0xE2 && lead != 0xE3) return 0;
+    uint32_t code_point;
+    int length = decodeUtf8(reinterpret_cast<const unsigned char*>(data), size, code_point);
+    if (!length) return 0;
+    bool is_space = code_point == 0xA0 || (code_point >= 0x2000 && code_point <= 0x200B) || code_point == 0x2028 ||
+                    code_point == 0x2029 || code_point == 0x202F || code_point == 0x205F || code_point == 0x3000;
+    return is_space ? length : 0;
+}
+
+#if defined(__AVX2__)
+// бит i delimiters - байт data[i] разделитель ASCII, бит i leads - с него может начинаться пробел Unicode
+inline void classifyBlock32(const char* data, uint32_t& delimiters, uint32_t& leads) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    // ' ' и '!', ':' и ';' - соседние коды, '\t'..'\r' - непрерывный диапазон (байты >= 0x80 отрицательны и не попадают)
+    auto inRange = [&](char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(lo - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), bytes));
+    };
+    auto equals = [&](char value) { return _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(value)); };
+    __m256i mask = _mm256_or_si256(inRange('\t', '\r'), inRange(' ', '!'));
+    mask = _mm256_or_si256(mask, inRange(':', ';'));
+    mask = _mm256_or_si256(mask, _mm256_or_si256(equals('.'), _mm256_or_si256(equals(','), equals('?'))));
+    delimiters = static_cast<uint32_t>(_mm256_movemask_epi8(mask));
+    // 0xE2 и 0xE3 отличаются последним битом
+    __m256i lead = _mm256_or_si256(equals(static_cast<char>(0xC2)),
+                                   _mm256_cmpeq_epi8(_mm256_or_si256(bytes, _mm256_set1_epi8(1)),
+                                                     _mm256_set1_epi8(static_cast<char>(0xE3))));
+    leads = static_cast<uint32_t>(_mm256_movemask_epi8(lead));
+}
+
+inline void classifyBlock64(const char* data, uint64_t& delimiters, uint64_t& leads) {
+    uint32_t low_delimiters, low_leads, high_delimiters, high_leads;
+    classifyBlock32(data, low_delimiters, low_leads);
+    classifyBlock32(data + 32, high_delimiters, high_leads);
+    delimiters = low_delimiters | static_cast<uint64_t>(high_delimiters) << 32;
+    leads = low_leads | static_cast<uint64_t>(high_leads) << 32;
+}
+#elif defined(__SSE2__)
+inline void classifyBlock16(const char* data, uint32_t& delimiters, uint32_t& leads) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    auto inRange = [&](char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(hi + 1)));
+    };
+    auto equals = [&](char value) { return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)); };
+    __m128i mask = _mm_or_si128(inRange('\t', '\r'), inRange(' ', '!'));
+    mask = _mm_or_si128(mask, inRange(':', ';'));
+    mask = _mm_or_si128(mask, _mm_or_si128(equals('.'), _mm_or_si128(equals(','), equals('?'))));
+    delimiters = static_cast<uint32_t>(_mm_movemask_epi8(mask));
+    __m128i lead = _mm_or_si128(equals(static_cast<char>(0xC2)),
+                                _mm_cmpeq_epi8(_mm_or_si128(bytes, _mm_set1_epi8(1)), _mm_set1_epi8(static_cast<char>(0xE3))));
+    leads = static_cast<uint32_t>(_mm_movemask_epi8(lead));
+}
+
+inline void classifyBlock64(const char* data, uint64_t& delimiters, uint64_t& leads) {
+    delimiters = 0;
+    leads = 0;
+    for (int part = 0; part < 4; ++part) {
+        uint32_t part_delimiters, part_leads;
+        classifyBlock16(data + 16 * part, part_delimiters, part_leads);
+        delimiters |= static_cast<uint64_t>(part_delimiters) << (16 * part);
+        leads |= static_cast<uint64_t>(part_leads) << (16 * part);
+    }
+}
+#else
+inline void classifyBlock64(const char* data, uint64_t& delimiters, uint64_t& leads) {
+    delimiters = 0;
+    leads = 0;
+    for (int i = 0; i < 64; ++i) {
+        unsigned char c = data[i];
+        delimiters |= static_cast<uint64_t>(isDelimiter(c)) << i;
+        leads |= static_cast<uint64_t>(c == 0xC2 || c == 0xE2 || c == 0xE3) << i;
+    }
+}
+#endif
+
+// on_token(string_view) для каждого токена по порядку
+template <typename Fn>
+void forEachToken(string_view text, Fn&& on_token) {
+    const char* data = text.data();
+    size_t size = text.size();
+    size_t token_start = 0;
+    bool in_token = false;
+    // хвост пробела Unicode, начатого в конце предыдущего блока (биты первых байтов блока)
+    uint64_t carry = 0;
+
+    size_t base = 0;
+    for (; base + 64 <= size; base += 64) {
+        uint64_t delimiters, leads;
+        classifyBlock64(data + base, delimiters, leads);
+        delimiters |= carry;
+        carry = 0;
+        while (leads) {
+            int at = __builtin_ctzll(leads);
+            leads &= leads - 1;
+            int length = unicodeSpaceLength(data + base + at, size - base - at);
+            if (!length) continue;
+            uint64_t bits = (uint64_t(1) << length) - 1;
+            delimiters |= bits << at;
+            if (at + length > 64) carry = bits >> (64 - at);
+        }
+
+        uint64_t token_bits = ~delimiters;
+        // позиции блока, которые еще не разобраны
+        uint64_t pending = ~uint64_t(0);
+        while (true) {
+            if (in_token) {
+                uint64_t ends = ~token_bits & pending;
+                if (!ends) break; // токен продолжается в следующем блоке
+                int end = __builtin_ctzll(ends);
+                on_token(string_view(data + token_start, base + end - token_start));
+                in_token = false;
+                if (end == 63) break;
+                pending = ~uint64_t(0) << (end + 1);
+            } else {
+                uint64_t starts = token_bits & pending;
+                if (!starts) break;
+                int start = __builtin_ctzll(starts);
+                token_start = base + start;
+                in_token = true;
+                pending = ~uint64_t(0) << start;
+            }
+        }
+    }
+
+    // хвост короче блока (токен перед перенесенным пробелом уже закончен)
+    for (size_t i = base + __builtin_popcountll(carry); i < size;) {
+        int length = isDelimiter(data[i]) ? 1 : unicodeSpaceLength(data + i, size - i);
+        if (length) {
+            if (in_token) on_token(string_view(data + token_start, i - token_start));
+            in_token = false;
+            i += length;
+        } else {
+            if (!in_token) {
+                token_start = i;
+                in_token = true;
+            }
+            i++;
+        }
+    }
+    if (in_token) on_token(string_view(data + token_start, size - token_start));
+}
+
+inline vector<string_view> tokenize(string_view text) {
+    vector<string_view> tokens;
+    forEachToken(text, [&](string_view token) { tokens.push_back(token); });
+    return tokens;
+}
+
+// Таблица свертки регистра для символов U+0000..U+07FF (однобайтные и двухбайтные в UTF-8):
+// код в нижнем регистре или 0, если символ не входит в терм (пунктуация, знаки, диакритика).
+// Латиница, Latin-1, Latin Extended-A, греческий, кириллица и армянский сворачиваются в нижний регистр,
+// остальные буквы этого диапазона остаются как есть. Ё сворачивается в е, как принято в русском поиске
+struct CaseFoldTable {
+    uint16_t fold[0x800];
+
+    constexpr CaseFoldTable() : fold() {
+        for (uint32_t c = 0; c < 0x800; ++c) fold[c] = static_cast<uint16_t>(c);
+        // ASCII: буквы и цифры
+        for (uint32_t c = 0; c < 0x80; ++c) {
+            bool is_alnum = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+            fold[c] = is_alnum ? static_cast<uint16_t>(c >= 'A' && c <= 'Z' ? c + 0x20 : c) : 0;
+        }
+        // Latin-1: управляющие символы и знаки U+0080..U+00BF, × и ÷
+        for (uint32_t c = 0x80; c < 0xC0; ++c) fold[c] = 0;
+        fold[0xD7] = fold[0xF7] = 0;
+        for (uint32_t c = 0xC0; c <= 0xDE; ++c) {
+            if (c != 0xD7) fold[c] = static_cast<uint16_t>(c + 0x20);
+        }
+        // Latin Extended-A: пары заглавная/строчная
+        for (uint32_t c = 0x100; c < 0x180; ++c) {
+            bool upper_even = (c < 0x138 && c != 0x130 && c != 0x131) || (c >= 0x14A && c < 0x178);
+            bool upper_odd = (c >= 0x139 && c < 0x149) || (c >= 0x179 && c < 0x17F);
+            if ((upper_even && c % 2 == 0) || (upper_odd && c % 2 == 1)) fold[c] = static_cast<uint16_t>(c + 1);
+        }
+        fold[0x130] = 'i';
+        fold[0x178] = 0xFF;
+        // комбинируемая диакритика (ударения и т.п.)
+        for (uint32_t c = 0x300; c < 0x370; ++c) fold[c] = 0;
+        // греческий
+        for (uint32_t c = 0x391; c <= 0x3A9; ++c) {
+            if (c != 0x3A2) fold[c] = static_cast<uint16_t>(c + 0x20);
+        }
+        fold[0x386] = 0x3AC;
+        for (uint32_t c = 0x388; c <= 0x38A; ++c) fold[c] = static_cast<uint16_t>(c + 0x25);
+        fold[0x38C] = 0x3CC;
+        fold[0x38E] = 0x3CD;
+        fold[0x38F] = 0x3CE;
+        fold[0x374] = fold[0x375] = fold[0x37E] = fold[0x384] = fold[0x385] = fold[0x387] = 0;
+        // кириллица
+        for (uint32_t c = 0x400; c < 0x410; ++c) fold[c] = static_cast<uint16_t>(c + 0x50);
+        for (uint32_t c = 0x410; c < 0x430; ++c) fold[c] = static_cast<uint16_t>(c + 0x20);
+        fold[0x401] = fold[0x451] = 0x435;
+        for (uint32_t c = 0x460; c < 0x482; c += 2) fold[c] = static_cast<uint16_t>(c + 1);
+        for (uint32_t c = 0x482; c < 0x48A; ++c) fold[c] = 0;
+        for (uint32_t c = 0x48A; c < 0x4C0; c += 2) fold[c] = static_cast<uint16_t>(c + 1);
+        fold[0x4C0] = 0x4CF;
+        for (uint32_t c = 0x4C1; c < 0x4CF; c += 2) fold[c] = static_cast<uint16_t>(c + 1);
+        for (uint32_t c = 0x4D0; c < 0x530; c += 2) fold[c] = static_cast<uint16_t>(c + 1);
+        // армянский
+        for (uint32_t c = 0x531; c <= 0x556; ++c) fold[c] = static_cast<uint16_t>(c + 0x30);
+        for (uint32_t c = 0x559; c <= 0x55F; ++c) fold[c] = 0;
+        fold[0x589] = fold[0x58A] = 0;
+    }
+};
+
+inline constexpr CaseFoldTable CASE_FOLD{};
+
+// символы от U+0800, которые не входят в термы: пунктуация и знаки, селекторы вариантов, BOM, эмодзи
+inline bool isIgnoredCodePoint(uint32_t code_point) {
+    return (code_point >= 0x2000 && code_point <= 0x2BFF) || (code_point >= 0x3000 && code_point <= 0x303F) ||
+           (code_point >= 0xFE00 && code_point <= 0xFE0F) || code_point == 0xFEFF || (code_point >= 0xFFF0 && code_point <= 0xFFFF) ||
+           (code_point >= 0x1F000 && code_point <= 0x1FAFF);
+}
+
+// нормализация терма в переиспользуемый буфер: остаются буквы и цифры в нижнем регистре (UTF-8).
+// ASCII разбирается по таблице без декодирования; результат не длиннее терма, поэтому пишется на месте.
+// Битые байты UTF-8 отбрасываются, разложенная й (и + U+0306) собирается обратно
+inline void normalizeTerm(string_view term, string& out) {
+    out.resize(term.size());
+    char* write = out.data();
+    const unsigned char* read = reinterpret_cast<const unsigned char*>(term.data());
+    const unsigned char* end = read + term.size();
+    while (read < end) {
+        if (*read < 0x80) {
+            uint16_t folded = CASE_FOLD.fold[*read++];
+            if (folded) *write++ = static_cast<char>(folded);
+            continue;
+        }
+
+        uint32_t code_point;
+        int length = decodeUtf8(read, end - read, code_point);
+        if (!length) {
+            read++;
+            continue;
+        }
+        read += length;
+        if (code_point >= 0x800) {
+            if (isIgnoredCodePoint(code_point)) continue;
+            for (const unsigned char* byte = read - length; byte < read; ++byte) *write++ = static_cast<char>(*byte);
+            continue;
+        }
+        if (code_point == 0x306 && write - out.data() >= 2 && write[-2] == '\xD0' && write[-1] == '\xB8') {
+            write[-1] = '\xB9';
+            continue;
+        }
+        uint16_t folded = CASE_FOLD.fold[code_point];
+        if (folded >= 0x80) {
+            *write++ = static_cast<char>(0xC0 | folded >> 6);
+            *write++ = static_cast<char>(0x80 | (folded & 0x3F));
+        } else if (folded) {
+            *write++ = static_cast<char>(folded);
+        }
+    }
+    out.resize(write - out.data());
+}
+
+// нормализация терма
+inline string normalizeTerm(string_view term) {
+    string result;
+    normalizeTerm(term, result);
+    return result;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "search_class.h"
+#include "corpus_generator.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace chrono;
+
+// Воспроизводимый прогон: синтетический корпус (corpus_generator.h) и файлы с запросами.
+//   workload_benchmark [параметр=значение ...] workloads/boolean.txt workloads/fields.txt ...
+// Параметры корпуса: docs, vocabulary, zipf, seed, field=имя:доля:fixed|uniform|lognormal:a:b
+// (каждый field заменяет набор полей по умолчанию). Индекс: compress=0|1, threads, batch.
+// Запросы: repeat (проходов по файлу), warmup (проходов без замера), mode=all|count|top:K, cache=0|1.
+// В файле запросов - по запросу в строке, пустые строки и строки с '#' в начале пропускаются
+
+struct WorkloadOptions {
+    CorpusOptions corpus;
+    size_t doc_count = 100000;
+    bool compress = false;
+    int threads = 0;
+    size_t batch_size = 10000;
+    size_t repeat = 5;
+    size_t warmup = 1;
+    // all - все doc_id, count - только число, top - лучшие top_k по BM25
+    string mode = "all";
+    size_t top_k = 10;
+    bool cache = false;
+    vector<string> workloads;
+};
+
+bool parseField(const string& value, FieldSpec& field) {
+    vector<string> parts;
+    stringstream stream(value);
+    string part;
+    while (getline(stream, part, ':')) parts.push_back(part);
+    if (parts.size() != 5) return false;
+    field.name = parts[0];
+    field.probability = stod(parts[1]);
+    if (parts[2] == "fixed") field.distribution = LengthDistribution::FIXED;
+    else if (parts[2] == "uniform") field.distribution = LengthDistribution::UNIFORM;
+    else if (parts[2] == "lognormal") field.distribution = LengthDistribution::LOGNORMAL;
+    else return false;
+    field.a = stod(parts[3]);
+    field.b = stod(parts[4]);
+    return true;
+}
+
+bool parseArguments(int argc, char** argv, WorkloadOptions& options) {
+    bool custom_fields = false;
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        size_t eq = argument.find('=');
+        if (eq == string::npos) {
+            options.workloads.push_back(argument);
+            continue;
+        }
+        string key = argument.substr(0, eq);
+        string value = argument.substr(eq + 1);
+        if (key == "docs") options.doc_count = stoull(value);
+        else if (key == "vocabulary") options.corpus.vocabulary_size = stoull(value);
+        else if (key == "zipf") options.corpus.zipf_exponent = stod(value);
+        else if (key == "seed") options.corpus.seed = stoull(value);
+        else if (key == "compress") options.compress = value != "0";
+        else if (key == "threads") options.threads = stoi(value);
+        else if (key == "batch") options.batch_size = max<size_t>(1, stoull(value));
+        else if (key == "repeat") options.repeat = max<size_t>(1, stoull(value));
+        else if (key == "warmup") options.warmup = stoull(value);
+        else if (key == "cache") options.cache = value != "0";
+        else if (key == "mode") {
+            options.mode = value;
+            if (value.rfind("top:", 0) == 0) {
+                options.mode = "top";
+                options.top_k = stoull(value.substr(4));
+            } else if (value != "all" && value != "count") {
+                cerr << "unknown mode " << value << endl;
+                return false;
+            }
+        } else if (key == "field") {
+            if (!custom_fields) options.corpus.fields.clear();
+            custom_fields = true;
+            FieldSpec field;
+            if (!parseField(value, field)) {
+                cerr << "bad field spec " << value << " (expected name:probability:distribution:a:b)" << endl;
+                return false;
+            }
+            options.corpus.fields.push_back(field);
+        } else {
+            cerr << "unknown parameter " << key << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<string> readWorkload(const string& path) {
+    vector<string> queries;
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        queries.push_back(line);
+    }
+    return queries;
+}
+
+// пиковый резидентный объем процесса (ru_maxrss в Linux - в килобайтах)
+double peakRssMegabytes() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// p-й процентиль по отсортированным замерам (ближайший ранг)
+double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+    return sorted[min(sorted.size(), max<size_t>(1, rank)) - 1];
+}
+
+size_t runQuery(TextIndexer& indexer, const string& query, const WorkloadOptions& options) {
+    if (options.mode == "count") return indexer.countQuery(query);
+    if (options.mode == "top") return indexer.executeQuery(query, options.top_k).size();
+    return indexer.executeQuery(query).size();
+}
+
+void runWorkload(TextIndexer& indexer, const string& path, const WorkloadOptions& options) {
+    vector<string> queries = readWorkload(path);
+    if (queries.empty()) {
+        cout << path << "\tno queries" << endl;
+        return;
+    }
+    for (size_t pass = 0; pass < options.warmup; ++pass) {
+        for (const string& query : queries) runQuery(indexer, query, options);
+    }
+
+    vector<double> samples;
+    samples.reserve(queries.size() * options.repeat);
+    size_t results = 0;
+    auto total_start = steady_clock::now();
+    for (size_t pass = 0; pass < options.repeat; ++pass) {
+        for (const string& query : queries) {
+            auto start_time = steady_clock::now();
+            results += runQuery(indexer, query, options);
+            samples.push_back(duration<double, micro>(steady_clock::now() - start_time).count());
+        }
+    }
+    double total_seconds = duration<double>(steady_clock::now() - total_start).count();
+
+    sort(samples.begin(), samples.end());
+    cout << path << "\t" << queries.size() << "\t" << samples.size() << "\t" << samples.size() / total_seconds << "\t"
+         << percentile(samples, 50) << "\t" << percentile(samples, 95) << "\t" << percentile(samples, 99) << "\t"
+         << samples.back() << "\t" << static_cast<double>(results) / samples.size() << endl;
+}
+
+int main(int argc, char** argv) {
+    WorkloadOptions options;
+    if (!parseArguments(argc, argv, options)) return 1;
+
+    cout << "corpus: " << options.doc_count << " docs, vocabulary " << options.corpus.vocabulary_size << ", zipf "
+         << options.corpus.zipf_exponent << ", seed " << options.corpus.seed << ", fields";
+    for (const FieldSpec& field : options.corpus.fields) cout << " " << field.name;
+    cout << endl;
+
+    TextIndexer indexer(options.compress);
+    indexer.setQueryCacheCapacity(options.cache ? DEFAULT_QUERY_CACHE_BYTES : 0);
+
+    // генерация корпуса в замер индексации не входит
+    CorpusGenerator generator(options.corpus);
+    double index_seconds = 0;
+    indexer.beginBulkLoad();
+    for (size_t generated = 0; generated < options.doc_count;) {
+        auto batch = generator.nextBatch(min(options.batch_size, options.doc_count - generated));
+        generated += batch.size();
+        auto start_time = steady_clock::now();
+        indexer.addDocuments(batch, options.threads);
+        index_seconds += duration<double>(steady_clock::now() - start_time).count();
+    }
+    auto start_time = steady_clock::now();
+    indexer.commit();
+    indexer.waitForMerges();
+    index_seconds += duration<double>(steady_clock::now() - start_time).count();
+
+    size_t postings = indexer.postingCount();
+    size_t posting_bytes = indexer.postingMemoryBytes();
+    size_t positional_bytes = indexer.positionalMemoryBytes();
+    cout << "indexing: " << index_seconds * 1000 << " ms, " << options.doc_count / index_seconds << " docs/s" << endl;
+    cout << "index: " << postings << " postings, doc_id lists " << static_cast<double>(posting_bytes) / max<size_t>(1, postings)
+         << " bytes/posting, positions " << static_cast<double>(positional_bytes) / max<size_t>(1, postings)
+         << " bytes/posting" << endl;
+    cout << "peak RSS after indexing: " << peakRssMegabytes() << " MB" << endl;
+
+    cout << "\nqueries (" << options.mode;
+    if (options.mode == "top") cout << " " << options.top_k;
+    cout << ", cache " << (options.cache ? "on" : "off") << ", " << options.warmup << " warmup + " << options.repeat
+         << " measured passes, us per query)" << endl;
+    cout << "workload\tqueries\truns\tQPS\tp50\tp95\tp99\tmax\tavg results" << endl;
+    for (const string& path : options.workloads) runWorkload(indexer, path, options);
+    cout << "peak RSS: " << peakRssMegabytes() << " MB" << endl;
+    return 0;
+}